@@ -1,30 +1,74 @@
 #include <Arduino.h>
 #include <Arduino_FreeRTOS.h>
 #include <semphr.h> // add the FreeRTOS functions for Semaphores (or Flags).
+#include <queue.h>
+#include <Gpio.h>
+#ifdef BENCHMARK
+#include <CycleProbe.h>
+#endif
 
-#define LEDPIN1 PB5 // 11
-#define LEDPIN2 PB6 // 12
-#define LEDPIN3 PB7 // 13
+typedef Pin<PortB, PB5> Led1; // 11
+typedef Pin<PortB, PB6> Led2; // 12
+typedef Pin<PortB, PB7> Led3; // 13
+typedef PinGroup<Led1, Led2, Led3> Leds;
 
 /*
 Reference:
   FreeRTOS\examples\AnalogRead_DigitalRead
   FreeRTOS\examples\Blink_AnalogRead
 
-Improvements:
-  Tasks 1-3 are identical, they could be simplified to TaskLed(LEDPINX)
+Periodic jobs:
+  The three identical LED tasks are replaced by one task running a table of
+  periodic jobs. Every job shares the stack of TaskPeriodicJobs, so adding a
+  blinker costs one PeriodicJob entry (7 bytes) instead of a TCB and a stack.
+  See README.md for the RAM comparison.
+
+  Jobs hand their messages to TaskPrinter through printQueue, the Serial port at
+  9600 baud would otherwise hold up every job behind the one printing.
 */
 
 // Declare a mutex Semaphore Handle which we will use to manage the Serial Port.
 // It will be used to ensure only one Task is accessing this resource at any time.
 SemaphoreHandle_t xSerialSemaphore;
 
+// LED pins whose "on" message is waiting for TaskPrinter
+#define PRINT_QUEUE_LENGTH 8
+QueueHandle_t printQueue;
+
+// A periodic job is run by TaskPeriodicJobs every period ticks.
+// It must not block, all jobs are run from the same task. Prints go through printQueue.
+typedef void (*JobFunction_t)(uint8_t arg);
+
+struct PeriodicJob
+{
+  JobFunction_t run; // Job body
+  uint8_t arg;       // Argument passed to the body, e.g. LED pin
+  TickType_t period; // Ticks between two runs
+  TickType_t next;   // Tick of the next run
+};
+
 // Function declarations
-void TaskLED1(void *pvParameters);
-void TaskLED2(void *pvParameters);
-void TaskLED3(void *pvParameters);
+void TaskPeriodicJobs(void *pvParameters);
+void TaskPrinter(void *pvParameters);
+template <class Led>
+void toggleLed(uint8_t pin);
 void printMessage(String msg);
 
+// Blinkers, the LED is toggled every period so one on/off cycle takes two periods.
+// Adding a row here and its pin to Leds is all it takes to add a blinker.
+static PeriodicJob jobs[] = {
+    {toggleLed<Led1>, Led1::bit, 1000 / portTICK_PERIOD_MS, 0}, // wait for one second
+    {toggleLed<Led2>, Led2::bit, 2000 / portTICK_PERIOD_MS, 0}, // wait for 2 second
+    {toggleLed<Led3>, Led3::bit, 3000 / portTICK_PERIOD_MS, 0}, // wait for 3 second
+};
+#define JOB_COUNT (sizeof(jobs) / sizeof(jobs[0]))
+
+#ifdef BENCHMARK
+PROBE(job_run);
+PROBE(print_message);
+static void benchPrint(const char *str) { Serial.print(str); }
+#endif
+
 void setup()
 {
   // put your setup code here, to run once:
@@ -47,28 +91,26 @@ void setup()
       xSemaphoreGive((xSerialSemaphore)); // Make the Serial Port available for use, by "Giving" the Semaphore.
   }
 
-  xTaskCreate(
-      TaskLED1,
-      "BlinkLED1" /*A name just for humans*/,
-      128 /*This stack size can be checked & adjusted by reading the Stack Highwater*/,
-      NULL,
-      2 /*Priority, with 3 (configMAX_PRIORITIES - 1) being the highest, and 0 being the lowest.*/,
-      NULL);
+  printQueue = xQueueCreate(PRINT_QUEUE_LENGTH, sizeof(uint8_t));
+
+#ifdef BENCHMARK
+  probeBegin(benchPrint);
+#endif
 
   xTaskCreate(
-      TaskLED2,
-      "BlinkLED2" /*A name just for humans*/,
+      TaskPeriodicJobs,
+      "Jobs" /*A name just for humans*/,
       128 /*This stack size can be checked & adjusted by reading the Stack Highwater*/,
       NULL,
       2 /*Priority, with 3 (configMAX_PRIORITIES - 1) being the highest, and 0 being the lowest.*/,
       NULL);
 
   xTaskCreate(
-      TaskLED3,
-      "BlinkLED3" /*A name just for humans*/,
-      128 /*This stack size can be checked & adjusted by reading the Stack Highwater*/,
+      TaskPrinter,
+      "Printer",
+      128,
       NULL,
-      2 /*Priority, with 3 (configMAX_PRIORITIES - 1) being the highest, and 0 being the lowest.*/,
+      1, // Below the jobs, printing never delays a release
       NULL);
 
   vTaskStartScheduler();
@@ -80,101 +122,97 @@ void loop()
   // Dis empty lol
 }
 
-void TaskLED1(void *pvParameters __attribute__((unused))) // This is a Task.
+void TaskPeriodicJobs(void *pvParameters __attribute__((unused))) // This is a Task.
 {
   /*
-  Task for blinking 1st led
+  Task running every job in the jobs table.
+  Releases are kept in absolute ticks, so a late run does not push the following ones.
   */
+  TickType_t now = xTaskGetTickCount();
+  TickType_t wake = now; // Earliest release, xTaskDelayUntil sleeps until it
 
-  // Setup LEDPIN1 as output
-  // pinMode(LEDPIN1, OUTPUT);
-  DDRB |= _BV(LEDPIN1);
+  // Setup LED pins as output
+  Leds::output();
+  for (uint8_t i = 0; i < JOB_COUNT; i++)
+  {
+    // First run is right away
+    jobs[i].next = now;
+  }
 
   // Safe Serial.print()
-  printMessage("Starting Task1");
+  printMessage("Starting periodic jobs");
 
   for (;;) // A Task shall never return or exit.
   {
-    printMessage("Task1 triggered");
-
-    // turn the LED on (HIGH is the voltage level)
-    // digitalWrite(LEDPIN1, HIGH);
-    PORTB |= _BV(LEDPIN1);
-
-    vTaskDelay(1000 / portTICK_PERIOD_MS); // wait for one second
-
-    // turn the LED off by making the voltage LOW
-    // digitalWrite(LEDPIN1, LOW);
-    PORTB &= _BV(LEDPIN1);
-
-    vTaskDelay(1000 / portTICK_PERIOD_MS); // wait for one second
+    TickType_t sleep = portMAX_DELAY;
+    now = xTaskGetTickCount();
+    wake = now;
+
+    for (uint8_t i = 0; i < JOB_COUNT; i++)
+    {
+      // Wrap-safe "now >= next", a job is due when it is less than half the tick range late
+      if ((TickType_t)(now - jobs[i].next) < (portMAX_DELAY / 2))
+      {
+#ifdef BENCHMARK
+        PROBE_START(job_run);
+#endif
+        jobs[i].run(jobs[i].arg);
+#ifdef BENCHMARK
+        PROBE_STOP(job_run);
+#endif
+        // Skip releases that were missed while the job was late
+        do
+        {
+          jobs[i].next += jobs[i].period;
+        } while ((TickType_t)(now - jobs[i].next) < (portMAX_DELAY / 2));
+      }
+      // Sleep until the earliest release
+      TickType_t remaining = jobs[i].next - now;
+      if (remaining < sleep)
+      {
+        sleep = remaining;
+      }
+    }
+
+    // Counted from the tick the jobs were checked at, not from their end, so the time
+    // the jobs took does not add to the sleep
+    xTaskDelayUntil(&wake, sleep);
   }
 }
 
-void TaskLED2(void *pvParameters __attribute__((unused))) // This is a Task.
+template <class Led>
+void toggleLed(uint8_t pin)
 {
-  /*
-  Task for blinking 2st led
-  */
-
-  // Setup LEDPIN2 as output
-  // pinMode(LEDPIN2, OUTPUT);
-  DDRB |= _BV(LEDPIN2);
-
-  // Safe Serial.print()
-  printMessage("Starting Task2");
+  // Change between high and low every time the job is run
+  Led::toggle();
 
-  for (;;) // A Task shall never return or exit.
+  if (Led::driven())
   {
-    printMessage("Task2 triggered");
-
-    // turn the LED on (HIGH is the voltage level)
-    // digitalWrite(LEDPIN2, HIGH);
-    PORTB |= _BV(LEDPIN2);
-
-    vTaskDelay(2000 / portTICK_PERIOD_MS); // wait for 2 second
-
-    // turn the LED off by making the voltage LOW
-    // digitalWrite(LEDPIN2, LOW);
-    PORTB &= _BV(LEDPIN2);
-
-    vTaskDelay(2000 / portTICK_PERIOD_MS); // wait for 2 second
+    // Dropped if the printer is behind, a job never waits
+    xQueueSend(printQueue, &pin, 0);
   }
 }
 
-void TaskLED3(void *pvParameters __attribute__((unused))) // This is a Task.
+void TaskPrinter(void *pvParameters __attribute__((unused)))
 {
   /*
-  Task for blinking 3st led
+  Prints the messages of the jobs, blocking on the Serial port instead of them.
   */
-
-  // Setup LEDPIN3 as output
-  // pinMode(LEDPIN3, OUTPUT);
-  DDRB |= _BV(LEDPIN3);
-
-  // Safe Serial.print()
-  printMessage("Starting Task3");
-
-  for (;;) // A Task shall never return or exit.
+  uint8_t pin;
+  for (;;)
   {
-    printMessage("Task3 triggered");
-
-    // turn the LED on (HIGH is the voltage level)
-    // digitalWrite(LEDPIN3, HIGH);
-    PORTB |= _BV(LEDPIN3);
-
-    vTaskDelay(3000 / portTICK_PERIOD_MS); // wait for 3 second
-
-    // turn the LED off by making the voltage LOW
-    // digitalWrite(LEDPIN3, LOW);
-    PORTB &= _BV(LEDPIN3);
-
-    vTaskDelay(3000 / portTICK_PERIOD_MS); // wait for 3 second
+    if (xQueueReceive(printQueue, &pin, portMAX_DELAY) == pdTRUE)
+    {
+      printMessage("LED " + String(pin) + " on");
+    }
   }
 }
 
 void printMessage(String msg)
 {
+#ifdef BENCHMARK
+  PROBE_START(print_message);
+#endif
   if (xSemaphoreTake(xSerialSemaphore, (TickType_t)5) == pdTRUE)
   {
     // We were able to obtain or "Take" the semaphore and can now access the shared resource.
@@ -184,4 +222,7 @@ void printMessage(String msg)
 
     xSemaphoreGive(xSerialSemaphore); // Now free or "Give" the Serial Port for others.
   }
+#ifdef BENCHMARK
+  PROBE_STOP(print_message);
+#endif
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 #include <Arduino_FreeRTOS.h>
 #include <queue.h>
 #include <event_groups.h>
+#ifdef BENCHMARK
+#include <CycleProbe.h>
+#endif
 
 #define TASK_BIT_1 (1 << 0)
 #define TASK_BIT_2 (1 << 1)
@@ -16,6 +19,11 @@
 // Global variables
 EventGroupHandle_t event_group;
 
+#ifdef BENCHMARK
+PROBE(event_set);
+static void benchPrint(const char *str) { Serial.print(str); }
+#endif
+
 // put function declarations here:
 void TaskEventSetter5s(void *pvParameters);
 void TaskEventSetter25s(void *pvParameters);
@@ -25,6 +33,10 @@ void setup()
 {
   // put your setup code here, to run once:
   event_group = xEventGroupCreate();
+#ifdef BENCHMARK
+  Serial.begin(9600);
+  probeBegin(benchPrint);
+#endif
 
   if (event_group != NULL)
   {
@@ -70,7 +82,13 @@ void TaskEventSetter5s(void *pvParameters)
 
   for (;;)
   {
+#ifdef BENCHMARK
+    PROBE_START(event_set);
+#endif
     xEventGroupSetBits(event_group, TASK_BIT_1);
+#ifdef BENCHMARK
+    PROBE_STOP(event_set);
+#endif
     value++;
     vTaskDelay(5000);
   }
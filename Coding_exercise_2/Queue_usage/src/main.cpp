@@ -1,10 +1,19 @@
 #include <Arduino.h>
 #include <Arduino_FreeRTOS.h>
 #include <queue.h>
+#ifdef BENCHMARK
+#include <CycleProbe.h>
+#endif
 
 // Global variables
 QueueHandle_t integerQueue;
 
+#ifdef BENCHMARK
+PROBE(queue_send);
+PROBE(queue_to_receiver); // Send until the receiver has the item, includes the context switch
+static void benchPrint(const char *str) { Serial.print(str); }
+#endif
+
 // put function declarations here:
 void TaskSender(void *pvParameters);
 void TaskReceiver(void *pvParameters);
@@ -17,6 +26,10 @@ void setup()
    * Create a queue.
    * https://www.freertos.org/a00116.html
    */
+#ifdef BENCHMARK
+  Serial.begin(9600);
+  probeBegin(benchPrint);
+#endif
   integerQueue = xQueueCreate(10, /*Queue length*/
                               sizeof(int) /*Queue item size*/);
 
@@ -57,7 +70,14 @@ void TaskSender(void *pvParameters)
 
   for (;;)
   {
+#ifdef BENCHMARK
+    PROBE_START(queue_to_receiver);
+    PROBE_START(queue_send);
+#endif
     xQueueSend(integerQueue, &value, portMAX_DELAY);
+#ifdef BENCHMARK
+    PROBE_STOP(queue_send);
+#endif
     value++;
     vTaskDelay(1000);
   }
@@ -85,6 +105,9 @@ void TaskReceiver(void *pvParameters)
      * https://www.freertos.org/a00118.html
      */
     if (xQueueReceive(integerQueue, &valueFromQueue, portMAX_DELAY) == pdPASS) {
+#ifdef BENCHMARK
+      PROBE_STOP(queue_to_receiver);
+#endif
       Serial.println(valueFromQueue);
     }
   }
@@ -3,35 +3,84 @@
 #include <timers.h>
 #include <task.h>
 #include <semphr.h>
+#include <Gpio.h>
+#ifdef BENCHMARK
+#include <CycleProbe.h>
+#endif
 
 /*Define LED pin here*/
-#define LEDPIN PB5 // 11
+typedef Pin<PortB, PB5> Led; // 11
 /*Macros for Serial.print()*/
 #define write(msg) ThreadSafePrintMessage(msg, 0)
 #define writeLine(msg) ThreadSafePrintMessage(msg, 1)
 
 /*
 https://microcontrollerslab.com/freertos-create-software-timers-with-arduino/
+
+Every timer callback runs in the timer daemon task, one after the other, so a callback
+that blocks delays every timer due after it. Printing does: the callback waits for the
+Serial mutex, and Serial.print waits for room in its buffer at 9600 baud.
+The callbacks therefore only toggle the LED, note the tick and set their bit in the
+notification value of TimerWorkerTask, which does the printing. Events of a timer that
+fires again before the worker ran are merged into one print with the latest tick.
+Build with -D TIMER_CALLBACK_INLINE to print from the callbacks as before.
+
+The bench builds (-D BENCHMARK) add BENCH_TIMERS auto-reload timers with periods of
+1 to 17 ticks, a task that keeps the Serial mutex busy with long lines and a task that
+posts a function call to the daemon queue every tick. They report how late the timers
+fire (timer_late_ms) and how many posts were waiting in the daemon queue (daemon_queue).
+env:bench offloads, env:bench_inline does not, tools/bench.py runs both.
 */
 
 /*Define ms period in ticks for both timers*/
 #define TIMER_1_PERIOD pdMS_TO_TICKS(250)
 #define TIMER_2_PERIOD pdMS_TO_TICKS(500)
+/*Notification bits of the timers for TimerWorkerTask*/
+#define TIMER_1_EVENT 0x01
+#define TIMER_2_EVENT 0x02
+#define TIMER_WORKER_STACK 256
+#define TIMER_WORKER_PRIORITY (tskIDLE_PRIORITY + 1)
 /*Reference handles for both timers*/
 TimerHandle_t xTimer1, xTimer2;
 BaseType_t xTimer1Started, xTimer2Started;
+#ifndef TIMER_CALLBACK_INLINE
+/*Prints for the timer callbacks*/
+TaskHandle_t xTimerWorker;
+/*Tick of the last firing of each timer, written by the daemon, read by the worker*/
+static TickType_t timer1Tick, timer2Tick;
+#endif
 /*To make sure only one task is accesing Serial at a time*/
 SemaphoreHandle_t xSerialSemaphore;
 
+#ifdef BENCHMARK
+#define BENCH_TIMERS 32
+#define BENCH_LOG_PERIOD pdMS_TO_TICKS(150)
+#define BENCH_TASK_STACK 256
+/*Periods in ticks, timer i gets benchPeriods[i % 8]*/
+static const uint8_t benchPeriods[] = {1, 2, 3, 5, 7, 11, 13, 17};
+static TimerHandle_t benchTimers[BENCH_TIMERS];
+static TickType_t benchExpected[BENCH_TIMERS]; // Next expiry of every bench timer, 0 before its first firing
+static volatile uint8_t benchPending;           // Posts in the daemon queue not run yet
+PROBE(timer1_callback);
+PROBE(timer2_callback);
+PROBE(timer_late_ms);
+PROBE(daemon_queue);
+static void benchPrint(const char *str) { Serial.print(str); }
+static void benchBegin(void);
+#endif
+
 // put function declarations here:
 static void Timer1Callback(TimerHandle_t xTimer);
 static void Timer2Callback(TimerHandle_t xTimer);
+#ifndef TIMER_CALLBACK_INLINE
+static void TimerWorkerTask(void *pvParameters);
+#endif
 void ThreadSafePrintMessage(String msg, uint8_t line);
 
 void setup()
 {
   /*Setup LED*/
-  DDRB |= _BV(LEDPIN);
+  Led::output();
   /*Start Serial and related Semaphore*/
   Serial.begin(9600);
   if (xSerialSemaphore == NULL) // Check to confirm that the Serial Semaphore has not already been created.
@@ -40,6 +89,13 @@ void setup()
     if ((xSerialSemaphore) != NULL)
       xSemaphoreGive((xSerialSemaphore)); // Make the Serial Port available for use, by "Giving" the Semaphore.
   }
+#ifdef BENCHMARK
+  probeBegin(benchPrint);
+  benchBegin();
+#endif
+#ifndef TIMER_CALLBACK_INLINE
+  xTaskCreate(TimerWorkerTask, "TimerWorker", TIMER_WORKER_STACK, NULL, TIMER_WORKER_PRIORITY, &xTimerWorker);
+#endif
   /*Create timer 1 with 250ms period*/
   xTimer1 = xTimerCreate(
       "250msTimer",   /*Txt name for timer, only for human use*/
@@ -83,22 +139,151 @@ static void Timer1Callback(TimerHandle_t xTimer)
 {
   /*Current tick count*/
   TickType_t xTimeNow;
+#ifdef BENCHMARK
+  PROBE_START(timer1_callback);
+#endif
   xTimeNow = xTaskGetTickCount();
   /*Change LED state and print time on serial*/
-  PORTB ^= _BV(LEDPIN); /*XOR led pin to change between high and low everytime timer is triggered*/
+  Led::toggle(); /*Change between high and low everytime timer is triggered*/
+#ifdef TIMER_CALLBACK_INLINE
   write("LedTimer, time: ");
   writeLine(String(xTimeNow / 31));
+#else
+  timer1Tick = xTimeNow;
+  xTaskNotify(xTimerWorker, TIMER_1_EVENT, eSetBits);
+#endif
+#ifdef BENCHMARK
+  PROBE_STOP(timer1_callback);
+#endif
 }
 
 static void Timer2Callback(TimerHandle_t xTimer)
 {
   /*Current tick count*/
   TickType_t xTimeNow;
+#ifdef BENCHMARK
+  PROBE_START(timer2_callback);
+#endif
   xTimeNow = xTaskGetTickCount();
   /*This is the longer period timer, that print out message in serial*/
+#ifdef TIMER_CALLBACK_INLINE
   write("Timer 2, time: ");
   writeLine(String(xTimeNow / 31));
+#else
+  timer2Tick = xTimeNow;
+  xTaskNotify(xTimerWorker, TIMER_2_EVENT, eSetBits);
+#endif
+#ifdef BENCHMARK
+  PROBE_STOP(timer2_callback);
+#endif
+}
+
+#ifndef TIMER_CALLBACK_INLINE
+/*Prints for the timer callbacks, blocking here only delays the prints*/
+static void TimerWorkerTask(void *pvParameters)
+{
+  uint32_t events;
+  TickType_t tick1, tick2;
+  for (;;)
+  {
+    xTaskNotifyWait(0, 0xFFFFFFFF, &events, portMAX_DELAY);
+    /*The ticks are written by the daemon, which has the higher priority*/
+    taskENTER_CRITICAL();
+    tick1 = timer1Tick;
+    tick2 = timer2Tick;
+    taskEXIT_CRITICAL();
+    if (events & TIMER_1_EVENT)
+    {
+      write("LedTimer, time: ");
+      writeLine(String(tick1 / 31));
+    }
+    if (events & TIMER_2_EVENT)
+    {
+      write("Timer 2, time: ");
+      writeLine(String(tick2 / 31));
+    }
+  }
+}
+#endif
+
+#ifdef BENCHMARK
+/*Light callback of the bench timers, records how late it runs*/
+static void BenchTimerCallback(TimerHandle_t xTimer)
+{
+  uint8_t i = (uintptr_t)pvTimerGetTimerID(xTimer);
+  TickType_t now = xTaskGetTickCount();
+  if (benchExpected[i] != 0)
+  {
+    /*Auto-reload keeps the expiries on the period grid, a late callback does not move the next one*/
+    probeRecord(&timer_late_ms, (uint32_t)(TickType_t)(now - benchExpected[i]) * portTICK_PERIOD_MS);
+    benchExpected[i] += benchPeriods[i % sizeof(benchPeriods)];
+  }
+  else
+  {
+    benchExpected[i] = now + benchPeriods[i % sizeof(benchPeriods)];
+  }
+}
+
+/*Runs in the daemon, after the commands posted before it*/
+static void benchPended(void *pvParameter1, uint32_t ulParameter2)
+{
+  taskENTER_CRITICAL();
+  benchPending--;
+  taskEXIT_CRITICAL();
+}
+
+/*Keeps the Serial mutex busy, a long line waits for room in the Serial buffer while holding it*/
+static void BenchLogTask(void *pvParameters)
+{
+  for (;;)
+  {
+    writeLine("Bench log: a status line long enough to fill the Serial buffer and hold the mutex while it drains");
+    vTaskDelay(BENCH_LOG_PERIOD);
+  }
+}
+
+/*Starts the bench timers, then posts a function call to the daemon queue every tick and records how many posts
+were still waiting*/
+static void BenchQueueTask(void *pvParameters)
+{
+  uint8_t depth;
+  /*Started here, more start commands than configTIMER_QUEUE_LENGTH would not fit before the scheduler runs*/
+  for (uint8_t i = 0; i < BENCH_TIMERS; i++)
+  {
+    if (benchTimers[i] != NULL)
+    {
+      xTimerStart(benchTimers[i], portMAX_DELAY);
+    }
+  }
+  for (;;)
+  {
+    taskENTER_CRITICAL();
+    depth = benchPending++;
+    taskEXIT_CRITICAL();
+    if (xTimerPendFunctionCall(benchPended, NULL, 0, 0) != pdPASS)
+    {
+      /*Queue full*/
+      taskENTER_CRITICAL();
+      benchPending--;
+      taskEXIT_CRITICAL();
+      depth = configTIMER_QUEUE_LENGTH;
+    }
+    probeRecord(&daemon_queue, depth);
+    vTaskDelay(1);
+  }
+}
+
+/*Creates the bench timers and load tasks, BenchQueueTask starts the timers*/
+static void benchBegin(void)
+{
+  for (uint8_t i = 0; i < BENCH_TIMERS; i++)
+  {
+    benchTimers[i] = xTimerCreate("Bench", benchPeriods[i % sizeof(benchPeriods)], pdTRUE, (void *)(uintptr_t)i, BenchTimerCallback);
+  }
+  xTaskCreate(BenchLogTask, "BenchLog", BENCH_TASK_STACK, NULL, tskIDLE_PRIORITY + 1, NULL);
+  xTaskCreate(BenchQueueTask, "BenchQueue", BENCH_TASK_STACK, NULL, tskIDLE_PRIORITY + 2, NULL);
 }
+#endif
 
 void ThreadSafePrintMessage(String msg, uint8_t line)
 {
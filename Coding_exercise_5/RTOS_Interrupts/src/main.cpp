@@ -2,6 +2,10 @@
 #include <Arduino_FreeRTOS.h>
 #include "semphr.h"
 #include "task.h"
+#include <Gpio.h>
+#ifdef BENCHMARK
+#include <CycleProbe.h>
+#endif
 
 /*
 https://exploreembedded.com/wiki/Resuming_Task_From_ISR#Downloads
@@ -10,12 +14,18 @@ https://www.arduino.cc/en/Tutorial/BuiltInExamples/Button
 */
 
 #define BUTTONPIN PE4 // D2
-#define LEDPIN PB5    // D11
+typedef Pin<PortB, PB5> Led; // D11
 #define DEBOUNCING_TIME (uint32_t)150
 
 SemaphoreHandle_t xBinarySemaphore;
 volatile uint32_t last_interrupt;
 
+#ifdef BENCHMARK
+PROBE(button_isr);
+PROBE(isr_to_task); // Semaphore given in the ISR until the LED task has it
+static void benchPrint(const char *str) { Serial.print(str); }
+#endif
+
 void ExternalInterrupt(void);
 void taskTogleLED(void *pvParameters);
 
@@ -23,6 +33,9 @@ void setup(void)
 {
   Serial.begin(9600);
   Serial.println("Setup Start");
+#ifdef BENCHMARK
+  probeBegin(benchPrint);
+#endif
   xTaskCreate(taskTogleLED, "LEDtask", 128, NULL, 2, NULL);
   attachInterrupt(digitalPinToInterrupt(2 /*BUTTONPIN*/), ExternalInterrupt /*Function to call when triggered*/, FALLING /*Edge to trigger to*/);
   xBinarySemaphore = xSemaphoreCreateBinary();
@@ -38,23 +51,35 @@ void loop(void)
 // Function to be called when ISR trigger
 void ExternalInterrupt(void)
 {
+#ifdef BENCHMARK
+  PROBE_START(button_isr);
+#endif
   //Debounce interrupt button
   if ((uint32_t)(micros() - last_interrupt) >= (DEBOUNCING_TIME * 1000))
   {
+#ifdef BENCHMARK
+    PROBE_START(isr_to_task);
+#endif
     xSemaphoreGiveFromISR(xBinarySemaphore, pdFALSE);
     last_interrupt = micros();
   }
+#ifdef BENCHMARK
+  PROBE_STOP(button_isr);
+#endif
 }
 
 void taskTogleLED(void *pvParameters)
 {
-  DDRB |= _BV(LEDPIN);  // LEDPIN output
-  PORTB &= _BV(LEDPIN); // Turn LED off
+  Led::output(); // LED pin output
+  Led::low();    // Turn LED off
   Serial.println("Starting LED-task");
   for (;;)
   {
     xSemaphoreTake(xBinarySemaphore, portMAX_DELAY); // Wait for semaphore
+#ifdef BENCHMARK
+    PROBE_STOP(isr_to_task);
+#endif
     Serial.println("Got semaphore for alarm ");
-    PORTB ^= _BV(LEDPIN); // Switch LED state on/off
+    Led::toggle(); // Switch LED state on/off
   }
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef BOOT_PROFILE_H
+#define BOOT_PROFILE_H
+
+#include <Arduino.h>
+
+/*
+Boot profile
+
+Each mark records, once, the micros() value when boot first got to it. micros()
+starts counting in init(), before setup(), so the times are from reset apart from
+the C runtime start-up (copying .data, clearing .bss and global constructors).
+*/
+
+enum BootMark
+{
+  BOOT_SETUP,          // setup() entered
+  BOOT_SETTINGS,       // Settings restored from EEPROM
+  BOOT_SCHEDULER,      // Kernel objects and control tasks created, scheduler starting
+  BOOT_FIRST_SAMPLE,   // First soil moisture reading
+  BOOT_FIRST_DECISION, // First pump decision, all zones scanned
+  BOOT_FIRST_LIGHT,    // First light decision
+  BOOT_CONSOLE,        // Console and report task up
+  BOOT_MARK_COUNT
+};
+
+/// @brief Records the time of a mark, only the first call for a mark counts.
+/// @param mark Mark reached.
+void bootMark(uint8_t mark);
+
+/// @brief Time of a mark.
+/// @param mark Mark to read.
+/// @return Microseconds from reset, 0 if the mark has not been reached.
+uint32_t bootTime(uint8_t mark);
+
+/// @brief Name of a mark, for printing.
+/// @param mark Mark to name.
+/// @return Name of the mark.
+const char *bootMarkName(uint8_t mark);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef CONFIG_PROTOCOL_H
+#define CONFIG_PROTOCOL_H
+
+#include <Arduino.h>
+#include <Arduino_FreeRTOS.h>
+
+/*
+Framed configuration protocol
+
+The console prompts for one value at a time and every answer ends with a
+SERIAL_READ_TIMEOUT, so a batch of changes takes seconds per value. A host can instead
+send binary frames on the same port, each carrying up to CONFIG_MAX_OPS operations:
+
+  request:  0xC5 seq count {op|key value}*count crc
+  response: 0xC6 seq status bad count {value}*count crc
+
+op|key is one byte, CONFIG_OP_SET in the top bit for a set, without it for a get.
+Values are 32 bit little endian, crc is the CRC-16 (_crc_ccitt_update, initial value
+0xFFFF) of every byte from seq on, little endian.
+
+A frame is applied as a whole: every set is checked first and one bad key or value
+rejects the frame, with its index in bad. The caller then applies all sets while
+holding the locks of the values, and the response carries the value of every key
+after the frame, so gets in the same frame see its sets.
+
+A frame with a bad count can't be told apart from what follows it, so everything up to
+CONFIG_BYTE_TIMEOUT of silence is dropped before the response, frames the host sent
+right behind it included, which then get no response.
+
+The sync bytes are not ASCII, so frames and text commands share the port. Responses
+are written under xSerialSemaphore and report lines may come between them, the host
+finds the response by its sync byte and CRC. Frames are handled in order and seq is
+echoed, so a host can send several before the first response as long as they fit in
+the RX ring.
+
+tools/config_cli.py is the host side.
+*/
+
+#define CONFIG_REQUEST_SYNC 0xC5
+#define CONFIG_RESPONSE_SYNC 0xC6
+#define CONFIG_MAX_OPS 16
+#define CONFIG_OP_SET 0x80
+#define CONFIG_KEY_MASK 0x7F
+#define CONFIG_BYTE_TIMEOUT pdMS_TO_TICKS(50) // Longest gap between the bytes of a frame
+
+/*Keys, independent of the EEPROM layout so zones can be added without changing the host*/
+#define CONFIG_KEY_THRESHOLD 0x00 // + zone, up to 0x3F
+#define CONFIG_KEY_LIGHTS_ON 0x40
+#define CONFIG_KEY_LIGHTS_OFF 0x41
+#define CONFIG_KEY_LIGHT_MODE 0x42
+#define CONFIG_KEY_TIME 0x43      // hour << 16 | min << 8 | sec
+#define CONFIG_KEY_ZONES 0x44     // Read only
+
+#define CONFIG_THRESHOLD_MAX 1023 // Full scale of the ADC
+
+enum ConfigStatus
+{
+  CONFIG_OK,
+  CONFIG_BAD_CRC,
+  CONFIG_BAD_LENGTH, // count is 0 or above CONFIG_MAX_OPS
+  CONFIG_BAD_KEY,
+  CONFIG_BAD_VALUE,
+  CONFIG_READ_ONLY,
+  CONFIG_TIMEOUT // Not answered, the frame may be missing its seq
+};
+
+struct ConfigOp
+{
+  uint8_t key; // With CONFIG_OP_SET for a set
+  uint32_t value;
+};
+
+struct ConfigFrame
+{
+  uint8_t seq;
+  uint8_t count;
+  ConfigOp ops[CONFIG_MAX_OPS];
+};
+
+struct ConfigStats
+{
+  uint32_t frames; // Frames applied
+  uint32_t sets;
+  uint32_t gets;
+  uint16_t rejected; // Frames with a bad length, key or value
+  uint16_t crcErrors;
+  uint16_t timeouts;
+  uint32_t maxFrameUs; // Longest time from the sync byte to the queued response
+};
+
+/// @brief Reads the rest of a frame, call after uartRead returned CONFIG_REQUEST_SYNC.
+/// @param frame Frame read.
+/// @return CONFIG_OK, CONFIG_BAD_CRC, CONFIG_BAD_LENGTH or CONFIG_TIMEOUT.
+uint8_t configReceive(ConfigFrame *frame);
+
+/// @brief Checks one value, also used by the text commands.
+/// @param key Key without CONFIG_OP_SET.
+/// @param value Value to set.
+/// @param zones Number of zones.
+/// @return CONFIG_OK, CONFIG_BAD_KEY, CONFIG_BAD_VALUE or CONFIG_READ_ONLY.
+uint8_t configCheck(uint8_t key, uint32_t value, uint8_t zones);
+
+/// @brief Checks every set of a frame.
+/// @param frame Frame read by configReceive.
+/// @param zones Number of zones.
+/// @param bad Index of the first rejected operation.
+/// @return CONFIG_OK or the status of the rejected operation.
+uint8_t configValidate(const ConfigFrame *frame, uint8_t zones, uint8_t *bad);
+
+/// @brief Sends the response, the caller holds xSerialSemaphore.
+/// @param frame Frame with the value of every key after it was applied.
+/// @param status Status of the frame, the values are only sent with CONFIG_OK.
+/// @param bad Index of the rejected operation.
+void configRespond(const ConfigFrame *frame, uint8_t status, uint8_t bad);
+
+/// @brief Takes a copy of the statistics of the protocol.
+/// @param stats Copy of the statistics.
+void getConfigStats(ConfigStats *stats);
+
+#endif
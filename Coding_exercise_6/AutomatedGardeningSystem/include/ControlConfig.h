@@ -0,0 +1,77 @@
+#ifndef CONTROL_CONFIG_H
+#define CONTROL_CONFIG_H
+
+#include <Arduino.h>
+#include <Arduino_FreeRTOS.h>
+
+/*
+Versioned control configuration
+
+The light mode, the manual light hours, the time of day and the day/night state are
+read by LightManagementTask on every release, by ReportTask and by the console, and
+written by updateTime, the console and the configuration frames. Read field by field
+they can mix two updates, the time is three bytes and the day count two, and every
+read under a mutex costs a take and a give.
+
+Here they form one block kept in CONTROL_CONFIG_SLOTS copies. A writer copies the
+published block to the next slot, changes the copy and publishes it by storing the
+slot index, a single byte store. Readers never lock: controlConfigRead copies the
+published slot and compares its version before and after the copy, a writer that
+reused the slot in between gives it a new version and the copy is repeated. A slot is
+only reused after CONTROL_CONFIG_SLOTS - 1 further publishes, so a retry needs that
+many updates during one copy of a few bytes.
+
+Writers are serialised by suspending the scheduler from controlConfigEdit to
+controlConfigPublish (vTaskSuspendAll), not by a critical section: the AVR port
+pushes SREG on enter and pops it on exit, so a critical section can't be left in
+another function than the one that entered it. Interrupts stay enabled and never
+write the block. Only plain assignments belong in between, no blocking calls and no
+FreeRTOS API. Before the scheduler starts (restoreSettings in setup) the pair is
+harmless.
+
+The version counts publishes in 8 bits and skips 0, a reader would have to be preempted
+for 255 publishes for a copy to pass the check with a wrong version.
+*/
+
+#define CONTROL_CONFIG_SLOTS 3
+
+struct ControlConfig
+{
+  uint8_t version;   // Set by controlConfigPublish
+  uint8_t dayNight;  // day or night, follows hour
+  uint8_t lightMode; // 0 automatic, 1 manual
+  uint8_t lightsOn;  // Hour the lights go on in manual mode
+  uint8_t lightsOff; // Hour the lights go off in manual mode
+  uint8_t hour;
+  uint8_t min;
+  uint8_t sec;
+  uint16_t dayCount; // Days passed since boot
+};
+
+struct ControlConfigStats
+{
+  uint8_t version;
+  uint32_t publishes;
+  uint16_t retries; // Copies repeated because a writer reused the slot
+};
+
+/// @brief Publishes the first block, call before the scheduler starts.
+/// @param initial Block to start with, its version is ignored.
+void controlConfigBegin(const ControlConfig *initial);
+
+/// @brief Takes a consistent copy of the published block without locking.
+/// @param copy Copy of the block.
+void controlConfigRead(ControlConfig *copy);
+
+/// @brief Suspends the scheduler and returns a copy of the published block to change.
+/// @return The copy, published by controlConfigPublish.
+ControlConfig *controlConfigEdit(void);
+
+/// @brief Publishes the copy returned by controlConfigEdit and resumes the scheduler.
+void controlConfigPublish(void);
+
+/// @brief Takes a copy of the statistics of the block.
+/// @param stats Copy of the statistics.
+void getControlConfigStats(ControlConfigStats *stats);
+
+#endif
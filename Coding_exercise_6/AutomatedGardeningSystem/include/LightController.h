@@ -0,0 +1,57 @@
+#ifndef LIGHT_CONTROLLER_H
+#define LIGHT_CONTROLLER_H
+
+#include <Arduino.h>
+
+/*
+Light level controller
+
+A PI controller keeps the measured light level at LIGHT_SETPOINT by adding LED light
+to the daylight. It runs once per release of the light management task, at
+TASK_PERIOD_LIGHT_MANAGEMENT from tools/tasks.json, and reads the sensor itself.
+
+Everything is fixed point, values with 8 fraction bits (Q8):
+  The reading is smoothed by an exponential moving average, weight 1/2^LIGHT_FILTER_SHIFT.
+  error = LIGHT_SETPOINT - filtered reading
+  output = Kp * error + integral, limited to 0 - LIGHT_CONTROL_MAX
+Anti-windup: the integral is limited to the output range and does not grow while the
+output is saturated in the direction of the error.
+
+The output is the total brightness of the three lights, 0 - 3 * 255.
+
+For every step the controller records the time since the previous step, so the
+spread of the loop period shows the release jitter, and the CPU cycles the step took
+counted by Timer1, which runs at F_CPU for the light PWM.
+*/
+
+#define LIGHT_SETPOINT 100         // Sensor reading of full daylight
+#define LIGHT_CONTROL_MAX (3 * 255) // All three lights fully on
+#define LIGHT_FILTER_SHIFT 2
+#define LIGHT_KP_Q8 1024 // 4.0 output per unit of error
+#define LIGHT_KI_Q8 512  // 2.0 output per unit of error and step
+
+struct LightControlStats
+{
+  uint32_t steps;
+  uint32_t minIntervalUs; // Between the starts of two steps
+  uint32_t maxIntervalUs;
+  uint16_t lastCycles; // Spent in lightControlStep
+  uint16_t maxCycles;
+  uint32_t saturated; // Steps with the output at 0 or LIGHT_CONTROL_MAX
+  uint16_t filtered;  // Filtered reading, Q8
+  uint16_t output;
+};
+
+/// @brief Clears the filter and the integral, call while the controller is not in charge of the lights.
+void lightControlReset(void);
+
+/// @brief Runs one step of the controller.
+/// @param reading Light level read from the sensor.
+/// @return Total brightness of the lights, 0 - LIGHT_CONTROL_MAX.
+uint16_t lightControlStep(uint16_t reading);
+
+/// @brief Takes a copy of the statistics of the controller.
+/// @param stats Copy of the statistics.
+void getLightControlStats(LightControlStats *stats);
+
+#endif
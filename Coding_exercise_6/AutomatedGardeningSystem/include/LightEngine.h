@@ -0,0 +1,51 @@
+#ifndef LIGHT_ENGINE_H
+#define LIGHT_ENGINE_H
+
+#include <Arduino.h>
+
+/*
+Grow-light engine
+
+The three LEDs are driven by the hardware PWM of Timer1, fast PWM with TOP = 0xFFFF:
+  channel 0: OC1A, PB5, pin 11
+  channel 1: OC1B, PB6, pin 12
+  channel 2: OC1C, PB7, pin 13
+The PWM runs at F_CPU / 65536, 244 Hz, without any CPU time.
+
+Brightness is 0-255 and perceptual. The duty comes from a gamma table in flash
+(include/GammaTable.h, generated by tools/gamma_table.py).
+
+A ramp moves a channel to a new brightness over a given time. The Timer1 overflow
+interrupt advances every ramping channel once per PWM period. It is only enabled while
+a ramp is running, so outside ramps the lights take no CPU time at all, and the task
+only calls lightSet when the target changes.
+
+CPU load during a ramp is one overflow interrupt per PWM period, the light_ramp_isr
+probe of the bench build measures its cycles. For comparison, 8-bit software PWM of
+three pins at the same 244 Hz needs an interrupt every 256th of the period, 62500 per
+second.
+*/
+
+#define LIGHT_CHANNELS 3
+#define LIGHT_PWM_HZ (F_CPU / 65536UL)
+
+/// @brief Starts the PWM of the three channels with all lights off.
+void lightBegin(void);
+
+/// @brief Moves a channel to a brightness.
+/// @param channel Channel, 0 to LIGHT_CHANNELS - 1.
+/// @param level Brightness 0-255.
+/// @param rampMs Time to get there, 0 to change right away.
+void lightSet(uint8_t channel, uint8_t level, uint16_t rampMs);
+
+/// @brief Current brightness of a channel, follows a ramp while it runs.
+/// @param channel Channel, 0 to LIGHT_CHANNELS - 1.
+/// @return Brightness 0-255.
+uint8_t lightLevel(uint8_t channel);
+
+/// @brief Target brightness of a channel.
+/// @param channel Channel, 0 to LIGHT_CHANNELS - 1.
+/// @return Brightness 0-255.
+uint8_t lightTarget(uint8_t channel);
+
+#endif
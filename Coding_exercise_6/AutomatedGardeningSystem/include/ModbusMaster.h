@@ -0,0 +1,134 @@
+#ifndef MODBUS_MASTER_H
+#define MODBUS_MASTER_H
+
+#include <Arduino.h>
+#include <Arduino_FreeRTOS.h>
+#include "task.h"
+
+/*
+Modbus RTU master on USART1
+
+For installations where the sensors and pumps are remote nodes on an RS-485 bus
+instead of analog pins. USART1 runs 8E1 (TX1 PD3, RX1 PD2), the driver enable of the
+transceiver is on PA0 (pin 22), high while sending, and its receiver enable is tied
+to it inverted.
+
+Requests are queued in batches like TwiBus.h: modbusSubmit queues a batch and returns,
+the interrupts send every request, wait for its response and go straight on to the
+next, the owner task is notified once the whole batch is done and runs as soon as the
+interrupt returns if it has the higher priority. Each request reads up to
+MODBUS_MAX_REGISTERS consecutive registers (function 3 or 4) or writes one
+(function 6), so the registers of a node come in one round trip. modbusBatchTimeout
+gives the time to wait for a batch, from the frame times at the baud rate of the bus.
+The driver notes the tick at which the first request of a batch goes on the bus and
+modbusWait only counts from there, so a batch queued behind a long scan of dead nodes
+gets its whole bus time. The wait in the queue is bounded anyway, every request ahead
+ends after MODBUS_RESPONSE_TIMEOUT_MS at the latest.
+
+Frame timing is done by Timer3 (clk/64, 4 us per count), without the CPU waiting:
+  every received byte restarts the timer
+  t1.5 without a byte: a byte after it makes the frame invalid
+  t3.5 without a byte: end of the response frame
+  MODBUS_RESPONSE_TIMEOUT_MS after the request without an answer: timeout
+t1.5 and t3.5 are 1.5 and 3.5 character times, 750 us and 1750 us above 19200 baud as
+the specification asks. A request is only sent once the bus has been silent for t3.5.
+
+Nodes 1 to MODBUS_MAX_NODE have their own statistics: requests, responses, timeouts,
+errors (CRC, timing or a response that does not match), exceptions and the latency from
+the start of the request to the end of the response, t3.5 included.
+
+tools/modbus_slave.py simulates the nodes on a pty or a serial port and measures the
+zones scanned per second. tools/sim.py --modbus runs the sim_modbus build in simavr
+(tools/modbus_sim.c) with USART1 on a pty and these slaves on it.
+*/
+
+#define MODBUS_MAX_REGISTERS 16
+#define MODBUS_MAX_NODE 48
+#define MODBUS_RESPONSE_TIMEOUT_MS 20
+#define MODBUS_READ_HOLDING_REGISTERS 0x03
+#define MODBUS_READ_INPUT_REGISTERS 0x04
+#define MODBUS_WRITE_REGISTER 0x06
+
+enum ModbusStatus
+{
+  MODBUS_PENDING,
+  MODBUS_OK,
+  MODBUS_TIMEOUT,   // No answer, or the batch was cancelled by modbusWait
+  MODBUS_ERROR,     // CRC, t1.5 gap, overrun or a response that does not match the request
+  MODBUS_EXCEPTION  // The node answered with an exception, its code is in exception
+};
+
+struct ModbusRequest
+{
+  uint8_t node;      // 1-247
+  uint8_t function;  // MODBUS_READ_HOLDING_REGISTERS, MODBUS_READ_INPUT_REGISTERS or MODBUS_WRITE_REGISTER
+  uint16_t address;  // First register
+  uint8_t quantity;  // Registers to read, 1 for a write
+  uint16_t *values;  // Registers read, or the value to write in values[0]
+  volatile uint8_t status;
+  uint8_t exception;
+};
+
+struct ModbusBatch
+{
+  ModbusRequest *requests;
+  uint8_t count;
+  TaskHandle_t owner;  // Notified when done, NULL for none
+  volatile bool done;  // Set by the driver once every request has a status
+  ModbusBatch *next;   // Used by the driver
+  volatile bool started;          // Set by the driver when the first request goes on the bus
+  volatile TickType_t startTick;  // Tick at which it did
+};
+
+struct ModbusNodeStats
+{
+  uint16_t requests;
+  uint16_t responses;
+  uint16_t timeouts;
+  uint16_t errors;
+  uint16_t exceptions;
+  uint16_t latencyMaxUs;
+  uint32_t latencySumUs; // Over the responses
+};
+
+struct ModbusStats
+{
+  uint32_t batches;
+  uint32_t requests;
+  uint16_t gaps;      // Frames broken by a t1.5 gap
+  uint16_t overruns;  // Frames longer than the response buffer
+  uint16_t cancelled; // Batches cancelled by modbusWait
+};
+
+/// @brief Sets up USART1, Timer3 and the driver enable pin.
+/// @param baud Baud rate of the bus.
+void modbusBegin(uint32_t baud);
+
+/// @brief Queues a batch, the first request is sent right away if the bus is idle.
+/// @param batch Batch with requests, count and owner set.
+void modbusSubmit(ModbusBatch *batch);
+
+/// @brief Longest time a batch can take on the bus when every node answers as late as it may, not counting
+/// the batches queued ahead of it.
+/// @param batch Batch with requests and count set.
+/// @return Ticks for modbusWait: the bytes of every request and answer, the t3.5 gaps around
+/// them and MODBUS_RESPONSE_TIMEOUT_MS per request, rounded up by one tick.
+TickType_t modbusBatchTimeout(const ModbusBatch *batch);
+
+/// @brief Sleeps until every request of a batch is done.
+/// @param batch Batch passed to modbusSubmit.
+/// @param timeout Ticks to wait from the start of the batch on the bus, the batch is cancelled after them.
+/// @return pdTRUE if the batch finished, pdFALSE if it was cancelled.
+BaseType_t modbusWait(ModbusBatch *batch, TickType_t timeout);
+
+/// @brief Takes a copy of the statistics of the bus.
+/// @param stats Copy of the statistics.
+void getModbusStats(ModbusStats *stats);
+
+/// @brief Takes a copy of the statistics of one node.
+/// @param node Node address.
+/// @param stats Copy of the statistics.
+/// @return false if the node is above MODBUS_MAX_NODE.
+bool getModbusNodeStats(uint8_t node, ModbusNodeStats *stats);
+
+#endif
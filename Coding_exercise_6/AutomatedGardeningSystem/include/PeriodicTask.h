@@ -0,0 +1,60 @@
+#ifndef PERIODIC_TASK_H
+#define PERIODIC_TASK_H
+
+#include <Arduino.h>
+#include <Arduino_FreeRTOS.h>
+#include "task.h"
+
+/*
+Periodic tasks
+
+A periodic task is described by a PeriodicTask struct and run by PeriodicTaskRunner.
+Releases are kept in absolute ticks with xTaskDelayUntil, so the period does not
+stretch by the execution time of the body or by preemption.
+
+For every release the runner records:
+  lateness: ticks between the planned release and the start of the body
+  execution time: microseconds spent in the body
+  deadline miss: body finished more than deadline ticks after the release
+*/
+
+struct PeriodicStats
+{
+  uint32_t releases = 0;
+  uint16_t deadlineMisses = 0;
+  uint16_t overruns = 0; // Next release was already in the past when the body finished
+  TickType_t lastLateness = 0;
+  TickType_t maxLateness = 0;
+  uint32_t lastExecUs = 0;
+  uint32_t maxExecUs = 0;
+};
+
+struct PeriodicTask
+{
+  const char *name;
+  TickType_t period;   // Ticks between releases
+  TickType_t deadline; // Ticks from release to end of the body
+  void (*setup)(void); // Run once before the first release, can be NULL
+  void (*body)(void);  // Run once per release
+  PeriodicStats stats;
+  TaskHandle_t handle; // Set by createPeriodicTask
+};
+
+/// @brief Creates a FreeRTOS task running the given periodic task.
+/// @param task Periodic task description, must stay valid while the task runs.
+/// @param stackDepth Stack size of the task.
+/// @param priority Priority of the task.
+/// @param handle Handle of the created task, can be NULL.
+/// @return pdPASS if the task was created.
+BaseType_t createPeriodicTask(PeriodicTask *task, uint16_t stackDepth, UBaseType_t priority, TaskHandle_t *handle);
+
+/// @brief Task function running setup once and then body once per period.
+/// @param pvParameters A pointer to the PeriodicTask.
+void PeriodicTaskRunner(void *pvParameters);
+
+/// @brief Takes a consistent copy of the statistics of a periodic task.
+/// @param task Periodic task to read.
+/// @param stats Copy of the statistics.
+void getPeriodicStats(const PeriodicTask *task, PeriodicStats *stats);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef POOL_ALLOCATOR_H
+#define POOL_ALLOCATOR_H
+
+#include <Arduino.h>
+
+/*
+Fixed-block pool allocator
+
+malloc, free and realloc are wrapped at link time (-Wl,--wrap in platformio.ini),
+so String, new and pvPortMalloc (heap_3) all go through the pools. Requests up to
+the largest block size are served from fixed-size blocks, anything larger or a full
+pool falls back to the avr-libc heap. Fixed blocks can't fragment the heap, which
+is what the short-lived String objects of the report and print paths used to do.
+
+Pool sizes can be changed with -D POOL_BLOCKS_8=.. etc. in build_flags.
+*/
+
+#ifndef POOL_BLOCKS_8
+#define POOL_BLOCKS_8 24
+#endif
+#ifndef POOL_BLOCKS_16
+#define POOL_BLOCKS_16 16
+#endif
+#ifndef POOL_BLOCKS_32
+#define POOL_BLOCKS_32 12
+#endif
+#ifndef POOL_BLOCKS_64
+#define POOL_BLOCKS_64 6
+#endif
+
+#define POOL_CLASS_COUNT 4
+
+struct PoolClassStats
+{
+  uint8_t blockSize;
+  uint8_t blocks;
+  uint8_t inUse;
+  uint8_t highWater;
+  uint32_t allocs;
+  uint16_t fallbacks; // Allocations that found the pool full and went to the heap
+};
+
+struct HeapStats
+{
+  size_t freeBytes;        // Free list plus the untouched space above the heap
+  size_t largestFreeBlock; // Largest allocation that can still succeed
+  uint8_t fragmentation;   // 100 - 100 * largestFreeBlock / freeBytes, in percent
+  uint16_t allocs;         // Blocks currently allocated from the heap
+  uint16_t failures;       // Allocations that returned NULL
+};
+
+/// @brief Takes a consistent copy of the statistics of one size class.
+/// @param sizeClass Size class, 0 to POOL_CLASS_COUNT - 1.
+/// @param stats Copy of the statistics.
+void getPoolStats(uint8_t sizeClass, PoolClassStats *stats);
+
+/// @brief Walks the avr-libc free list and measures free space and fragmentation.
+/// @param stats Heap statistics.
+void getHeapStats(HeapStats *stats);
+
+#endif
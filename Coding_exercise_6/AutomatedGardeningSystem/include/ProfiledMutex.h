@@ -0,0 +1,79 @@
+#ifndef PROFILED_MUTEX_H
+#define PROFILED_MUTEX_H
+
+#include <Arduino.h>
+#include <Arduino_FreeRTOS.h>
+#include "semphr.h"
+
+/*
+Profiled mutex
+
+A FreeRTOS mutex that records, per mutex:
+  takes, contended takes (the mutex was held by another task) and timeouts
+  histograms of the wait for the mutex and of the time it was held
+  the longest wait and hold
+Histogram buckets are powers of 4 from 64 us: <64us, <256us, <1ms, <4ms, <16ms,
+<64ms, <256ms and longer.
+
+A mutex created with a ceiling uses the immediate priority ceiling protocol: the
+taking task is raised to the ceiling before it takes the mutex and goes back to its
+own priority when it gives it. No task that uses the mutex can then preempt the
+holder, so a task is blocked by at most one lower priority critical section. The
+ceilings are generated by tools/rta.py (TASK_CEILING_* in TaskConfig.h) as the
+highest priority of the tasks using each mutex. Use ceilings on all mutexes or on
+none: a task that holds an inheritance mutex may run at an inherited priority, and
+would go back to that instead of its own.
+*/
+
+#define MUTEX_NO_CEILING 0
+#define MUTEX_HIST_BUCKETS 8
+
+struct MutexStats
+{
+  uint32_t takes;
+  uint32_t contended; // Takes that found the mutex held
+  uint16_t timeouts;
+  uint16_t waitHist[MUTEX_HIST_BUCKETS];
+  uint16_t holdHist[MUTEX_HIST_BUCKETS];
+  uint32_t maxWaitUs;
+  uint32_t maxHoldUs;
+};
+
+struct ProfiledMutex
+{
+  const char *name;
+  SemaphoreHandle_t handle;
+  UBaseType_t ceiling;       // MUTEX_NO_CEILING for priority inheritance only
+  UBaseType_t ownerPriority; // Priority of the holder before the ceiling
+  uint32_t takenUs;          // When the holder got the mutex
+  MutexStats stats;
+};
+
+/// @brief Creates the mutex.
+/// @param mutex Mutex to create.
+/// @param name Name for printing.
+/// @param ceiling Priority ceiling, MUTEX_NO_CEILING for none.
+/// @return true if the mutex was created.
+bool mutexCreate(ProfiledMutex *mutex, const char *name, UBaseType_t ceiling);
+
+/// @brief Takes the mutex, like xSemaphoreTake.
+/// @param mutex Mutex to take.
+/// @param timeout Ticks to wait.
+/// @return pdTRUE if the mutex was taken.
+BaseType_t mutexTake(ProfiledMutex *mutex, TickType_t timeout);
+
+/// @brief Gives the mutex back, like xSemaphoreGive.
+/// @param mutex Mutex held by the calling task.
+void mutexGive(ProfiledMutex *mutex);
+
+/// @brief Takes a copy of the statistics of a mutex.
+/// @param mutex Mutex to read.
+/// @param stats Copy of the statistics.
+void getMutexStats(const ProfiledMutex *mutex, MutexStats *stats);
+
+/// @brief Upper bound of a histogram bucket.
+/// @param bucket Bucket, the last one has no bound.
+/// @return Bound in microseconds.
+uint32_t mutexBucketUs(uint8_t bucket);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef SENSOR_HISTORY_H
+#define SENSOR_HISTORY_H
+
+#include <Arduino.h>
+
+/*
+Compressed sensor history
+
+Every zone keeps its readings in two forms:
+
+Samples: blocks of HISTORY_BLOCK_SAMPLES readings, stored as the first reading and the
+zig-zag encoded deltas to the previous reading, all deltas of a block packed with the
+smallest width from 4 to 8 bits that fits them. A block whose deltas need more than
+8 bits stores the readings themselves in 10 bits. Blocks go into a byte ring of
+HISTORY_DATA_BYTES per zone, the oldest blocks are dropped to make room. The block
+being filled is kept uncompressed.
+
+Summaries: min, max and sum pyramids. A level 0 node summarises one block, every node
+of the next level summarises HISTORY_FANOUT nodes of the level below. The levels below
+the top only keep the nodes of their unfinished parent, the top level keeps the last
+HISTORY_TOP_SLOTS nodes.
+
+A query for the last n samples is exact while the n samples are still in the ring or
+the open block, which holds the pump decision and the hour trend: it decompresses the
+blocks of the window, a few at most. Longer windows add up the unfinished nodes and
+walk the completed ones newest first, level by level, in
+O(HISTORY_LEVELS * HISTORY_FANOUT) steps. Nodes only come whole, so the walk stops at
+the first one that would run past the window. A result never covers more than n
+samples and tells how many it covers.
+
+Not thread safe, callers hold xSensorsSemaphore.
+*/
+
+#define HISTORY_ZONES 5
+#define HISTORY_BLOCK_SAMPLES 16
+#define HISTORY_FANOUT 4
+#define HISTORY_LEVELS 3    // Level 2 nodes cover 256 samples
+#define HISTORY_TOP_SLOTS 8 // 2048 samples at the top level
+#ifndef HISTORY_DATA_BYTES
+#define HISTORY_DATA_BYTES 64
+#endif
+#define HISTORY_MAX_READING 1023 // 10-bit ADC
+
+struct HistoryAggregate
+{
+  uint16_t min;
+  uint16_t max;
+  uint16_t avg;
+  uint16_t count; // Samples covered, 0 when there is no history yet
+};
+
+struct HistoryStats
+{
+  uint16_t samples;        // Samples that can still be decompressed, including the open block
+  uint8_t blocks;          // Compressed blocks in the ring
+  uint16_t dataBytes;      // Bytes of the ring used by them
+  uint16_t zoneBytes;      // RAM of one zone: ring, open block and pyramid
+  uint8_t bitsPerSample10; // Average compressed size, in tenths of a bit
+};
+
+/// @brief Adds a reading to the history of a zone.
+/// @param zone Zone, 0 to HISTORY_ZONES - 1.
+/// @param reading Sensor reading, clamped to HISTORY_MAX_READING.
+void historyAdd(uint8_t zone, uint16_t reading);
+
+/// @brief Min, max and average of at most the last samples readings of a zone.
+/// @param zone Zone, 0 to HISTORY_ZONES - 1.
+/// @param samples Number of newest samples wanted.
+/// @param result Aggregate, count is the number of samples it covers, samples when they are all still kept.
+void historyQuery(uint8_t zone, uint16_t samples, HistoryAggregate *result);
+
+/// @brief Decompresses the newest samples of a zone.
+/// @param zone Zone, 0 to HISTORY_ZONES - 1.
+/// @param out Samples, oldest first.
+/// @param count Size of out.
+/// @return Number of samples written.
+uint16_t historyRecent(uint8_t zone, uint16_t *out, uint16_t count);
+
+/// @brief Memory used by the history of a zone.
+/// @param zone Zone, 0 to HISTORY_ZONES - 1.
+/// @param stats Statistics.
+void getHistoryStats(uint8_t zone, HistoryStats *stats);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef SETTINGS_STORE_H
+#define SETTINGS_STORE_H
+
+#include <Arduino.h>
+#include <Arduino_FreeRTOS.h>
+#include <avr/eeprom.h>
+
+/*
+Settings store in EEPROM
+
+The EEPROM is a circular log of 8-byte records: key, sequence number, value and a
+CRC-8. A change appends a record at the head, so writes rotate over every cell of the
+EEPROM instead of wearing out a fixed address. At boot every slot is read once and the
+newest record with a valid CRC wins for each key, so restore time is bounded by the
+size of the EEPROM and a record torn by a reset is simply ignored.
+
+The two slots after the head are kept free of current records: when the head reaches
+one, that record is copied to the head first. An old copy is therefore only overwritten
+once a newer copy exists.
+
+settingsSet only changes the cached value. settingsFlush writes the keys that changed,
+once no change has been made for SETTINGS_QUIET_TICKS, so a burst of edits costs one
+record per key. Bytes are written with eeprom_update_byte, unchanged bytes are not
+erased again. Writing blocks about 3.4 ms per byte, so flush from a low priority task.
+
+tools/eeprom_endurance.py runs the same algorithm on a host to estimate wear. With a
+clock save every 10 minutes and 4 edits a day the most worn byte takes 107 cycles a
+year, 935 years to the 100 000 of the datasheet.
+*/
+
+#define SETTINGS_RECORD_SIZE 8
+#define SETTINGS_SLOTS ((E2END + 1) / SETTINGS_RECORD_SIZE)
+#ifndef SETTINGS_QUIET_TICKS
+#define SETTINGS_QUIET_TICKS pdMS_TO_TICKS(2000)
+#endif
+
+enum SettingKey
+{
+  SETTING_THRESHOLD_1,
+  SETTING_THRESHOLD_2,
+  SETTING_THRESHOLD_3,
+  SETTING_THRESHOLD_4,
+  SETTING_THRESHOLD_5,
+  SETTING_LIGHTS_ON,
+  SETTING_LIGHTS_OFF,
+  SETTING_LIGHT_MODE,
+  SETTING_TIME, // hour << 16 | min << 8 | sec
+  SETTING_COUNT
+};
+
+struct SettingsStats
+{
+  uint32_t restoreUs;   // Time settingsBegin spent reading the log
+  uint8_t restored;     // Keys found in the log
+  uint16_t crcErrors;   // Written slots that failed the CRC at boot
+  uint32_t writes;      // Records written since boot
+  uint16_t relocations; // Records copied forward to keep them ahead of the head
+  uint16_t head;        // Slot written next
+};
+
+/// @brief Reads the log and restores the newest value of every key, call before the scheduler starts.
+void settingsBegin(void);
+
+/// @brief Value of a setting.
+/// @param key Setting to read.
+/// @param value Restored or last set value, unchanged if there is none.
+/// @return true if the setting has a value.
+bool settingsGet(uint8_t key, uint32_t *value);
+
+/// @brief Changes a setting, it is written by the next settingsFlush.
+/// @param key Setting to change.
+/// @param value New value.
+void settingsSet(uint8_t key, uint32_t value);
+
+/// @brief Writes the changed settings once no change has been made for SETTINGS_QUIET_TICKS.
+/// @return Number of records written.
+uint8_t settingsFlush(void);
+
+/// @brief Takes a copy of the statistics of the settings store.
+/// @param stats Copy of the statistics.
+void getSettingsStats(SettingsStats *stats);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SOIL_SAMPLER_H
+#define SOIL_SAMPLER_H
+
+#include <Arduino.h>
+
+/*
+Adaptive soil moisture sampler
+
+Soil moisture changes over minutes, so a zone does not need a reading on every
+release of the soil moisture task. Every zone has its own sampling interval, counted
+in soil ticks (one tick per SOILMOISTURETASK_DELAY):
+  doubled, up to SAMPLER_MAX_INTERVAL, while the reading stays within
+    SAMPLER_STABLE_DELTA of the previous one
+  halved while it moves more than that
+  SAMPLER_MIN_INTERVAL while the slope is SAMPLER_STEEP_SLOPE_Q8 or more, while the
+    reading is within SAMPLER_NEAR of the threshold or above it, and for
+    SAMPLER_WATERING_TICKS after a pump was started
+  never longer than half the time the current slope needs to reach the threshold
+
+The zones wait in a min-heap ordered by their next sample tick, so finding the zones
+due in a tick visits the due zones and their children only.
+
+The sampler also measures detection lag: the caller reports when the true moisture
+of a zone crosses its threshold (known in the simulation) and when the zone is
+detected dry, the ticks in between are the lag. Building with SAMPLER_FIXED samples
+every zone on every tick, the scheme used before, to compare against.
+*/
+
+#define SAMPLER_ZONES 5
+#define SAMPLER_MIN_INTERVAL 1
+#define SAMPLER_MAX_INTERVAL 16
+#define SAMPLER_STABLE_DELTA 8       // mV, about the sensor noise
+#define SAMPLER_STEEP_SLOPE_Q8 (4 * 256) // mV per tick
+#define SAMPLER_NEAR 20              // mV below the threshold
+#define SAMPLER_WATERING_TICKS 8
+
+struct SamplerStats
+{
+  uint32_t scans;      // Ticks with at least one reading
+  uint32_t reads;      // Readings of all zones
+  uint16_t detections; // Threshold crossings detected
+  uint32_t lagSum;     // Ticks from crossing to detection
+  uint16_t lagMax;
+  uint8_t interval[SAMPLER_ZONES]; // Current interval of every zone
+};
+
+/// @brief Makes every zone due in tick 0 with the shortest interval.
+void samplerBegin(void);
+
+/// @brief Zones due for a reading, so they can be read in one scan.
+/// @param now Current soil tick.
+/// @param due Zones to read, room for SAMPLER_ZONES.
+/// @return Number of zones due, they stay due until samplerUpdate or samplerRetry.
+uint8_t samplerDue(uint32_t now, uint8_t *due);
+
+/// @brief Schedules the next reading of a zone after a successful reading.
+/// @param zone Zone read.
+/// @param now Current soil tick.
+/// @param reading Reading of the zone.
+/// @param threshold Pump threshold of the zone.
+void samplerUpdate(uint8_t zone, uint32_t now, uint16_t reading, uint16_t threshold);
+
+/// @brief Reads a zone again on the next tick after a failed reading.
+/// @param zone Zone that failed.
+/// @param now Current soil tick.
+void samplerRetry(uint8_t zone, uint32_t now);
+
+/// @brief Samples a zone at the shortest interval while its pump runs.
+/// @param zone Zone being watered.
+/// @param now Current soil tick.
+void samplerWatering(uint8_t zone, uint32_t now);
+
+/// @brief Reports whether the true moisture of a zone is past its threshold.
+/// @param zone Zone.
+/// @param now Current soil tick.
+/// @param dry true if the zone is past its threshold.
+void samplerTruth(uint8_t zone, uint32_t now, bool dry);
+
+/// @brief Reports that a zone was detected dry.
+/// @param zone Zone.
+/// @param now Current soil tick.
+void samplerDetected(uint8_t zone, uint32_t now);
+
+/// @brief Takes a copy of the statistics of the sampler.
+/// @param stats Copy of the statistics.
+void getSamplerStats(SamplerStats *stats);
+
+#endif
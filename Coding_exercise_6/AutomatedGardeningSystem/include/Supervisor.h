@@ -0,0 +1,77 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <Arduino.h>
+#include <Arduino_FreeRTOS.h>
+
+/*
+Task supervisor
+
+The kernel tick comes from the watchdog, so the watchdog can't also catch a task that
+stopped. Instead every supervised task calls supervisorBeat once per loop, which sets
+its bit in a mask. A software timer checks the mask every SUPERVISOR_PERIOD_MS:
+
+  due = dueMask[slot]   tasks whose window ends in this check
+  missed = due & ~alive
+  alive &= ~due
+
+The windows are powers of two of checks, so the tasks due in every slot are in a
+table of SUPERVISOR_SLOTS masks built at registration, and the check is the same few
+instructions whatever the number of tasks. A task is only checked after its first
+beat, so tasks that start late are not counted as missing.
+
+A task that misses a window is counted and reported by supervisorTakeMissed. A task
+that misses two windows in a row resets the board through the watchdog, the tasks
+that missed are kept in .noinit RAM and returned by supervisorResetCause after the
+restart. The watchdog stays enabled after a watchdog reset while WDRF is set, so a
+function in .init3 saves and clears MCUSR and turns the watchdog off before the C
+runtime starts, otherwise the board keeps resetting every 15 ms.
+
+The bench build measures the check and a beat with the supervisor_check and
+supervisor_beat probes.
+*/
+
+#define SUPERVISOR_TASKS 8 // Bits of the masks
+#define SUPERVISOR_SLOTS 128
+#define SUPERVISOR_PERIOD_MS 100
+
+struct SupervisorStats
+{
+  uint32_t checks;
+  uint16_t misses[SUPERVISOR_TASKS]; // Windows missed, per task
+  uint8_t watched;                   // Registered tasks
+  uint8_t started;                   // Tasks that have beaten at least once
+};
+
+/// @brief Registers a task, call before supervisorBegin.
+/// @param id Task id, 0 to SUPERVISOR_TASKS - 1.
+/// @param name Name for printing.
+/// @param windowMs Longest time allowed between two beats, rounded up to a power of two of checks.
+void supervisorWatch(uint8_t id, const char *name, uint16_t windowMs);
+
+/// @brief Starts the check timer.
+/// @return true if the timer was started.
+bool supervisorBegin(void);
+
+/// @brief Marks a task alive, call once per loop of the task.
+/// @param id Task id.
+void supervisorBeat(uint8_t id);
+
+/// @brief Tasks that missed a window since the last call.
+/// @return Mask of task ids.
+uint8_t supervisorTakeMissed(void);
+
+/// @brief Tasks that made the supervisor reset the board before this boot.
+/// @return Mask of task ids, 0 after a normal reset.
+uint8_t supervisorResetCause(void);
+
+/// @brief Name of a registered task.
+/// @param id Task id.
+/// @return Name of the task.
+const char *supervisorName(uint8_t id);
+
+/// @brief Takes a copy of the statistics of the supervisor.
+/// @param stats Copy of the statistics.
+void getSupervisorStats(SupervisorStats *stats);
+
+#endif
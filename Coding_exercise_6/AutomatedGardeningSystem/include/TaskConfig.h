@@ -0,0 +1,27 @@
+#ifndef TASK_CONFIG_H
+#define TASK_CONFIG_H
+
+/*
+Generated by tools/rta.py from tools/tasks.json, do not edit.
+Priorities are rate monotonic, periods in ms, mutex ceilings are the highest priority of their users.
+*/
+
+#define TASK_PRIO_SOIL_MOISTURE 2
+#define TASK_PERIOD_SOIL_MOISTURE 100
+#define TASK_PRIO_MAIN_EVENT 2
+#define TASK_PERIOD_MAIN_EVENT 100
+#define TASK_PRIO_WATER_CONTROL 2
+#define TASK_PERIOD_WATER_CONTROL 100
+#define TASK_PRIO_PUMP 2
+#define TASK_PERIOD_PUMP 100
+#define TASK_PRIO_LIGHT_MANAGEMENT 3
+#define TASK_PERIOD_LIGHT_MANAGEMENT 60
+#define TASK_PRIO_TIME_INCREMENT 1
+#define TASK_PERIOD_TIME_INCREMENT 1000
+#define TASK_PRIO_REPORT 1
+#define TASK_PERIOD_REPORT 5000
+#define TASK_PRIO_USER_INPUT 0
+#define TASK_CEILING_SENSORS_SEMAPHORE 2
+#define TASK_CEILING_SERIAL_SEMAPHORE 2
+
+#endif
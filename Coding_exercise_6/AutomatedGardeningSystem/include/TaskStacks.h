@@ -0,0 +1,31 @@
+#ifndef TASK_STACKS_H
+#define TASK_STACKS_H
+
+/*
+Hand estimates, not yet generated: tools/stack_usage.py --write replaces this file with
+sizes from -fstack-usage and the call graph of every build, commit its output. Until
+then every build checks these against its own call graph and fails if one is too small.
+
+Estimated from the locals and the deepest call chain of every task, with the saved
+context, an interrupt and a 25% margin on top:
+  MainEventTask       due[], readings[], fresh[], a HistoryAggregate, readSensors and
+                      the TWI or Modbus wait
+  UserInputTask       the 's' statistics and handleConfigFrame, which edits and
+                      publishes the control block and appends settings records
+  timeIncrementTask   the settings flush of the running clock, and in the sim builds
+                      the statistics printed at the end
+  ReportTask          the hour and day trends of every zone
+The stacks come from the heap, next to the pools and the sensor history: the builds
+also check .data, .bss and .noinit plus every stack (two pump tasks) against the 8 KB.
+*/
+
+#define TASK_STACK_LIGHT_MANAGEMENT 320
+#define TASK_STACK_MAIN_EVENT 480
+#define TASK_STACK_PUMP 384
+#define TASK_STACK_REPORT 512
+#define TASK_STACK_SOIL_MOISTURE 288
+#define TASK_STACK_TIME_INCREMENT 512
+#define TASK_STACK_USER_INPUT 640
+#define TASK_STACK_WATER_CONTROL 384
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef TWI_BUS_H
+#define TWI_BUS_H
+
+#include <Arduino.h>
+#include <Arduino_FreeRTOS.h>
+#include "task.h"
+
+/*
+Interrupt-driven TWI (I2C) master
+
+Wire waits for every byte in a loop on TWINT, so a task reading five sensors keeps the
+CPU busy for the whole bus time, about 0.3 ms per 2-byte register read at 100 kHz.
+Here the TWI interrupt runs the transfers as a state machine and the task sleeps.
+
+A batch is an array of transfers, each an optional write (usually the register
+address) followed by an optional read after a repeated start. twiSubmit queues the
+batch and returns. The interrupt runs the transfers of the batch back to back with
+repeated starts, and the next queued batch right after it, so the bus only stops when
+the queue is empty. A transfer that is not acknowledged gets its own status and does
+not stop the rest of the batch. The owner task is notified (xTaskNotifyGive) once the
+whole batch is done and the interrupt switches to it on return if it has the higher
+priority, twiWait sleeps until then. A batch that is not done within the
+timeout of twiWait is taken out of the queue and the TWI is reset, for a slave holding
+the bus.
+
+Batches and their buffers belong to the caller and must stay valid until twiWait
+returns.
+
+Every batch gets its bus time and the CPU time the driver took for it (twiSubmit and
+the interrupts, counted on Timer1 which runs at F_CPU for the light PWM), the
+statistics add them up over all batches. A blocking Wire read keeps the CPU busy for
+the whole bus time.
+
+SCL is PD0 (pin 21), SDA is PD1 (pin 20). The internal pull-ups are enabled like Wire
+does, real buses need external ones.
+*/
+
+#define TWI_DEFAULT_HZ 100000UL
+
+enum TwiStatus
+{
+  TWI_PENDING,
+  TWI_OK,
+  TWI_NACK,      // Address or data not acknowledged
+  TWI_BUS_ERROR, // Illegal start or stop, or arbitration lost
+  TWI_TIMEOUT    // Batch taken out of the queue by twiWait
+};
+
+struct TwiTransfer
+{
+  uint8_t address;    // 7 bit
+  const uint8_t *tx;  // Written first, NULL if txLength is 0
+  uint8_t txLength;
+  uint8_t *rx;        // Read after a repeated start, NULL if rxLength is 0
+  uint8_t rxLength;
+  volatile uint8_t status;
+};
+
+struct TwiBatch
+{
+  TwiTransfer *transfers;
+  uint8_t count;
+  TaskHandle_t owner;  // Notified when done, NULL for none
+  volatile bool done;  // Set by the driver once every transfer has a status
+  uint32_t busUs;      // Set by the driver, from the start condition to the end of the last transfer
+  uint16_t cpuCycles;  // Set by the driver, twiSubmit and the interrupts of this batch
+  TwiBatch *next;      // Used by the driver
+};
+
+struct TwiStats
+{
+  uint32_t batches;
+  uint32_t transfers;
+  uint16_t nacks;
+  uint16_t busErrors;
+  uint16_t timeouts;
+  uint32_t busUs;      // Sum over the batches, from the start condition to the last transfer
+  uint32_t maxBusUs;
+  uint32_t cpuCycles;  // Sum of the cycles in twiSubmit and the interrupt
+  uint32_t interrupts;
+};
+
+/// @brief Sets up the TWI as a master.
+/// @param hz SCL frequency.
+void twiBegin(uint32_t hz);
+
+/// @brief Queues a batch, the bus starts right away if it is idle.
+/// @param batch Batch with transfers, count and owner set.
+void twiSubmit(TwiBatch *batch);
+
+/// @brief Sleeps until every transfer of a batch is done.
+/// @param batch Batch passed to twiSubmit.
+/// @param timeout Ticks to wait, the batch is cancelled after them.
+/// @return pdTRUE if the batch finished, pdFALSE if it timed out.
+BaseType_t twiWait(TwiBatch *batch, TickType_t timeout);
+
+/// @brief Takes a copy of the statistics of the driver.
+/// @param stats Copy of the statistics.
+void getTwiStats(TwiStats *stats);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef UART_H
+#define UART_H
+
+#include <Arduino.h>
+#include <Arduino_FreeRTOS.h>
+#include "task.h"
+
+/*
+Interrupt-driven USART0 driver
+
+Replaces HardwareSerial for the gardening system, do not use Serial in the same
+program: HardwareSerial0 would bring its own USART0 interrupt handlers.
+
+TX has two paths:
+  uartWrite copies bytes into the TX ring, it only blocks while the ring is full.
+  uartQueue queues a caller-owned UartBuffer without copying. The owner task is
+  notified (xTaskNotifyGive) when the last byte has been moved to the UART, the
+  buffer must stay valid until then. uartWaitSent sleeps until that happens.
+Bytes in the TX ring go out before queued buffers. Writers that mix both paths
+should hold xSerialSemaphore and wait for their buffers to keep their output in order.
+
+Both rings are owned by the application and passed to uartBegin, so their size and
+placement are chosen where the RAM budget is known.
+
+A task woken by an interrupt (sent buffer, room in the ring, received byte) runs as
+the interrupt returns, not at the next tick. In the bench build the uart_tx_kb probe
+gives the CPU cycles the TX path takes per KB sent.
+*/
+
+struct UartBuffer
+{
+  const uint8_t *data;
+  uint16_t length;
+  TaskHandle_t owner;  // Notified when sent, NULL for none
+  volatile bool sent;  // Set by the driver once the last byte is out
+  UartBuffer *next;    // Used by the driver
+};
+
+struct UartStats
+{
+  uint32_t txBytes;
+  uint32_t rxBytes;
+  uint16_t rxOverruns; // Bytes lost because the RX ring was full
+  uint16_t rxErrors;   // Frame, data overrun and parity errors reported by the UART
+};
+
+/// @brief Sets up USART0 at the given baud rate with double speed (U2X), 8N1.
+/// @param baud Baud rate, up to 1000000 at 16 MHz.
+/// @param txRing Buffer for uartWrite.
+/// @param txSize Size of txRing.
+/// @param rxRing Buffer for received bytes.
+/// @param rxSize Size of rxRing.
+void uartBegin(uint32_t baud, uint8_t *txRing, uint16_t txSize, uint8_t *rxRing, uint16_t rxSize);
+
+/// @brief Copies bytes into the TX ring, sleeping while it is full.
+/// @param data Bytes to send.
+/// @param length Number of bytes.
+/// @param timeout Ticks to wait for room in the ring.
+/// @return Number of bytes copied.
+uint16_t uartWrite(const uint8_t *data, uint16_t length, TickType_t timeout);
+
+/// @brief Queues a caller-owned buffer for sending without copying it.
+/// @param buffer Buffer with data, length and owner set.
+void uartQueue(UartBuffer *buffer);
+
+/// @brief Sleeps until a queued buffer has been sent.
+/// @param buffer Buffer passed to uartQueue.
+/// @param timeout Ticks to wait.
+/// @return pdTRUE if the buffer was sent.
+BaseType_t uartWaitSent(UartBuffer *buffer, TickType_t timeout);
+
+/// @brief Writes a string by polling the UART, for fault handlers running with interrupts disabled.
+/// @param str Null-terminated string.
+void uartPollWrite(const char *str);
+
+/// @brief Number of received bytes waiting in the RX ring.
+uint16_t uartAvailable(void);
+
+/// @brief Takes one received byte.
+/// @return The byte, or -1 if the RX ring is empty.
+int16_t uartRead(void);
+
+/// @brief Sleeps until a byte has been received.
+/// @param timeout Ticks to wait.
+/// @return pdTRUE if a byte is waiting.
+BaseType_t uartWaitForData(TickType_t timeout);
+
+/// @brief Takes a consistent copy of the driver counters.
+/// @param stats Copy of the counters.
+void getUartStats(UartStats *stats);
+
+#endif
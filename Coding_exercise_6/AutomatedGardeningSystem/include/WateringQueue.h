@@ -0,0 +1,66 @@
+#ifndef WATERING_QUEUE_H
+#define WATERING_QUEUE_H
+
+#include <Arduino.h>
+#include <Arduino_FreeRTOS.h>
+
+/*
+Watering job queue
+
+A zone that needs water gets a job. Pending jobs wait in a max-heap ordered by zone
+priority and then by moisture deficit (reading minus threshold), so the driest zone
+of the most important group is watered first. A zone has at most one job: a request
+for a zone that is already queued raises the deficit of the queued job, a request for
+a zone whose pump is running is dropped. Both count as merged.
+
+A job starts only while fewer than WATERING_MAX_PUMPS pumps run and the current of
+its pump fits in what is left of WATERING_BUDGET_MA. The supply drives two pumps at a
+time. A pump that alone needs more than the budget still starts once nothing else
+runs, so it is not starved. Jobs start strictly in heap order, a job that does not fit
+holds back the ones behind it.
+
+Times are in kernel ticks.
+*/
+
+#define WATERING_ZONES 5
+#define WATERING_MAX_PUMPS 2
+#define WATERING_BUDGET_MA 800
+#define WATERING_PUMP_MA 400 // Default current of one pump
+
+struct WateringStats
+{
+  uint32_t requests;
+  uint32_t merged;    // Requests for a zone already queued or watering
+  uint32_t started;
+  uint32_t completed;
+  uint32_t waitSum;   // Ticks from first request to start
+  TickType_t waitMax;
+  uint8_t queued;     // Jobs waiting now
+  uint8_t running;    // Pumps running now
+  uint8_t maxQueued;
+  uint8_t maxRunning;
+};
+
+/// @brief Asks for water for a zone.
+/// @param zone Zone.
+/// @param priority Zone priority, higher first.
+/// @param deficit Reading above the pump threshold.
+/// @param currentMa Current of the pump of the zone.
+/// @param now Current tick.
+void wateringRequest(uint8_t zone, uint8_t priority, uint16_t deficit, uint16_t currentMa, TickType_t now);
+
+/// @brief Takes the next job if the pump limits allow it, the zone counts as watering until wateringDone.
+/// @param zone Zone to water.
+/// @param now Current tick.
+/// @return true if a job was started.
+bool wateringNext(uint8_t *zone, TickType_t now);
+
+/// @brief Marks the pump of a zone as stopped.
+/// @param zone Zone watered.
+void wateringDone(uint8_t zone);
+
+/// @brief Takes a copy of the statistics of the queue.
+/// @param stats Copy of the statistics.
+void getWateringStats(WateringStats *stats);
+
+#endif
@@ -0,0 +1,32 @@
+#include "BootProfile.h"
+#include <Arduino_FreeRTOS.h>
+#include "task.h"
+
+static uint32_t marks[BOOT_MARK_COUNT];
+static const char *const markNames[BOOT_MARK_COUNT] = {"setup", "settings", "scheduler", "first sample", "first decision", "first light", "console"};
+
+void bootMark(uint8_t mark)
+{
+  uint32_t now = micros();
+  // Critical sections nest before the scheduler starts too, they only save SREG and disable interrupts
+  taskENTER_CRITICAL();
+  if (marks[mark] == 0)
+  {
+    // A mark at 0 us would look unset
+    marks[mark] = now ? now : 1;
+  }
+  taskEXIT_CRITICAL();
+}
+
+uint32_t bootTime(uint8_t mark)
+{
+  taskENTER_CRITICAL();
+  uint32_t time = marks[mark];
+  taskEXIT_CRITICAL();
+  return time;
+}
+
+const char *bootMarkName(uint8_t mark)
+{
+  return markNames[mark];
+}
@@ -0,0 +1,202 @@
+#include "ConfigProtocol.h"
+#include "Uart.h"
+#include <util/crc16.h>
+
+#define CONFIG_RESPONSE_HEADER 5
+#define CONFIG_CRC_SIZE 2
+
+static uint8_t response[CONFIG_RESPONSE_HEADER + 4 * CONFIG_MAX_OPS + CONFIG_CRC_SIZE];
+static uint32_t frameStartUs = 0;
+static ConfigStats stats;
+
+/// @brief Reads one byte of a frame.
+/// @return false if none came within CONFIG_BYTE_TIMEOUT.
+static bool readByte(uint8_t *byte, uint16_t *crc)
+{
+  if (uartWaitForData(CONFIG_BYTE_TIMEOUT) != pdTRUE)
+  {
+    return false;
+  }
+  *byte = uartRead();
+  *crc = _crc_ccitt_update(*crc, *byte);
+  return true;
+}
+
+/// @brief Drops the rest of a frame whose length is unknown, up to CONFIG_BYTE_TIMEOUT without a
+/// byte, so its payload is not read as text commands.
+static void discardFrame(void)
+{
+  while (uartWaitForData(CONFIG_BYTE_TIMEOUT) == pdTRUE)
+  {
+    uartRead();
+  }
+}
+
+uint8_t configReceive(ConfigFrame *frame)
+{
+  frameStartUs = micros();
+  uint16_t crc = 0xFFFF;
+  uint8_t status = CONFIG_TIMEOUT;
+  if (readByte(&frame->seq, &crc) && readByte(&frame->count, &crc))
+  {
+    if (frame->count == 0 || frame->count > CONFIG_MAX_OPS)
+    {
+      discardFrame();
+      return CONFIG_BAD_LENGTH;
+    }
+    bool complete = true;
+    for (uint8_t i = 0; i < frame->count && complete; i++)
+    {
+      uint8_t bytes[5];
+      for (uint8_t b = 0; b < sizeof(bytes) && complete; b++)
+      {
+        complete = readByte(&bytes[b], &crc);
+      }
+      frame->ops[i].key = bytes[0];
+      frame->ops[i].value = bytes[1] | ((uint32_t)bytes[2] << 8) | ((uint32_t)bytes[3] << 16) | ((uint32_t)bytes[4] << 24);
+    }
+    uint8_t low, high;
+    // The CRC of the data followed by its CRC is 0
+    if (complete && readByte(&low, &crc) && readByte(&high, &crc))
+    {
+      status = crc == 0 ? CONFIG_OK : CONFIG_BAD_CRC;
+    }
+  }
+
+  taskENTER_CRITICAL();
+  if (status == CONFIG_TIMEOUT)
+  {
+    stats.timeouts++;
+  }
+  else if (status == CONFIG_BAD_CRC)
+  {
+    stats.crcErrors++;
+  }
+  taskEXIT_CRITICAL();
+  return status;
+}
+
+uint8_t configCheck(uint8_t key, uint32_t value, uint8_t zones)
+{
+  if (key < CONFIG_KEY_LIGHTS_ON)
+  {
+    if (key >= CONFIG_KEY_THRESHOLD + zones)
+    {
+      return CONFIG_BAD_KEY;
+    }
+    return value <= CONFIG_THRESHOLD_MAX ? CONFIG_OK : CONFIG_BAD_VALUE;
+  }
+  switch (key)
+  {
+  case CONFIG_KEY_LIGHTS_ON:
+  case CONFIG_KEY_LIGHTS_OFF:
+    return value < 24 ? CONFIG_OK : CONFIG_BAD_VALUE;
+  case CONFIG_KEY_LIGHT_MODE:
+    return value <= 1 ? CONFIG_OK : CONFIG_BAD_VALUE;
+  case CONFIG_KEY_TIME:
+    if ((value >> 16) < 24 && ((value >> 8) & 0xFF) < 60 && (value & 0xFF) < 60)
+    {
+      return CONFIG_OK;
+    }
+    return CONFIG_BAD_VALUE;
+  case CONFIG_KEY_ZONES:
+    return CONFIG_READ_ONLY;
+  default:
+    return CONFIG_BAD_KEY;
+  }
+}
+
+uint8_t configValidate(const ConfigFrame *frame, uint8_t zones, uint8_t *bad)
+{
+  for (uint8_t i = 0; i < frame->count; i++)
+  {
+    const ConfigOp *op = &frame->ops[i];
+    uint8_t key = op->key & CONFIG_KEY_MASK;
+    uint8_t status;
+    if (op->key & CONFIG_OP_SET)
+    {
+      status = configCheck(key, op->value, zones);
+    }
+    else
+    {
+      // Any key that can be set, or the read only ones, can be read
+      status = configCheck(key, 0, zones);
+      if (status == CONFIG_READ_ONLY)
+      {
+        status = CONFIG_OK;
+      }
+    }
+    if (status != CONFIG_OK)
+    {
+      *bad = i;
+      return status;
+    }
+  }
+  *bad = 0;
+  return CONFIG_OK;
+}
+
+void configRespond(const ConfigFrame *frame, uint8_t status, uint8_t bad)
+{
+  uint8_t count = status == CONFIG_OK ? frame->count : 0;
+  uint8_t length = 0;
+  response[length++] = CONFIG_RESPONSE_SYNC;
+  response[length++] = frame->seq;
+  response[length++] = status;
+  response[length++] = bad;
+  response[length++] = count;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint32_t value = frame->ops[i].value;
+    for (uint8_t b = 0; b < 4; b++)
+    {
+      response[length++] = value >> (8 * b);
+    }
+  }
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 1; i < length; i++)
+  {
+    crc = _crc_ccitt_update(crc, response[i]);
+  }
+  response[length++] = crc;
+  response[length++] = crc >> 8;
+
+  UartBuffer buffer = {response, length, xTaskGetCurrentTaskHandle()};
+  uartQueue(&buffer);
+  uint32_t frameUs = micros() - frameStartUs;
+
+  taskENTER_CRITICAL();
+  if (status == CONFIG_OK)
+  {
+    stats.frames++;
+    for (uint8_t i = 0; i < count; i++)
+    {
+      if (frame->ops[i].key & CONFIG_OP_SET)
+      {
+        stats.sets++;
+      }
+      else
+      {
+        stats.gets++;
+      }
+    }
+  }
+  else if (status != CONFIG_BAD_CRC)
+  {
+    stats.rejected++;
+  }
+  if (frameUs > stats.maxFrameUs)
+  {
+    stats.maxFrameUs = frameUs;
+  }
+  taskEXIT_CRITICAL();
+
+  uartWaitSent(&buffer, portMAX_DELAY);
+}
+
+void getConfigStats(ConfigStats *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
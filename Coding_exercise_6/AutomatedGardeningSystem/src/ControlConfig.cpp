@@ -0,0 +1,68 @@
+#include "ControlConfig.h"
+#include "task.h"
+
+// Keeps the compiler from moving loads and stores of the slots across the version checks
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+static ControlConfig slots[CONTROL_CONFIG_SLOTS];
+static volatile uint8_t published; // Slot of the current block, a single byte store publishes
+static uint8_t draft;              // Slot being changed, only between controlConfigEdit and controlConfigPublish
+static ControlConfigStats stats;
+
+void controlConfigBegin(const ControlConfig *initial)
+{
+  slots[0] = *initial;
+  slots[0].version = 1;
+  published = 0;
+  stats.version = 1;
+}
+
+void controlConfigRead(ControlConfig *copy)
+{
+  for (;;)
+  {
+    const ControlConfig *slot = &slots[published];
+    uint8_t version = slot->version;
+    COMPILER_BARRIER();
+    *copy = *slot;
+    COMPILER_BARRIER();
+    if (slot->version == version && copy->version == version)
+    {
+      break;
+    }
+    taskENTER_CRITICAL();
+    stats.retries++;
+    taskEXIT_CRITICAL();
+  }
+}
+
+ControlConfig *controlConfigEdit(void)
+{
+  // Not a critical section: the AVR port keeps SREG on the stack from enter to exit, so
+  // both have to be in one function. Suspending the scheduler is a counter.
+  vTaskSuspendAll();
+  uint8_t current = published;
+  draft = current + 1 < CONTROL_CONFIG_SLOTS ? current + 1 : 0;
+  slots[draft] = slots[current];
+  return &slots[draft];
+}
+
+void controlConfigPublish(void)
+{
+  uint8_t version = slots[published].version + 1;
+  slots[draft].version = version == 0 ? 1 : version;
+  taskENTER_CRITICAL();
+  stats.version = slots[draft].version;
+  stats.publishes++;
+  taskEXIT_CRITICAL();
+  COMPILER_BARRIER();
+  published = draft;
+  xTaskResumeAll();
+}
+
+void getControlConfigStats(ControlConfigStats *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
@@ -0,0 +1,98 @@
+#include "LightController.h"
+#include <Arduino_FreeRTOS.h>
+#include "task.h"
+#include <util/atomic.h>
+
+#define LIGHT_OUTPUT_MAX_Q8 ((int32_t)LIGHT_CONTROL_MAX << 8)
+
+// Only used by the light management task
+static int32_t filtered = 0; // Q8
+static int32_t integral = 0; // Q8
+static bool running = false; // filtered holds a reading, lastStartUs is valid
+static uint32_t lastStartUs = 0;
+
+static LightControlStats stats = {0, 0xFFFFFFFF, 0, 0, 0, 0, 0, 0};
+
+/// @brief Timer1 counts F_CPU cycles up to 0xFFFF for the light PWM.
+static uint16_t cycleCounter(void)
+{
+  uint16_t count;
+  // TCNT1 is read through the TEMP register the light ISR uses for OCR1x
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    count = TCNT1;
+  }
+  return count;
+}
+
+void lightControlReset(void)
+{
+  running = false;
+  integral = 0;
+}
+
+uint16_t lightControlStep(uint16_t reading)
+{
+  uint16_t startCycles = cycleCounter();
+  uint32_t startUs = micros();
+  uint32_t intervalUs = startUs - lastStartUs;
+  bool timed = running;
+
+  int32_t sample = (int32_t)reading << 8;
+  if (running)
+  {
+    filtered += (sample - filtered) >> LIGHT_FILTER_SHIFT;
+  }
+  else
+  {
+    filtered = sample;
+    running = true;
+  }
+  lastStartUs = startUs;
+
+  int32_t error = ((int32_t)LIGHT_SETPOINT << 8) - filtered;
+  int32_t proportional = (error * LIGHT_KP_Q8) >> 8;
+  int32_t output = proportional + integral;
+  // Anti-windup: no integration that would push a saturated output further
+  if (!(output >= LIGHT_OUTPUT_MAX_Q8 && error > 0) && !(output <= 0 && error < 0))
+  {
+    integral = constrain(integral + ((error * LIGHT_KI_Q8) >> 8), (int32_t)0, LIGHT_OUTPUT_MAX_Q8);
+  }
+  output = constrain(proportional + integral, (int32_t)0, LIGHT_OUTPUT_MAX_Q8);
+  uint16_t level = (output + 128) >> 8;
+
+  uint16_t cycles = cycleCounter() - startCycles;
+  taskENTER_CRITICAL();
+  stats.steps++;
+  if (timed)
+  {
+    if (intervalUs < stats.minIntervalUs)
+    {
+      stats.minIntervalUs = intervalUs;
+    }
+    if (intervalUs > stats.maxIntervalUs)
+    {
+      stats.maxIntervalUs = intervalUs;
+    }
+  }
+  stats.lastCycles = cycles;
+  if (cycles > stats.maxCycles)
+  {
+    stats.maxCycles = cycles;
+  }
+  if (level == 0 || level == LIGHT_CONTROL_MAX)
+  {
+    stats.saturated++;
+  }
+  stats.filtered = filtered > 0xFFFF ? 0xFFFF : filtered;
+  stats.output = level;
+  taskEXIT_CRITICAL();
+  return level;
+}
+
+void getLightControlStats(LightControlStats *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
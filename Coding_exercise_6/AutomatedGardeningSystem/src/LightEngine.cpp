@@ -0,0 +1,154 @@
+#include "LightEngine.h"
+#include "GammaTable.h"
+#include <Gpio.h>
+#include <util/atomic.h>
+#ifdef BENCHMARK
+#include <CycleProbe.h>
+#endif
+
+typedef Pin<PortB, PB5> LightPin1; // OC1A, 11
+typedef Pin<PortB, PB6> LightPin2; // OC1B, 12
+typedef Pin<PortB, PB7> LightPin3; // OC1C, 13
+typedef PinGroup<LightPin1, LightPin2, LightPin3> LightPins;
+
+// Brightness in 8.8 fixed point, so slow ramps can advance by less than one level per period
+struct LightChannel
+{
+  uint16_t level;
+  uint16_t target;
+  uint16_t step; // Per PWM period, 0 when not ramping
+};
+
+static volatile LightChannel channels[LIGHT_CHANNELS];
+
+static volatile uint16_t *const dutyRegisters[LIGHT_CHANNELS] = {&OCR1A, &OCR1B, &OCR1C};
+// Non-inverting compare output, OC1x cleared on compare match
+static const uint8_t compareOutputs[LIGHT_CHANNELS] = {_BV(COM1A1), _BV(COM1B1), _BV(COM1C1)};
+
+#ifdef BENCHMARK
+PROBE(light_ramp_isr);
+#endif
+
+/// @brief Writes the duty of a brightness, interrupts must be disabled.
+static void applyLevel(uint8_t channel, uint8_t level)
+{
+  if (level == 0)
+  {
+    // OCR1x = 0 still gives a one cycle pulse, disconnect the pin, PORTB keeps it low
+    TCCR1A &= ~compareOutputs[channel];
+  }
+  else
+  {
+    *dutyRegisters[channel] = pgm_read_word(&gammaTable[level]);
+    TCCR1A |= compareOutputs[channel];
+  }
+}
+
+void lightBegin(void)
+{
+  LightPins::low();
+  LightPins::output();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    // Fast PWM, TOP = ICR1 (mode 14), no prescaler
+    ICR1 = 0xFFFF;
+    TCCR1A = _BV(WGM11);
+    TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS10);
+    TIMSK1 = 0;
+    for (uint8_t c = 0; c < LIGHT_CHANNELS; c++)
+    {
+      channels[c].level = channels[c].target = channels[c].step = 0;
+      applyLevel(c, 0);
+    }
+  }
+}
+
+void lightSet(uint8_t channel, uint8_t level, uint16_t rampMs)
+{
+  uint16_t target = (uint16_t)level << 8;
+  uint32_t periods = (uint32_t)rampMs * LIGHT_PWM_HZ / 1000;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    volatile LightChannel *c = &channels[channel];
+    c->target = target;
+    if (periods == 0 || c->level == target)
+    {
+      c->level = target;
+      c->step = 0;
+      applyLevel(channel, level);
+    }
+    else
+    {
+      uint16_t distance = c->level > target ? c->level - target : target - c->level;
+      uint32_t step = distance / periods;
+      c->step = step ? step : 1;
+      // Overflow interrupt runs until every ramp has reached its target
+      TIFR1 = _BV(TOV1);
+      TIMSK1 |= _BV(TOIE1);
+    }
+  }
+}
+
+uint8_t lightLevel(uint8_t channel)
+{
+  uint16_t level;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    level = channels[channel].level;
+  }
+  return level >> 8;
+}
+
+uint8_t lightTarget(uint8_t channel)
+{
+  uint16_t target;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    target = channels[channel].target;
+  }
+  return target >> 8;
+}
+
+// Once per PWM period while a ramp runs, interrupts are disabled in the ISR
+ISR(TIMER1_OVF_vect)
+{
+#ifdef BENCHMARK
+  PROBE_START(light_ramp_isr);
+#endif
+  bool ramping = false;
+  for (uint8_t i = 0; i < LIGHT_CHANNELS; i++)
+  {
+    volatile LightChannel *c = &channels[i];
+    if (c->step == 0)
+    {
+      continue;
+    }
+    uint16_t level = c->level;
+    uint16_t target = c->target;
+    if (level < target)
+    {
+      level = (target - level > c->step) ? level + c->step : target;
+    }
+    else
+    {
+      level = (level - target > c->step) ? level - c->step : target;
+    }
+    c->level = level;
+    if (level == target)
+    {
+      c->step = 0;
+    }
+    else
+    {
+      ramping = true;
+    }
+    applyLevel(i, level >> 8);
+  }
+  if (!ramping)
+  {
+    TIMSK1 &= ~_BV(TOIE1);
+  }
+#ifdef BENCHMARK
+  PROBE_STOP(light_ramp_isr);
+#endif
+}
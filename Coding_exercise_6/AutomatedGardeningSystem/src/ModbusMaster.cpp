@@ -0,0 +1,467 @@
+#include "ModbusMaster.h"
+#include <Gpio.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+#define TICK_US 4                                  // Timer3 at clk/64
+#define FRAME_SIZE (5 + 2 * MODBUS_MAX_REGISTERS)   // Largest response, a read of MODBUS_MAX_REGISTERS
+#define EXCEPTION_FLAG 0x80
+
+typedef Pin<PortA, PA0> Rs485Enable; // DE and inverted RE of the transceiver, 22
+
+enum BusState
+{
+  BUS_IDLE,
+  BUS_SENDING,
+  BUS_WAITING,    // Request sent, no byte of the response yet
+  BUS_RECEIVING,
+  BUS_TURNAROUND  // t3.5 of silence after a cancelled request
+};
+
+static ModbusBatch *volatile queueHead; // Batch on the bus
+static ModbusBatch *queueTail;
+static volatile uint8_t state;
+static uint8_t request;  // Index in the batch on the bus
+static uint8_t frame[FRAME_SIZE];
+static uint8_t length, txPos;
+static bool silent;      // t1.5 passed since the last byte
+static bool broken;      // Gap, parity, framing or overrun in the current response
+static uint16_t t15, t35, responseTicks;
+static uint16_t characterUs; // Start, 8 data, parity and stop bits
+static uint32_t requestStartUs;
+static ModbusStats stats;
+static ModbusNodeStats nodeStats[MODBUS_MAX_NODE];
+
+/// @brief Restarts Timer3 with compare A at a and compare B at b, b 0 for none.
+static void armTimer(uint16_t a, uint16_t b)
+{
+  TCNT3 = 0;
+  OCR3A = a;
+  OCR3B = b;
+  TIFR3 = _BV(OCF3A) | _BV(OCF3B);
+  TIMSK3 = _BV(OCIE3A) | (b != 0 ? _BV(OCIE3B) : 0);
+}
+
+static ModbusNodeStats *statsOf(uint8_t node)
+{
+  return node >= 1 && node <= MODBUS_MAX_NODE ? &nodeStats[node - 1] : NULL;
+}
+
+static uint16_t crc(const uint8_t *data, uint8_t count)
+{
+  uint16_t value = 0xFFFF;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    value = _crc16_update(value, data[i]); // Polynomial 0xA001, the Modbus CRC
+  }
+  return value;
+}
+
+static bool valid(const ModbusRequest *r)
+{
+  if (r->node == 0 || r->values == NULL)
+  {
+    return false;
+  }
+  if (r->function == MODBUS_WRITE_REGISTER)
+  {
+    return r->quantity == 1;
+  }
+  return (r->function == MODBUS_READ_HOLDING_REGISTERS || r->function == MODBUS_READ_INPUT_REGISTERS) &&
+         r->quantity >= 1 && r->quantity <= MODBUS_MAX_REGISTERS;
+}
+
+/// @brief Builds the frame of a request and starts sending it, interrupts are disabled.
+static void sendRequest(const ModbusRequest *r)
+{
+  uint16_t data = r->function == MODBUS_WRITE_REGISTER ? r->values[0] : r->quantity;
+  frame[0] = r->node;
+  frame[1] = r->function;
+  frame[2] = r->address >> 8;
+  frame[3] = r->address & 0xFF;
+  frame[4] = data >> 8;
+  frame[5] = data & 0xFF;
+  uint16_t check = crc(frame, 6);
+  frame[6] = check & 0xFF; // The CRC goes low byte first
+  frame[7] = check >> 8;
+  length = 8;
+  txPos = 0;
+  state = BUS_SENDING;
+  TIMSK3 = 0;
+  Rs485Enable::high();
+  requestStartUs = micros();
+  stats.requests++;
+  ModbusNodeStats *node = statsOf(r->node);
+  if (node != NULL)
+  {
+    node->requests++;
+  }
+  UCSR1B |= _BV(UDRIE1);
+}
+
+/// @brief Ends the batch on the bus, interrupts are disabled.
+/// @param woken Set to pdTRUE if the notification woke a task of higher priority, NULL outside an interrupt.
+static void finishBatch(BaseType_t *woken)
+{
+  ModbusBatch *batch = queueHead;
+  queueHead = batch->next;
+  request = 0;
+  stats.batches++;
+  batch->done = true;
+  if (batch->owner != NULL)
+  {
+    vTaskNotifyGiveFromISR(batch->owner, woken);
+  }
+}
+
+/// @brief Sends the next pending request, from the next batch if this one is done, or stops at the end of the queue.
+/// @param woken Passed to finishBatch.
+static void nextRequest(BaseType_t *woken)
+{
+  while (queueHead != NULL)
+  {
+    ModbusBatch *batch = queueHead;
+    while (request < batch->count && batch->requests[request].status != MODBUS_PENDING)
+    {
+      request++;
+    }
+    if (request < batch->count)
+    {
+      if (!batch->started)
+      {
+        batch->startTick = xTaskGetTickCountFromISR();
+        batch->started = true;
+      }
+      sendRequest(&batch->requests[request]);
+      return;
+    }
+    finishBatch(woken);
+  }
+  state = BUS_IDLE;
+  TIMSK3 = 0;
+}
+
+/// @brief Checks the received frame against the request and copies the registers.
+static uint8_t parseResponse(ModbusRequest *r)
+{
+  if (broken || length < 5 || crc(frame, length) != 0)
+  {
+    return MODBUS_ERROR;
+  }
+  if (frame[0] != r->node)
+  {
+    return MODBUS_ERROR;
+  }
+  if (frame[1] == (r->function | EXCEPTION_FLAG) && length == 5)
+  {
+    r->exception = frame[2];
+    return MODBUS_EXCEPTION;
+  }
+  if (frame[1] != r->function)
+  {
+    return MODBUS_ERROR;
+  }
+  if (r->function == MODBUS_WRITE_REGISTER)
+  {
+    // The node echoes the request
+    return length == 8 && (uint16_t)(frame[2] << 8 | frame[3]) == r->address &&
+                   (uint16_t)(frame[4] << 8 | frame[5]) == r->values[0]
+               ? MODBUS_OK
+               : MODBUS_ERROR;
+  }
+  if (frame[2] != 2 * r->quantity || length != 5 + 2 * r->quantity)
+  {
+    return MODBUS_ERROR;
+  }
+  for (uint8_t i = 0; i < r->quantity; i++)
+  {
+    r->values[i] = frame[3 + 2 * i] << 8 | frame[4 + 2 * i];
+  }
+  return MODBUS_OK;
+}
+
+/// @brief Gives the request on the bus its status and sends the next one.
+/// @param woken Passed to finishBatch.
+static void finishRequest(uint8_t status, BaseType_t *woken)
+{
+  ModbusRequest *r = &queueHead->requests[request];
+  r->status = status;
+  ModbusNodeStats *node = statsOf(r->node);
+  if (node != NULL)
+  {
+    if (status == MODBUS_TIMEOUT)
+    {
+      node->timeouts++;
+    }
+    else if (status == MODBUS_ERROR)
+    {
+      node->errors++;
+    }
+    else
+    {
+      uint32_t latency = micros() - requestStartUs;
+      node->responses++;
+      node->exceptions += status == MODBUS_EXCEPTION;
+      node->latencySumUs += latency;
+      if (latency > node->latencyMaxUs)
+      {
+        node->latencyMaxUs = latency > 0xFFFF ? 0xFFFF : latency;
+      }
+    }
+  }
+  request++;
+  nextRequest(woken);
+}
+
+ISR(USART1_UDRE_vect)
+{
+  UDR1 = frame[txPos++];
+  if (txPos == length)
+  {
+    // The previous byte is still shifting out, TXC1 sets after the last one. The error
+    // flags must be written 0
+    UCSR1A = _BV(U2X1) | _BV(TXC1);
+    UCSR1B = (UCSR1B & ~_BV(UDRIE1)) | _BV(TXCIE1);
+  }
+}
+
+ISR(USART1_TX_vect)
+{
+  Rs485Enable::low();
+  UCSR1B &= ~_BV(TXCIE1);
+  state = BUS_WAITING;
+  length = 0;
+  silent = broken = false;
+  armTimer(responseTicks, 0);
+}
+
+ISR(USART1_RX_vect)
+{
+  bool error = UCSR1A & (_BV(FE1) | _BV(DOR1) | _BV(UPE1));
+  uint8_t data = UDR1;
+  if (state == BUS_WAITING)
+  {
+    state = BUS_RECEIVING;
+  }
+  else if (state == BUS_TURNAROUND)
+  {
+    armTimer(t35, 0); // The rest of a cancelled answer, silence starts after it
+    return;
+  }
+  else if (state != BUS_RECEIVING)
+  {
+    return; // A late answer or noise, dropped
+  }
+  if (silent)
+  {
+    stats.gaps += !broken;
+    broken = true;
+  }
+  if (length < FRAME_SIZE)
+  {
+    frame[length++] = data;
+  }
+  else
+  {
+    stats.overruns += !broken;
+    broken = true;
+  }
+  broken |= error;
+  silent = false;
+  armTimer(t35, t15);
+}
+
+ISR(TIMER3_COMPB_vect)
+{
+  silent = true;
+  TIMSK3 &= ~_BV(OCIE3B);
+}
+
+ISR(TIMER3_COMPA_vect)
+{
+  BaseType_t woken = pdFALSE;
+  switch (state)
+  {
+  case BUS_WAITING:
+    finishRequest(MODBUS_TIMEOUT, &woken);
+    break;
+  case BUS_RECEIVING:
+    finishRequest(parseResponse(&queueHead->requests[request]), &woken);
+    break;
+  case BUS_TURNAROUND:
+    nextRequest(&woken);
+    break;
+  default:
+    TIMSK3 = 0;
+    break;
+  }
+  // The owner of a finished batch runs when the interrupt returns instead of at the next tick
+  if (woken == pdTRUE)
+  {
+    vPortYieldFromISR();
+  }
+}
+
+void modbusBegin(uint32_t baud)
+{
+  queueHead = queueTail = NULL;
+  state = BUS_IDLE;
+  Rs485Enable::output();
+  Rs485Enable::low();
+  UBRR1 = (uint16_t)((F_CPU / 4 / baud - 1) / 2);
+  UCSR1A = _BV(U2X1);
+  UCSR1C = _BV(UPM11) | _BV(UCSZ11) | _BV(UCSZ10); // 8E1, the Modbus default
+  UCSR1B = _BV(RXEN1) | _BV(TXEN1) | _BV(RXCIE1);
+
+  TCCR3A = 0;
+  TCCR3B = _BV(CS31) | _BV(CS30); // Normal mode, clk/64
+  TIMSK3 = 0;
+  characterUs = 11000000UL / baud;
+  if (baud > 19200)
+  {
+    t15 = 750 / TICK_US;
+    t35 = 1750 / TICK_US;
+  }
+  else
+  {
+    t15 = characterUs * 3 / 2 / TICK_US;
+    t35 = characterUs * 7 / 2 / TICK_US;
+  }
+  responseTicks = MODBUS_RESPONSE_TIMEOUT_MS * 1000UL / TICK_US;
+}
+
+void modbusSubmit(ModbusBatch *batch)
+{
+  bool any = false;
+  for (uint8_t i = 0; i < batch->count; i++)
+  {
+    ModbusRequest *r = &batch->requests[i];
+    r->exception = 0;
+    r->status = valid(r) ? MODBUS_PENDING : MODBUS_ERROR;
+    any |= r->status == MODBUS_PENDING;
+  }
+  batch->done = !any;
+  batch->started = false;
+  if (batch->done)
+  {
+    return;
+  }
+  batch->next = NULL;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (queueHead == NULL)
+    {
+      queueHead = queueTail = batch;
+      if (state == BUS_IDLE)
+      {
+        // The batch has a pending request, nothing finishes and no task is notified here
+        request = 0;
+        nextRequest(NULL);
+      }
+      // Otherwise the turnaround after a cancelled request starts it
+    }
+    else
+    {
+      queueTail->next = batch;
+      queueTail = batch;
+    }
+  }
+}
+
+/// @brief Takes a batch that did not finish out of the queue, interrupts are disabled.
+static void cancel(ModbusBatch *batch)
+{
+  if (batch == queueHead)
+  {
+    // Stop whatever is on the bus and leave it silent for t3.5 before the next request
+    UCSR1B &= ~(_BV(UDRIE1) | _BV(TXCIE1));
+    Rs485Enable::low();
+    queueHead = batch->next;
+    request = 0;
+    state = BUS_TURNAROUND;
+    armTimer(t35, 0);
+  }
+  else
+  {
+    ModbusBatch *previous = queueHead;
+    while (previous->next != batch)
+    {
+      previous = previous->next;
+    }
+    previous->next = batch->next;
+    if (queueTail == batch)
+    {
+      queueTail = previous;
+    }
+  }
+  for (uint8_t i = 0; i < batch->count; i++)
+  {
+    if (batch->requests[i].status == MODBUS_PENDING)
+    {
+      batch->requests[i].status = MODBUS_TIMEOUT;
+    }
+  }
+  batch->done = true;
+  stats.cancelled++;
+}
+
+TickType_t modbusBatchTimeout(const ModbusBatch *batch)
+{
+  uint32_t us = 0;
+  for (uint8_t i = 0; i < batch->count; i++)
+  {
+    const ModbusRequest *r = &batch->requests[i];
+    // The longest answer, a write is echoed
+    uint8_t answer = r->function == MODBUS_WRITE_REGISTER ? 8 : 5 + 2 * r->quantity;
+    us += (uint32_t)(8 + answer) * characterUs + 2UL * t35 * TICK_US + MODBUS_RESPONSE_TIMEOUT_MS * 1000UL;
+  }
+  // Rounded up to whole ticks, and one tick more since the wait starts anywhere in the current tick
+  return (us * configTICK_RATE_HZ + 999999UL) / 1000000UL + 1;
+}
+
+BaseType_t modbusWait(ModbusBatch *batch, TickType_t timeout)
+{
+  // Other notifications can wake the task early, the flag decides. Time queued behind
+  // other batches is not counted, the task checks again after timeout ticks
+  while (!batch->done)
+  {
+    TickType_t waited = batch->started ? xTaskGetTickCount() - batch->startTick : 0;
+    if (waited >= timeout)
+    {
+      break;
+    }
+    ulTaskNotifyTake(pdTRUE, timeout - waited);
+  }
+  BaseType_t finished = pdTRUE;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (!batch->done)
+    {
+      cancel(batch);
+      finished = pdFALSE;
+    }
+  }
+  return finished;
+}
+
+void getModbusStats(ModbusStats *copy)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *copy = stats;
+  }
+}
+
+bool getModbusNodeStats(uint8_t node, ModbusNodeStats *copy)
+{
+  ModbusNodeStats *source = statsOf(node);
+  if (source == NULL)
+  {
+    return false;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *copy = *source;
+  }
+  return true;
+}
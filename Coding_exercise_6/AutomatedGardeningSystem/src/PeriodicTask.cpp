@@ -0,0 +1,78 @@
+#include "PeriodicTask.h"
+
+BaseType_t createPeriodicTask(PeriodicTask *task, uint16_t stackDepth, UBaseType_t priority, TaskHandle_t *handle)
+{
+  BaseType_t created = xTaskCreate(PeriodicTaskRunner, task->name, stackDepth, (void *)task, priority, &task->handle);
+  if (handle != NULL)
+  {
+    *handle = task->handle;
+  }
+  return created;
+}
+
+void PeriodicTaskRunner(void *pvParameters)
+{
+  PeriodicTask *task = (PeriodicTask *)pvParameters;
+
+  /*
+  Setup for this task
+  */
+  if (task->setup != NULL)
+  {
+    task->setup();
+  }
+  // First release is right away
+  TickType_t release = xTaskGetTickCount();
+
+  for (;;)
+  {
+    /*
+    Running tasks
+    */
+    TickType_t start = xTaskGetTickCount();
+    uint32_t startUs = micros();
+    task->body();
+    uint32_t execUs = micros() - startUs;
+    TickType_t response = xTaskGetTickCount() - release;
+
+    // Stats are multi-byte, update them in one go so readers never see half an update
+    taskENTER_CRITICAL();
+    PeriodicStats *stats = &task->stats;
+    stats->releases++;
+    // A task resumed with vTaskResume can start before its release, that is not late
+    stats->lastLateness = start - release;
+    if (stats->lastLateness > (portMAX_DELAY / 2))
+    {
+      stats->lastLateness = 0;
+    }
+    if (stats->lastLateness > stats->maxLateness)
+    {
+      stats->maxLateness = stats->lastLateness;
+    }
+    stats->lastExecUs = execUs;
+    if (execUs > stats->maxExecUs)
+    {
+      stats->maxExecUs = execUs;
+    }
+    if (response > task->deadline)
+    {
+      stats->deadlineMisses++;
+    }
+    taskEXIT_CRITICAL();
+
+    // Returns pdFALSE when the next release has already passed and the task did not block
+    if (xTaskDelayUntil(&release, task->period) == pdFALSE)
+    {
+      taskENTER_CRITICAL();
+      task->stats.overruns++;
+      taskEXIT_CRITICAL();
+    }
+  }
+}
+
+void getPeriodicStats(const PeriodicTask *task, PeriodicStats *stats)
+{
+  taskENTER_CRITICAL();
+  *stats = task->stats;
+  taskEXIT_CRITICAL();
+}
@@ -0,0 +1,236 @@
+#include "PoolAllocator.h"
+#include <util/atomic.h>
+
+extern "C"
+{
+  void *__real_malloc(size_t size);
+  void __real_free(void *ptr);
+  void *__real_realloc(void *ptr, size_t size);
+  void *__wrap_malloc(size_t size);
+  void __wrap_free(void *ptr);
+  void *__wrap_realloc(void *ptr, size_t size);
+
+  // avr-libc malloc internals, see avr-libc/libc/stdlib/stdlib_private.h
+  struct __freelist
+  {
+    size_t sz;
+    struct __freelist *nx;
+  };
+  extern struct __freelist *__flp;
+  extern char *__brkval;
+  extern char *__malloc_heap_start;
+  extern char *__malloc_heap_end;
+  extern size_t __malloc_margin;
+}
+
+struct FreeBlock
+{
+  FreeBlock *next;
+};
+
+struct PoolClass
+{
+  uint8_t *start;
+  uint8_t *end;
+  FreeBlock *freeList;
+  PoolClassStats stats;
+};
+
+static uint8_t pool8[POOL_BLOCKS_8 * 8];
+static uint8_t pool16[POOL_BLOCKS_16 * 16];
+static uint8_t pool32[POOL_BLOCKS_32 * 32];
+static uint8_t pool64[POOL_BLOCKS_64 * 64];
+
+static PoolClass pools[POOL_CLASS_COUNT] = {
+    {pool8, pool8 + sizeof(pool8), NULL, {8, POOL_BLOCKS_8, 0, 0, 0, 0}},
+    {pool16, pool16 + sizeof(pool16), NULL, {16, POOL_BLOCKS_16, 0, 0, 0, 0}},
+    {pool32, pool32 + sizeof(pool32), NULL, {32, POOL_BLOCKS_32, 0, 0, 0, 0}},
+    {pool64, pool64 + sizeof(pool64), NULL, {64, POOL_BLOCKS_64, 0, 0, 0, 0}},
+};
+
+static bool poolsReady = false;
+static uint16_t heapAllocs = 0;
+static uint16_t heapFailures = 0;
+
+/// @brief Threads every block of every class on its free list.
+/// @note Done on first use, global constructors may allocate before any init code runs.
+static void initPools(void)
+{
+  for (uint8_t c = 0; c < POOL_CLASS_COUNT; c++)
+  {
+    PoolClass *pool = &pools[c];
+    for (uint8_t *block = pool->start; block < pool->end; block += pool->stats.blockSize)
+    {
+      ((FreeBlock *)block)->next = pool->freeList;
+      pool->freeList = (FreeBlock *)block;
+    }
+  }
+  poolsReady = true;
+}
+
+/// @brief Returns the class a pool block belongs to, or NULL for heap blocks.
+static PoolClass *classOf(void *ptr)
+{
+  for (uint8_t c = 0; c < POOL_CLASS_COUNT; c++)
+  {
+    if ((uint8_t *)ptr >= pools[c].start && (uint8_t *)ptr < pools[c].end)
+    {
+      return &pools[c];
+    }
+  }
+  return NULL;
+}
+
+static void *heapMalloc(size_t size)
+{
+  void *ptr = __real_malloc(size);
+  if (ptr != NULL)
+  {
+    heapAllocs++;
+  }
+  else
+  {
+    heapFailures++;
+  }
+  return ptr;
+}
+
+void *__wrap_malloc(size_t size)
+{
+  void *ptr = NULL;
+  // Tasks call malloc directly through String, so the pools and the heap are guarded here
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (!poolsReady)
+    {
+      initPools();
+    }
+    for (uint8_t c = 0; c < POOL_CLASS_COUNT; c++)
+    {
+      PoolClass *pool = &pools[c];
+      if (size > pool->stats.blockSize)
+      {
+        continue;
+      }
+      if (pool->freeList == NULL)
+      {
+        // Class full, a larger class is still better than the heap
+        pool->stats.fallbacks++;
+        continue;
+      }
+      ptr = pool->freeList;
+      pool->freeList = pool->freeList->next;
+      pool->stats.allocs++;
+      if (++pool->stats.inUse > pool->stats.highWater)
+      {
+        pool->stats.highWater = pool->stats.inUse;
+      }
+      break;
+    }
+    if (ptr == NULL)
+    {
+      ptr = heapMalloc(size);
+    }
+  }
+  return ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+  if (ptr == NULL)
+  {
+    return;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    PoolClass *pool = classOf(ptr);
+    if (pool != NULL)
+    {
+      ((FreeBlock *)ptr)->next = pool->freeList;
+      pool->freeList = (FreeBlock *)ptr;
+      pool->stats.inUse--;
+    }
+    else
+    {
+      __real_free(ptr);
+      heapAllocs--;
+    }
+  }
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  if (ptr == NULL)
+  {
+    return __wrap_malloc(size);
+  }
+  PoolClass *pool = classOf(ptr);
+  if (pool == NULL)
+  {
+    void *moved;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      moved = __real_realloc(ptr, size);
+      if (moved == NULL)
+      {
+        heapFailures++;
+      }
+    }
+    return moved;
+  }
+  // The block can hold its class size, growing within it is free
+  if (size <= pool->stats.blockSize)
+  {
+    return ptr;
+  }
+  void *moved = __wrap_malloc(size);
+  if (moved != NULL)
+  {
+    memcpy(moved, ptr, pool->stats.blockSize);
+    __wrap_free(ptr);
+  }
+  return moved;
+}
+
+void getPoolStats(uint8_t sizeClass, PoolClassStats *stats)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *stats = pools[sizeClass].stats;
+  }
+}
+
+void getHeapStats(HeapStats *stats)
+{
+  size_t freeBytes = 0;
+  size_t largest = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    for (struct __freelist *fp = __flp; fp != NULL; fp = fp->nx)
+    {
+      // sz excludes the 2 byte size header, which is usable again once merged
+      freeBytes += fp->sz;
+      if (fp->sz > largest)
+      {
+        largest = fp->sz;
+      }
+    }
+    // Space the heap has not grown into yet
+    char *top = __malloc_heap_end != NULL ? __malloc_heap_end : (char *)(RAMEND - __malloc_margin);
+    char *brk = __brkval != NULL ? __brkval : __malloc_heap_start;
+    if (top > brk)
+    {
+      size_t untouched = top - brk;
+      freeBytes += untouched;
+      if (untouched > largest)
+      {
+        largest = untouched;
+      }
+    }
+    stats->allocs = heapAllocs;
+    stats->failures = heapFailures;
+  }
+  stats->freeBytes = freeBytes;
+  stats->largestFreeBlock = largest;
+  stats->fragmentation = freeBytes == 0 ? 0 : 100 - (uint8_t)((100UL * largest) / freeBytes);
+}
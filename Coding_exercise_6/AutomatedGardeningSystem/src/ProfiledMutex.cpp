@@ -0,0 +1,104 @@
+#include "ProfiledMutex.h"
+#include "task.h"
+
+static uint8_t bucket(uint32_t us)
+{
+  uint8_t b = 0;
+  us >>= 6;
+  while (us > 0 && b < MUTEX_HIST_BUCKETS - 1)
+  {
+    us >>= 2;
+    b++;
+  }
+  return b;
+}
+
+bool mutexCreate(ProfiledMutex *mutex, const char *name, UBaseType_t ceiling)
+{
+  mutex->name = name;
+  mutex->ceiling = ceiling;
+  mutex->handle = xSemaphoreCreateMutex();
+  return mutex->handle != NULL;
+}
+
+BaseType_t mutexTake(ProfiledMutex *mutex, TickType_t timeout)
+{
+  UBaseType_t priority = uxTaskPriorityGet(NULL);
+  bool raise = mutex->ceiling != MUTEX_NO_CEILING && mutex->ceiling > priority;
+  if (raise)
+  {
+    // Immediate ceiling: nothing that uses the mutex runs from here until it is given back
+    vTaskPrioritySet(NULL, mutex->ceiling);
+  }
+  uint32_t start = micros();
+  // A first try without blocking tells whether another task held it
+  BaseType_t taken = xSemaphoreTake(mutex->handle, 0);
+  bool held = taken != pdTRUE;
+  if (held && timeout > 0)
+  {
+    taken = xSemaphoreTake(mutex->handle, timeout);
+  }
+  uint32_t now = micros();
+  uint32_t wait = now - start;
+
+  taskENTER_CRITICAL();
+  MutexStats *stats = &mutex->stats;
+  if (taken == pdTRUE)
+  {
+    mutex->ownerPriority = priority;
+    mutex->takenUs = now;
+    stats->takes++;
+    if (held)
+    {
+      stats->contended++;
+    }
+  }
+  else
+  {
+    stats->timeouts++;
+  }
+  stats->waitHist[bucket(wait)]++;
+  if (wait > stats->maxWaitUs)
+  {
+    stats->maxWaitUs = wait;
+  }
+  taskEXIT_CRITICAL();
+
+  if (taken != pdTRUE && raise)
+  {
+    vTaskPrioritySet(NULL, priority);
+  }
+  return taken;
+}
+
+void mutexGive(ProfiledMutex *mutex)
+{
+  uint32_t hold = micros() - mutex->takenUs;
+  UBaseType_t priority = mutex->ownerPriority;
+  taskENTER_CRITICAL();
+  MutexStats *stats = &mutex->stats;
+  stats->holdHist[bucket(hold)]++;
+  if (hold > stats->maxHoldUs)
+  {
+    stats->maxHoldUs = hold;
+  }
+  taskEXIT_CRITICAL();
+  xSemaphoreGive(mutex->handle);
+  if (mutex->ceiling != MUTEX_NO_CEILING && mutex->ceiling > priority)
+  {
+    // Can switch to a task that waited for the mutex
+    vTaskPrioritySet(NULL, priority);
+  }
+}
+
+void getMutexStats(const ProfiledMutex *mutex, MutexStats *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = mutex->stats;
+  taskEXIT_CRITICAL();
+}
+
+uint32_t mutexBucketUs(uint8_t b)
+{
+  return 64UL << (2 * b);
+}
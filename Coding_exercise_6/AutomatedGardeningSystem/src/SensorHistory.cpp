@@ -0,0 +1,371 @@
+#include "SensorHistory.h"
+
+#define HISTORY_DELTAS (HISTORY_BLOCK_SAMPLES - 1)
+#define HISTORY_HEADER_BITS 16 // First reading in 10 bits, width code above it
+#define HISTORY_RAW_CODE 5     // Width code of a block storing 10-bit readings
+#define HISTORY_RAW_WIDTH 10
+#define HISTORY_BLOCK_BYTES(width) (HISTORY_HEADER_BITS / 8 + (HISTORY_DELTAS * (width) + 7) / 8)
+
+static_assert(HISTORY_DATA_BYTES >= HISTORY_BLOCK_BYTES(HISTORY_RAW_WIDTH), "HISTORY_DATA_BYTES can't hold one block");
+
+struct HistoryNode
+{
+  uint16_t min;
+  uint16_t max;
+  uint32_t sum;
+};
+
+struct OpenNode
+{
+  HistoryNode node;
+  uint16_t count;
+};
+
+struct ZoneHistory
+{
+  uint16_t block[HISTORY_BLOCK_SAMPLES]; // Open block, uncompressed
+  uint8_t data[HISTORY_DATA_BYTES];      // Ring of compressed blocks
+  uint16_t oldest;                       // Offset of the oldest block
+  uint16_t used;                         // Bytes used from oldest on
+  uint8_t blocks;
+  OpenNode open[HISTORY_LEVELS];                             // Unfinished node of every level
+  HistoryNode lower[HISTORY_LEVELS - 1][HISTORY_FANOUT - 1]; // Completed children of the unfinished parent
+  HistoryNode top[HISTORY_TOP_SLOTS];                        // Ring of the newest completed top level nodes
+  uint8_t topNewest;
+  uint8_t topUsed;
+};
+
+static ZoneHistory zones[HISTORY_ZONES];
+static bool historyReady = false;
+
+static void resetNode(OpenNode *open)
+{
+  open->node.min = 0xFFFF;
+  open->node.max = 0;
+  open->node.sum = 0;
+  open->count = 0;
+}
+
+static void addSample(HistoryNode *node, uint16_t reading)
+{
+  if (reading < node->min)
+  {
+    node->min = reading;
+  }
+  if (reading > node->max)
+  {
+    node->max = reading;
+  }
+  node->sum += reading;
+}
+
+static void mergeNode(HistoryNode *into, const HistoryNode *from)
+{
+  if (from->min < into->min)
+  {
+    into->min = from->min;
+  }
+  if (from->max > into->max)
+  {
+    into->max = from->max;
+  }
+  into->sum += from->sum;
+}
+
+static uint8_t codeWidth(uint8_t code)
+{
+  return code == HISTORY_RAW_CODE ? HISTORY_RAW_WIDTH : code + 4;
+}
+
+/// @brief Writes width bits of value, bit counted from the block at start, wrapping around the ring.
+static void putBits(ZoneHistory *z, uint16_t start, uint16_t bit, uint16_t value, uint8_t width)
+{
+  for (uint8_t i = 0; i < width; i++, bit++)
+  {
+    uint8_t *byte = &z->data[(start + (bit >> 3)) % HISTORY_DATA_BYTES];
+    if (value & (1U << i))
+    {
+      *byte |= (1 << (bit & 7));
+    }
+    else
+    {
+      *byte &= ~(1 << (bit & 7));
+    }
+  }
+}
+
+static uint16_t getBits(const ZoneHistory *z, uint16_t start, uint16_t bit, uint8_t width)
+{
+  uint16_t value = 0;
+  for (uint8_t i = 0; i < width; i++, bit++)
+  {
+    if (z->data[(start + (bit >> 3)) % HISTORY_DATA_BYTES] & (1 << (bit & 7)))
+    {
+      value |= (1U << i);
+    }
+  }
+  return value;
+}
+
+static uint8_t blockBytes(const ZoneHistory *z, uint16_t start)
+{
+  return HISTORY_BLOCK_BYTES(codeWidth(getBits(z, start, 0, HISTORY_HEADER_BITS) >> 10));
+}
+
+static uint16_t zigZag(int16_t delta)
+{
+  return (uint16_t)((delta << 1) ^ (delta >> 15));
+}
+
+static int16_t unZigZag(uint16_t value)
+{
+  return (int16_t)((value >> 1) ^ -(int16_t)(value & 1));
+}
+
+/// @brief Compresses the full open block into the ring, dropping the oldest blocks to make room.
+static void closeBlock(ZoneHistory *z)
+{
+  uint8_t width = 4;
+  for (uint8_t i = 1; i < HISTORY_BLOCK_SAMPLES; i++)
+  {
+    uint16_t value = zigZag(z->block[i] - z->block[i - 1]);
+    while (value >> width)
+    {
+      width++;
+    }
+  }
+  uint8_t code = width <= 8 ? width - 4 : HISTORY_RAW_CODE;
+  width = codeWidth(code);
+  uint8_t length = HISTORY_BLOCK_BYTES(width);
+
+  while (HISTORY_DATA_BYTES - z->used < length)
+  {
+    uint8_t dropped = blockBytes(z, z->oldest);
+    z->oldest = (z->oldest + dropped) % HISTORY_DATA_BYTES;
+    z->used -= dropped;
+    z->blocks--;
+  }
+
+  uint16_t start = (z->oldest + z->used) % HISTORY_DATA_BYTES;
+  putBits(z, start, 0, z->block[0] | ((uint16_t)code << 10), HISTORY_HEADER_BITS);
+  for (uint8_t i = 1; i < HISTORY_BLOCK_SAMPLES; i++)
+  {
+    uint16_t value = code == HISTORY_RAW_CODE ? z->block[i] : zigZag(z->block[i] - z->block[i - 1]);
+    putBits(z, start, HISTORY_HEADER_BITS + (i - 1) * width, value, width);
+  }
+  z->used += length;
+  z->blocks++;
+}
+
+static void decodeBlock(const ZoneHistory *z, uint16_t start, uint16_t *out)
+{
+  uint16_t header = getBits(z, start, 0, HISTORY_HEADER_BITS);
+  uint8_t code = header >> 10;
+  uint8_t width = codeWidth(code);
+  out[0] = header & HISTORY_MAX_READING;
+  for (uint8_t i = 1; i < HISTORY_BLOCK_SAMPLES; i++)
+  {
+    uint16_t value = getBits(z, start, HISTORY_HEADER_BITS + (i - 1) * width, width);
+    out[i] = code == HISTORY_RAW_CODE ? value : out[i - 1] + unZigZag(value);
+  }
+}
+
+static void initHistory(void)
+{
+  for (uint8_t zone = 0; zone < HISTORY_ZONES; zone++)
+  {
+    for (uint8_t l = 0; l < HISTORY_LEVELS; l++)
+    {
+      resetNode(&zones[zone].open[l]);
+    }
+  }
+  historyReady = true;
+}
+
+void historyAdd(uint8_t zone, uint16_t reading)
+{
+  if (!historyReady)
+  {
+    initHistory();
+  }
+  if (reading > HISTORY_MAX_READING)
+  {
+    reading = HISTORY_MAX_READING;
+  }
+  ZoneHistory *z = &zones[zone];
+  z->block[z->open[0].count] = reading;
+  for (uint8_t l = 0; l < HISTORY_LEVELS; l++)
+  {
+    addSample(&z->open[l].node, reading);
+    z->open[l].count++;
+  }
+
+  // Close the nodes this sample completed, bottom up
+  uint16_t size = HISTORY_BLOCK_SAMPLES;
+  for (uint8_t l = 0; l < HISTORY_LEVELS && z->open[l].count == size; l++, size *= HISTORY_FANOUT)
+  {
+    if (l == 0)
+    {
+      closeBlock(z);
+    }
+    if (l < HISTORY_LEVELS - 1)
+    {
+      // The last child completes its parent too and is summarised by it
+      uint8_t child = z->open[l + 1].count / size - 1;
+      if (child < HISTORY_FANOUT - 1)
+      {
+        z->lower[l][child] = z->open[l].node;
+      }
+    }
+    else
+    {
+      z->topNewest = (z->topNewest + 1) % HISTORY_TOP_SLOTS;
+      z->top[z->topNewest] = z->open[l].node;
+      if (z->topUsed < HISTORY_TOP_SLOTS)
+      {
+        z->topUsed++;
+      }
+    }
+    resetNode(&z->open[l]);
+  }
+}
+
+/// @brief Min, max and sum of the newest samples, taken from the blocks in the ring and the open block.
+/// @param samples Number of samples, at most the samples still kept.
+static void exactRecent(const ZoneHistory *z, uint16_t samples, HistoryNode *total)
+{
+  uint16_t skip = z->blocks * HISTORY_BLOCK_SAMPLES + z->open[0].count - samples;
+  uint16_t decoded[HISTORY_BLOCK_SAMPLES];
+  uint16_t start = z->oldest;
+  for (uint8_t b = 0; b < z->blocks; b++)
+  {
+    if (skip >= HISTORY_BLOCK_SAMPLES)
+    {
+      skip -= HISTORY_BLOCK_SAMPLES;
+    }
+    else
+    {
+      decodeBlock(z, start, decoded);
+      for (uint8_t i = skip; i < HISTORY_BLOCK_SAMPLES; i++)
+      {
+        addSample(total, decoded[i]);
+      }
+      skip = 0;
+    }
+    start = (start + blockBytes(z, start)) % HISTORY_DATA_BYTES;
+  }
+  for (uint8_t i = skip; i < z->open[0].count; i++)
+  {
+    addSample(total, z->block[i]);
+  }
+}
+
+void historyQuery(uint8_t zone, uint16_t samples, HistoryAggregate *result)
+{
+  result->min = result->max = result->avg = result->count = 0;
+  if (!historyReady)
+  {
+    return;
+  }
+  const ZoneHistory *z = &zones[zone];
+  uint16_t kept = z->blocks * HISTORY_BLOCK_SAMPLES + z->open[0].count;
+  HistoryNode total = z->open[0].node;
+  uint16_t covered = z->open[0].count;
+  uint16_t size = HISTORY_BLOCK_SAMPLES;
+  uint8_t l = 0;
+
+  if (samples > kept)
+  {
+    // Completed nodes of the unfinished parent, newest first, then one level up. A node
+    // that would run past the window ends the walk, older nodes are not contiguous with it
+    for (; l < HISTORY_LEVELS - 1 && covered < samples; l++, size *= HISTORY_FANOUT)
+    {
+      uint8_t child = (z->open[l + 1].count - z->open[l].count) / size;
+      while (child > 0 && covered + size <= samples)
+      {
+        child--;
+        mergeNode(&total, &z->lower[l][child]);
+        covered += size;
+      }
+      if (child > 0)
+      {
+        break;
+      }
+    }
+    if (l == HISTORY_LEVELS - 1)
+    {
+      uint8_t slot = z->topNewest;
+      for (uint8_t i = 0; i < z->topUsed && covered + size <= samples; i++)
+      {
+        mergeNode(&total, &z->top[slot]);
+        covered += size;
+        slot = slot ? slot - 1 : HISTORY_TOP_SLOTS - 1;
+      }
+    }
+  }
+  if (samples <= kept ? covered != samples : covered < kept)
+  {
+    // Short window, or one the nodes cover less of than the ring: exact from the samples
+    covered = samples < kept ? samples : kept;
+    total.min = 0xFFFF;
+    total.max = 0;
+    total.sum = 0;
+    exactRecent(z, covered, &total);
+  }
+
+  if (covered)
+  {
+    result->min = total.min;
+    result->max = total.max;
+    result->avg = total.sum / covered;
+    result->count = covered;
+  }
+}
+
+uint16_t historyRecent(uint8_t zone, uint16_t *out, uint16_t count)
+{
+  if (!historyReady)
+  {
+    return 0;
+  }
+  const ZoneHistory *z = &zones[zone];
+  uint16_t available = z->blocks * HISTORY_BLOCK_SAMPLES + z->open[0].count;
+  uint16_t skip = available > count ? available - count : 0;
+  uint16_t written = 0;
+  uint16_t samples[HISTORY_BLOCK_SAMPLES];
+
+  uint16_t start = z->oldest;
+  for (uint8_t b = 0; b < z->blocks; b++)
+  {
+    if (skip >= HISTORY_BLOCK_SAMPLES)
+    {
+      skip -= HISTORY_BLOCK_SAMPLES;
+    }
+    else
+    {
+      decodeBlock(z, start, samples);
+      for (uint8_t i = skip; i < HISTORY_BLOCK_SAMPLES; i++)
+      {
+        out[written++] = samples[i];
+      }
+      skip = 0;
+    }
+    start = (start + blockBytes(z, start)) % HISTORY_DATA_BYTES;
+  }
+  for (uint8_t i = skip; i < z->open[0].count; i++)
+  {
+    out[written++] = z->block[i];
+  }
+  return written;
+}
+
+void getHistoryStats(uint8_t zone, HistoryStats *stats)
+{
+  const ZoneHistory *z = &zones[zone];
+  stats->samples = z->blocks * HISTORY_BLOCK_SAMPLES + (historyReady ? z->open[0].count : 0);
+  stats->blocks = z->blocks;
+  stats->dataBytes = z->used;
+  stats->zoneBytes = sizeof(ZoneHistory);
+  // used * 8 bits * 10 / (blocks * HISTORY_BLOCK_SAMPLES)
+  stats->bitsPerSample10 = z->blocks ? (uint32_t)z->used * 80 / (z->blocks * HISTORY_BLOCK_SAMPLES) : 0;
+}
@@ -0,0 +1,201 @@
+#include "SettingsStore.h"
+#include "task.h"
+#include <util/crc16.h>
+
+#define SETTINGS_NO_SLOT 0xFFFF
+#define SETTINGS_EMPTY_KEY 0xFF // Erased EEPROM
+
+struct __attribute__((packed)) SettingsRecord
+{
+  uint8_t key;
+  uint16_t seq;
+  uint32_t value;
+  uint8_t crc;
+};
+
+static_assert(sizeof(SettingsRecord) == SETTINGS_RECORD_SIZE, "SettingsRecord must fill one slot");
+
+static uint32_t cached[SETTING_COUNT];     // Value settingsGet returns
+static uint32_t persisted[SETTING_COUNT];  // Value of the newest record in EEPROM
+static uint16_t latestSlot[SETTING_COUNT]; // Slot of the newest record, SETTINGS_NO_SLOT if none
+static uint16_t present = 0;               // Keys with a value, one bit per key
+static uint16_t dirty = 0;                 // Keys changed since the last flush
+static TickType_t lastChange = 0;
+static uint16_t head = 0;
+static uint16_t nextSeq = 0;
+static SettingsStats stats;
+
+static uint8_t recordCrc(const SettingsRecord *record)
+{
+  uint8_t crc = 0;
+  const uint8_t *bytes = (const uint8_t *)record;
+  for (uint8_t i = 0; i < offsetof(SettingsRecord, crc); i++)
+  {
+    crc = _crc8_ccitt_update(crc, bytes[i]);
+  }
+  return crc;
+}
+
+static uint16_t nextSlot(uint16_t slot)
+{
+  return slot + 1 < SETTINGS_SLOTS ? slot + 1 : 0;
+}
+
+/// @brief Key whose newest record is in slot, SETTING_COUNT if none.
+static uint8_t slotOwner(uint16_t slot)
+{
+  for (uint8_t key = 0; key < SETTING_COUNT; key++)
+  {
+    if (latestSlot[key] == slot)
+    {
+      return key;
+    }
+  }
+  return SETTING_COUNT;
+}
+
+static void appendRecord(uint8_t key, uint32_t value)
+{
+  SettingsRecord record = {key, nextSeq++, value, 0};
+  record.crc = recordCrc(&record);
+  eeprom_update_block(&record, (void *)(head * SETTINGS_RECORD_SIZE), sizeof(record));
+  latestSlot[key] = head;
+  persisted[key] = value;
+  head = nextSlot(head);
+  stats.writes++;
+}
+
+/// @brief Copies the newest record of a key out of the slot after the head, before the head reaches it.
+static void keepGap(void)
+{
+  for (;;)
+  {
+    uint8_t key = slotOwner(nextSlot(head));
+    if (key == SETTING_COUNT)
+    {
+      return;
+    }
+    appendRecord(key, persisted[key]);
+    stats.relocations++;
+  }
+}
+
+void settingsBegin(void)
+{
+  uint32_t start = micros();
+  uint16_t newestSlot = SETTINGS_NO_SLOT;
+  uint16_t newestSeq = 0;
+  uint16_t seqOf[SETTING_COUNT];
+
+  for (uint8_t key = 0; key < SETTING_COUNT; key++)
+  {
+    latestSlot[key] = SETTINGS_NO_SLOT;
+  }
+  for (uint16_t slot = 0; slot < SETTINGS_SLOTS; slot++)
+  {
+    SettingsRecord record;
+    eeprom_read_block(&record, (const void *)(slot * SETTINGS_RECORD_SIZE), sizeof(record));
+    if (record.key == SETTINGS_EMPTY_KEY)
+    {
+      continue;
+    }
+    if (record.key >= SETTING_COUNT || record.crc != recordCrc(&record))
+    {
+      stats.crcErrors++;
+      continue;
+    }
+    // Sequence numbers wrap, newer means less than half the range ahead
+    if (latestSlot[record.key] == SETTINGS_NO_SLOT || (int16_t)(record.seq - seqOf[record.key]) > 0)
+    {
+      latestSlot[record.key] = slot;
+      seqOf[record.key] = record.seq;
+      persisted[record.key] = record.value;
+    }
+    if (newestSlot == SETTINGS_NO_SLOT || (int16_t)(record.seq - newestSeq) > 0)
+    {
+      newestSlot = slot;
+      newestSeq = record.seq;
+    }
+  }
+
+  for (uint8_t key = 0; key < SETTING_COUNT; key++)
+  {
+    if (latestSlot[key] != SETTINGS_NO_SLOT)
+    {
+      cached[key] = persisted[key];
+      present |= (1U << key);
+      stats.restored++;
+    }
+  }
+  if (newestSlot != SETTINGS_NO_SLOT)
+  {
+    head = nextSlot(newestSlot);
+    nextSeq = newestSeq + 1;
+    // Only a reset in the middle of a relocation leaves a current record at the head
+    while (slotOwner(head) != SETTING_COUNT)
+    {
+      head = nextSlot(head);
+    }
+    keepGap();
+  }
+  stats.restoreUs = micros() - start;
+}
+
+bool settingsGet(uint8_t key, uint32_t *value)
+{
+  if (key >= SETTING_COUNT || !(present & (1U << key)))
+  {
+    return false;
+  }
+  taskENTER_CRITICAL();
+  *value = cached[key];
+  taskEXIT_CRITICAL();
+  return true;
+}
+
+void settingsSet(uint8_t key, uint32_t value)
+{
+  if (key >= SETTING_COUNT)
+  {
+    return;
+  }
+  taskENTER_CRITICAL();
+  cached[key] = value;
+  present |= (1U << key);
+  dirty |= (1U << key);
+  lastChange = xTaskGetTickCount();
+  taskEXIT_CRITICAL();
+}
+
+uint8_t settingsFlush(void)
+{
+  uint8_t written = 0;
+  for (uint8_t key = 0; key < SETTING_COUNT; key++)
+  {
+    bool changed = false;
+    uint32_t value;
+    taskENTER_CRITICAL();
+    if ((dirty & (1U << key)) && xTaskGetTickCount() - lastChange >= SETTINGS_QUIET_TICKS)
+    {
+      dirty &= ~(1U << key);
+      value = cached[key];
+      changed = latestSlot[key] == SETTINGS_NO_SLOT || value != persisted[key];
+    }
+    taskEXIT_CRITICAL();
+    if (changed)
+    {
+      appendRecord(key, value);
+      keepGap();
+      written++;
+    }
+  }
+  return written;
+}
+
+void getSettingsStats(SettingsStats *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  copy->head = head;
+  taskEXIT_CRITICAL();
+}
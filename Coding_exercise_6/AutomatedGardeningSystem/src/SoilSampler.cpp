@@ -0,0 +1,249 @@
+#include "SoilSampler.h"
+#include <Arduino_FreeRTOS.h>
+#include "task.h"
+
+enum CrossingState
+{
+  CROSSING_NONE,    // Below the threshold
+  CROSSING_PENDING, // Crossed, not detected yet
+  CROSSING_SEEN     // Detected, until the zone is below the threshold again
+};
+
+struct SamplerZone
+{
+  uint32_t nextTick;
+  uint32_t lastTick; // Tick of the last reading
+  uint16_t lastReading;
+  uint8_t interval;
+  uint32_t wateringUntil;
+  uint32_t crossTick;
+  uint8_t crossing;
+};
+
+static SamplerZone zones[SAMPLER_ZONES];
+static uint8_t heap[SAMPLER_ZONES]; // Zones, min-heap on nextTick
+static uint8_t heapIndex[SAMPLER_ZONES];
+static uint32_t lastScanTick = 0xFFFFFFFF;
+static SamplerStats stats;
+
+/// @brief Ticks wrap, a is earlier if it is less than half the range behind b.
+static bool earlier(uint32_t a, uint32_t b)
+{
+  return (int32_t)(a - b) < 0;
+}
+
+static void heapSwap(uint8_t i, uint8_t j)
+{
+  uint8_t zone = heap[i];
+  heap[i] = heap[j];
+  heap[j] = zone;
+  heapIndex[heap[i]] = i;
+  heapIndex[heap[j]] = j;
+}
+
+static void siftUp(uint8_t i)
+{
+  while (i > 0)
+  {
+    uint8_t parent = (i - 1) / 2;
+    if (!earlier(zones[heap[i]].nextTick, zones[heap[parent]].nextTick))
+    {
+      return;
+    }
+    heapSwap(i, parent);
+    i = parent;
+  }
+}
+
+static void siftDown(uint8_t i)
+{
+  for (;;)
+  {
+    uint8_t smallest = i;
+    uint8_t left = 2 * i + 1;
+    uint8_t right = left + 1;
+    if (left < SAMPLER_ZONES && earlier(zones[heap[left]].nextTick, zones[heap[smallest]].nextTick))
+    {
+      smallest = left;
+    }
+    if (right < SAMPLER_ZONES && earlier(zones[heap[right]].nextTick, zones[heap[smallest]].nextTick))
+    {
+      smallest = right;
+    }
+    if (smallest == i)
+    {
+      return;
+    }
+    heapSwap(i, smallest);
+    i = smallest;
+  }
+}
+
+/// @brief Moves a zone to a new next sample tick, interrupts must be disabled.
+static void reschedule(uint8_t zone, uint32_t tick)
+{
+  bool later = earlier(zones[zone].nextTick, tick);
+  zones[zone].nextTick = tick;
+  if (later)
+  {
+    siftDown(heapIndex[zone]);
+  }
+  else
+  {
+    siftUp(heapIndex[zone]);
+  }
+}
+
+void samplerBegin(void)
+{
+  taskENTER_CRITICAL();
+  for (uint8_t i = 0; i < SAMPLER_ZONES; i++)
+  {
+    zones[i].nextTick = 0;
+    zones[i].lastTick = 0;
+    zones[i].lastReading = 0;
+    zones[i].interval = SAMPLER_MIN_INTERVAL;
+    zones[i].wateringUntil = 0;
+    zones[i].crossing = CROSSING_NONE;
+    heap[i] = i;
+    heapIndex[i] = i;
+  }
+  taskEXIT_CRITICAL();
+}
+
+uint8_t samplerDue(uint32_t now, uint8_t *due)
+{
+  uint8_t count = 0;
+  uint8_t pending[SAMPLER_ZONES + 1]; // Heap nodes left to visit
+  uint8_t top = 0;
+  pending[top++] = 0;
+  taskENTER_CRITICAL();
+  // A zone is never due before its parent in the heap, so only the due part is visited
+  while (top > 0)
+  {
+    uint8_t i = pending[--top];
+    if (i >= SAMPLER_ZONES || earlier(now, zones[heap[i]].nextTick))
+    {
+      continue;
+    }
+    due[count++] = heap[i];
+    pending[top++] = 2 * i + 1;
+    pending[top++] = 2 * i + 2;
+  }
+  if (count > 0 && lastScanTick != now)
+  {
+    lastScanTick = now;
+    stats.scans++;
+  }
+  taskEXIT_CRITICAL();
+  return count;
+}
+
+void samplerUpdate(uint8_t zone, uint32_t now, uint16_t reading, uint16_t threshold)
+{
+  taskENTER_CRITICAL();
+  SamplerZone *z = &zones[zone];
+  uint8_t interval = z->interval;
+#ifdef SAMPLER_FIXED
+  interval = 1;
+#else
+  uint32_t elapsed = now - z->lastTick;
+  uint16_t change = reading > z->lastReading ? reading - z->lastReading : z->lastReading - reading;
+  uint32_t slopeQ8 = elapsed ? ((uint32_t)change << 8) / elapsed : 0;
+  if (z->lastReading == 0 || slopeQ8 >= SAMPLER_STEEP_SLOPE_Q8 || reading + SAMPLER_NEAR >= threshold ||
+      earlier(now, z->wateringUntil))
+  {
+    interval = SAMPLER_MIN_INTERVAL;
+  }
+  else
+  {
+    if (change <= SAMPLER_STABLE_DELTA)
+    {
+      interval = interval * 2 > SAMPLER_MAX_INTERVAL ? SAMPLER_MAX_INTERVAL : interval * 2;
+    }
+    else
+    {
+      interval = interval / 2 < SAMPLER_MIN_INTERVAL ? SAMPLER_MIN_INTERVAL : interval / 2;
+    }
+    // Drying towards the threshold, sample at least twice before it is reached
+    if (reading > z->lastReading && slopeQ8 > 0)
+    {
+      uint32_t horizon = ((uint32_t)(threshold - reading) << 8) / slopeQ8 / 2;
+      if (horizon < interval)
+      {
+        interval = horizon < SAMPLER_MIN_INTERVAL ? SAMPLER_MIN_INTERVAL : horizon;
+      }
+    }
+  }
+#endif
+  z->interval = interval;
+  z->lastTick = now;
+  z->lastReading = reading;
+  stats.reads++;
+  reschedule(zone, now + interval);
+  taskEXIT_CRITICAL();
+}
+
+void samplerRetry(uint8_t zone, uint32_t now)
+{
+  taskENTER_CRITICAL();
+  reschedule(zone, now + SAMPLER_MIN_INTERVAL);
+  taskEXIT_CRITICAL();
+}
+
+void samplerWatering(uint8_t zone, uint32_t now)
+{
+  taskENTER_CRITICAL();
+  zones[zone].interval = SAMPLER_MIN_INTERVAL;
+  zones[zone].wateringUntil = now + SAMPLER_WATERING_TICKS;
+  if (earlier(now + SAMPLER_MIN_INTERVAL, zones[zone].nextTick))
+  {
+    reschedule(zone, now + SAMPLER_MIN_INTERVAL);
+  }
+  taskEXIT_CRITICAL();
+}
+
+void samplerTruth(uint8_t zone, uint32_t now, bool dry)
+{
+  taskENTER_CRITICAL();
+  SamplerZone *z = &zones[zone];
+  if (!dry)
+  {
+    z->crossing = CROSSING_NONE;
+  }
+  else if (z->crossing == CROSSING_NONE)
+  {
+    z->crossing = CROSSING_PENDING;
+    z->crossTick = now;
+  }
+  taskEXIT_CRITICAL();
+}
+
+void samplerDetected(uint8_t zone, uint32_t now)
+{
+  taskENTER_CRITICAL();
+  SamplerZone *z = &zones[zone];
+  if (z->crossing == CROSSING_PENDING)
+  {
+    uint32_t lag = now - z->crossTick;
+    z->crossing = CROSSING_SEEN;
+    stats.detections++;
+    stats.lagSum += lag;
+    if (lag > stats.lagMax)
+    {
+      stats.lagMax = lag > 0xFFFF ? 0xFFFF : lag;
+    }
+  }
+  taskEXIT_CRITICAL();
+}
+
+void getSamplerStats(SamplerStats *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  for (uint8_t i = 0; i < SAMPLER_ZONES; i++)
+  {
+    copy->interval[i] = zones[i].interval;
+  }
+  taskEXIT_CRITICAL();
+}
@@ -0,0 +1,164 @@
+#include "Supervisor.h"
+#include "task.h"
+#include <timers.h>
+#include <avr/wdt.h>
+#ifdef BENCHMARK
+#include <CycleProbe.h>
+#endif
+
+#define SUPERVISOR_RESET_MAGIC 0x5EB7
+
+// Survives the watchdog reset, not cleared by the C runtime
+struct SupervisorReset
+{
+  uint16_t magic;
+  uint8_t missed;
+};
+
+static SupervisorReset resetRecord __attribute__((section(".noinit")));
+
+// MCUSR as it was at reset, the watchdog stays on after a watchdog reset with WDRF set
+static uint8_t resetFlags __attribute__((section(".noinit")));
+
+// Runs from the startup code before main, ahead of the 15 ms watchdog timeout. Not
+// called from anywhere, so naked and used keep the compiler from adding a return or
+// dropping it.
+void wdtOff(void) __attribute__((naked, used, section(".init3")));
+void wdtOff(void)
+{
+  resetFlags = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+}
+
+static uint8_t dueMask[SUPERVISOR_SLOTS];
+static const char *names[SUPERVISOR_TASKS];
+static uint8_t slot = 0;
+static volatile uint8_t alive = 0;
+static uint8_t strikes = 0; // Tasks that missed their previous window
+static uint8_t pendingLog = 0;
+static uint8_t resetCause = 0;
+static SupervisorStats stats;
+
+#ifdef BENCHMARK
+PROBE(supervisor_check);
+PROBE(supervisor_beat);
+#endif
+
+static void reset(uint8_t missed)
+{
+  resetRecord.magic = SUPERVISOR_RESET_MAGIC;
+  resetRecord.missed = missed;
+  // Interrupts off, the watchdog times out in system reset mode
+  cli();
+  wdt_enable(WDTO_15MS);
+  for (;;)
+  {
+  }
+}
+
+/// @brief Rare path of the check, a task missed its window.
+static void missedWindow(uint8_t missed)
+{
+  if (missed & strikes)
+  {
+    reset(missed & strikes);
+  }
+  for (uint8_t id = 0; id < SUPERVISOR_TASKS; id++)
+  {
+    if (missed & (1U << id))
+    {
+      stats.misses[id]++;
+    }
+  }
+  pendingLog |= missed;
+}
+
+static void check(TimerHandle_t timer)
+{
+#ifdef BENCHMARK
+  PROBE_START(supervisor_check);
+#endif
+  taskENTER_CRITICAL();
+  stats.started |= alive;
+  uint8_t due = dueMask[slot] & stats.started;
+  uint8_t missed = due & ~alive;
+  alive &= ~due;
+  taskEXIT_CRITICAL();
+  slot = (slot + 1) & (SUPERVISOR_SLOTS - 1);
+  stats.checks++;
+  if (missed)
+  {
+    missedWindow(missed);
+  }
+  strikes = (strikes & ~due) | missed;
+#ifdef BENCHMARK
+  PROBE_STOP(supervisor_check);
+#endif
+}
+
+void supervisorWatch(uint8_t id, const char *name, uint16_t windowMs)
+{
+  uint16_t checks = (windowMs + SUPERVISOR_PERIOD_MS - 1) / SUPERVISOR_PERIOD_MS;
+  uint8_t window = 1;
+  while (window < checks && window < SUPERVISOR_SLOTS)
+  {
+    window <<= 1;
+  }
+  names[id] = name;
+  stats.watched |= (1U << id);
+  for (uint8_t s = 0; s < SUPERVISOR_SLOTS; s += window)
+  {
+    dueMask[s] |= (1U << id);
+  }
+}
+
+bool supervisorBegin(void)
+{
+  if ((resetFlags & _BV(WDRF)) && resetRecord.magic == SUPERVISOR_RESET_MAGIC)
+  {
+    resetCause = resetRecord.missed;
+  }
+  resetRecord.magic = 0;
+  TimerHandle_t timer = xTimerCreate("Supervisor", pdMS_TO_TICKS(SUPERVISOR_PERIOD_MS), pdTRUE, NULL, check);
+  return timer != NULL && xTimerStart(timer, 0) == pdPASS;
+}
+
+void supervisorBeat(uint8_t id)
+{
+#ifdef BENCHMARK
+  PROBE_START(supervisor_beat);
+#endif
+  taskENTER_CRITICAL();
+  alive |= (1U << id);
+  taskEXIT_CRITICAL();
+#ifdef BENCHMARK
+  PROBE_STOP(supervisor_beat);
+#endif
+}
+
+uint8_t supervisorTakeMissed(void)
+{
+  taskENTER_CRITICAL();
+  uint8_t missed = pendingLog;
+  pendingLog = 0;
+  taskEXIT_CRITICAL();
+  return missed;
+}
+
+uint8_t supervisorResetCause(void)
+{
+  return resetCause;
+}
+
+const char *supervisorName(uint8_t id)
+{
+  return names[id];
+}
+
+void getSupervisorStats(SupervisorStats *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
@@ -0,0 +1,263 @@
+#include "TwiBus.h"
+#include <util/atomic.h>
+#include <util/twi.h>
+
+#define TWCR_RUN (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+
+static TwiBatch *volatile queueHead; // Batch on the bus
+static TwiBatch *queueTail;
+static uint8_t transfer;  // Index in the batch on the bus
+static uint8_t txPos, rxPos;
+static uint32_t batchStartUs;
+static TwiStats stats;
+
+/// @brief Timer1 counts F_CPU cycles up to 0xFFFF for the light PWM, read with interrupts disabled.
+static inline uint16_t cycleCounter(void)
+{
+  return TCNT1;
+}
+
+/// @brief Sends the start condition of the batch at the head of the queue.
+/// @param stop _BV(TWSTO) to send a stop first.
+static void startBatch(uint8_t stop)
+{
+  batchStartUs = micros();
+  transfer = 0;
+  txPos = rxPos = 0;
+  TWCR = TWCR_RUN | _BV(TWSTA) | stop;
+}
+
+/// @brief Ends the batch on the bus and starts the next queued one, interrupts are disabled.
+/// @param woken Set to pdTRUE if the notification woke a task of higher priority.
+/// @return true if the bus goes on with another batch.
+static bool finishBatch(BaseType_t *woken)
+{
+  TwiBatch *batch = queueHead;
+  batch->busUs = micros() - batchStartUs;
+  stats.batches++;
+  stats.busUs += batch->busUs;
+  if (batch->busUs > stats.maxBusUs)
+  {
+    stats.maxBusUs = batch->busUs;
+  }
+  queueHead = batch->next;
+  batch->done = true;
+  if (batch->owner != NULL)
+  {
+    vTaskNotifyGiveFromISR(batch->owner, woken);
+  }
+  return queueHead != NULL;
+}
+
+/// @brief Gives the current transfer its status and moves to the next one with a repeated start,
+/// or stops the bus at the end of the queue.
+/// @param woken Set to pdTRUE if the end of the batch woke a task of higher priority.
+static void finishTransfer(uint8_t status, BaseType_t *woken)
+{
+  TwiBatch *batch = queueHead;
+  batch->transfers[transfer].status = status;
+  stats.transfers++;
+  if (status == TWI_NACK)
+  {
+    stats.nacks++;
+  }
+  else if (status == TWI_BUS_ERROR)
+  {
+    stats.busErrors++;
+  }
+  // After a bus error the TWI has released the bus, the stop only resets the hardware
+  uint8_t stop = status == TWI_BUS_ERROR ? _BV(TWSTO) : 0;
+  if (++transfer < batch->count)
+  {
+    txPos = rxPos = 0;
+    TWCR = TWCR_RUN | _BV(TWSTA) | stop;
+  }
+  else if (finishBatch(woken))
+  {
+    startBatch(stop);
+  }
+  else
+  {
+    TWCR = TWCR_RUN | _BV(TWSTO);
+  }
+}
+
+ISR(TWI_vect)
+{
+  uint16_t startCycles = cycleCounter();
+  if (queueHead == NULL)
+  {
+    // Bus error while idle, nothing was on the bus
+    TWCR = TWCR_RUN | _BV(TWSTO);
+    return;
+  }
+  TwiBatch *batch = queueHead; // Counts the cycles even if the batch ends here
+  BaseType_t woken = pdFALSE;
+  TwiTransfer *t = &batch->transfers[transfer];
+  switch (TW_STATUS)
+  {
+  case TW_START:
+  case TW_REP_START:
+    // Write part first, a repeated start after it for the read part
+    TWDR = (t->address << 1) | (txPos < t->txLength ? TW_WRITE : TW_READ);
+    TWCR = TWCR_RUN;
+    break;
+  case TW_MT_SLA_ACK:
+  case TW_MT_DATA_ACK:
+    if (txPos < t->txLength)
+    {
+      TWDR = t->tx[txPos++];
+      TWCR = TWCR_RUN;
+    }
+    else if (t->rxLength > 0)
+    {
+      TWCR = TWCR_RUN | _BV(TWSTA);
+    }
+    else
+    {
+      finishTransfer(TWI_OK, &woken);
+    }
+    break;
+  case TW_MR_SLA_ACK:
+    // Acknowledge every byte but the last
+    TWCR = TWCR_RUN | (t->rxLength > 1 ? _BV(TWEA) : 0);
+    break;
+  case TW_MR_DATA_ACK:
+    t->rx[rxPos++] = TWDR;
+    TWCR = TWCR_RUN | (rxPos + 1 < t->rxLength ? _BV(TWEA) : 0);
+    break;
+  case TW_MR_DATA_NACK:
+    t->rx[rxPos++] = TWDR;
+    finishTransfer(TWI_OK, &woken);
+    break;
+  case TW_MT_SLA_NACK:
+  case TW_MT_DATA_NACK:
+  case TW_MR_SLA_NACK:
+    finishTransfer(TWI_NACK, &woken);
+    break;
+  default:
+    // Bus error or arbitration lost, there is no other master
+    finishTransfer(TWI_BUS_ERROR, &woken);
+    break;
+  }
+  uint16_t cycles = cycleCounter() - startCycles;
+  batch->cpuCycles += cycles;
+  stats.interrupts++;
+  stats.cpuCycles += cycles;
+  // The waiting task runs when the interrupt returns instead of at the next tick, TWCR is already written
+  if (woken == pdTRUE)
+  {
+    vPortYieldFromISR();
+  }
+}
+
+void twiBegin(uint32_t hz)
+{
+  queueHead = queueTail = NULL;
+  PORTD |= _BV(PD0) | _BV(PD1);
+  TWSR = 0; // Prescaler 1
+  TWBR = (F_CPU / hz - 16) / 2;
+  TWCR = _BV(TWEN) | _BV(TWIE);
+}
+
+void twiSubmit(TwiBatch *batch)
+{
+  batch->done = batch->count == 0;
+  if (batch->done)
+  {
+    return;
+  }
+  for (uint8_t i = 0; i < batch->count; i++)
+  {
+    batch->transfers[i].status = TWI_PENDING;
+  }
+  batch->next = NULL;
+  batch->busUs = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uint16_t startCycles = cycleCounter();
+    if (queueHead == NULL)
+    {
+      queueHead = queueTail = batch;
+      startBatch(0);
+    }
+    else
+    {
+      queueTail->next = batch;
+      queueTail = batch;
+    }
+    batch->cpuCycles = cycleCounter() - startCycles;
+    stats.cpuCycles += batch->cpuCycles;
+  }
+}
+
+/// @brief Takes a batch that did not finish out of the queue, interrupts are disabled.
+static void cancel(TwiBatch *batch)
+{
+  if (batch == queueHead)
+  {
+    // The batch is on the bus: reset the TWI, which releases SCL and SDA
+    TWCR = 0;
+    TWCR = _BV(TWEN) | _BV(TWIE);
+    queueHead = batch->next;
+    if (queueHead != NULL)
+    {
+      startBatch(0);
+    }
+  }
+  else
+  {
+    TwiBatch *previous = queueHead;
+    while (previous->next != batch)
+    {
+      previous = previous->next;
+    }
+    previous->next = batch->next;
+    if (queueTail == batch)
+    {
+      queueTail = previous;
+    }
+  }
+  for (uint8_t i = 0; i < batch->count; i++)
+  {
+    if (batch->transfers[i].status == TWI_PENDING)
+    {
+      batch->transfers[i].status = TWI_TIMEOUT;
+    }
+  }
+  batch->done = true;
+  stats.timeouts++;
+}
+
+BaseType_t twiWait(TwiBatch *batch, TickType_t timeout)
+{
+  TickType_t start = xTaskGetTickCount();
+  // Other notifications can wake the task early, the flag decides
+  while (!batch->done)
+  {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout)
+    {
+      break;
+    }
+    ulTaskNotifyTake(pdTRUE, timeout - waited);
+  }
+  BaseType_t finished = pdTRUE;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (!batch->done)
+    {
+      cancel(batch);
+      finished = pdFALSE;
+    }
+  }
+  return finished;
+}
+
+void getTwiStats(TwiStats *copy)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *copy = stats;
+  }
+}
@@ -0,0 +1,295 @@
+#include "Uart.h"
+#include <util/atomic.h>
+#ifdef BENCHMARK
+#include <CycleProbe.h>
+#endif
+
+static uint8_t *txRing;
+static uint16_t txSize;
+static volatile uint16_t txHead, txTail;
+static uint8_t *rxRing;
+static uint16_t rxSize;
+static volatile uint16_t rxHead, rxTail;
+
+static UartBuffer *volatile queueHead;
+static UartBuffer *queueTail;
+static volatile TaskHandle_t txWaiter, rxWaiter;
+static UartStats stats;
+
+#ifdef BENCHMARK
+// CPU cycles of the TX path, uartWrite, uartQueue and the UDRE interrupt, recorded once per KB sent.
+// The registers the compiler saves on entry to the interrupt are outside the count.
+PROBE(uart_tx_kb);
+static uint32_t txCycles;
+static uint16_t txKbBytes;
+
+/// @brief Adds the cycles since start to the TX path, interrupts are disabled.
+static void txCount(uint32_t start, uint16_t bytes)
+{
+  txCycles += cycleCount() - start;
+  txKbBytes += bytes;
+  if (txKbBytes >= 1024)
+  {
+    probeRecord(&uart_tx_kb, txCycles);
+    txCycles = 0;
+    txKbBytes -= 1024;
+  }
+}
+#endif
+
+/// @brief Switches to a task woken by an interrupt before it returns, instead of at the next tick.
+/// @note vPortYieldFromISR of the AVR port, call it last, after the interrupt source is cleared.
+static inline void yieldFromISR(BaseType_t woken)
+{
+  if (woken == pdTRUE)
+  {
+    vPortYieldFromISR();
+  }
+}
+
+void uartBegin(uint32_t baud, uint8_t *tx, uint16_t txLength, uint8_t *rx, uint16_t rxLength)
+{
+  txRing = tx;
+  txSize = txLength;
+  rxRing = rx;
+  rxSize = rxLength;
+  txHead = txTail = rxHead = rxTail = 0;
+  queueHead = queueTail = NULL;
+
+  // Double speed mode halves the divider, giving exact rates up to F_CPU / 8 (2 Mbps at 16 MHz)
+  UBRR0 = (uint16_t)((F_CPU / 4 / baud - 1) / 2);
+  UCSR0A = _BV(U2X0);
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00); // 8N1
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+}
+
+uint16_t uartWrite(const uint8_t *data, uint16_t length, TickType_t timeout)
+{
+  uint16_t written = 0;
+  while (written < length)
+  {
+    bool full;
+#ifdef BENCHMARK
+    uint32_t start = cycleCount();
+#endif
+    // Ring indexes are two bytes and shared with the UDRE interrupt
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      uint16_t next = txHead + 1 == txSize ? 0 : txHead + 1;
+      full = next == txTail;
+      if (full && timeout != 0)
+      {
+        txWaiter = xTaskGetCurrentTaskHandle();
+      }
+      else
+      {
+        txRing[txHead] = data[written++];
+        txHead = next;
+      }
+      UCSR0B |= _BV(UDRIE0);
+#ifdef BENCHMARK
+      txCount(start, 0);
+#endif
+    }
+    // Ring full, sleep until the UDRE interrupt has made room.
+    // A zero timeout never sleeps, so uartWrite can be used before the scheduler starts.
+    if (full && (timeout == 0 || ulTaskNotifyTake(pdTRUE, timeout) == 0))
+    {
+      break;
+    }
+  }
+  return written;
+}
+
+void uartQueue(UartBuffer *buffer)
+{
+  buffer->sent = buffer->length == 0;
+  if (buffer->sent)
+  {
+    return;
+  }
+  buffer->next = NULL;
+#ifdef BENCHMARK
+  uint32_t start = cycleCount();
+#endif
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (queueHead == NULL)
+    {
+      queueHead = buffer;
+    }
+    else
+    {
+      queueTail->next = buffer;
+    }
+    queueTail = buffer;
+    UCSR0B |= _BV(UDRIE0);
+#ifdef BENCHMARK
+    txCount(start, 0);
+#endif
+  }
+}
+
+BaseType_t uartWaitSent(UartBuffer *buffer, TickType_t timeout)
+{
+  TickType_t start = xTaskGetTickCount();
+  // Other notifications can wake the task early, the flag decides
+  while (!buffer->sent)
+  {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout)
+    {
+      return pdFALSE;
+    }
+    ulTaskNotifyTake(pdTRUE, timeout - waited);
+  }
+  return pdTRUE;
+}
+
+void uartPollWrite(const char *str)
+{
+  UCSR0B &= ~_BV(UDRIE0);
+  while (*str != '\0')
+  {
+    while (!(UCSR0A & _BV(UDRE0)))
+    {
+    }
+    UDR0 = *str++;
+  }
+}
+
+uint16_t uartAvailable(void)
+{
+  uint16_t head, tail;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    head = rxHead;
+    tail = rxTail;
+  }
+  return head >= tail ? head - tail : rxSize - tail + head;
+}
+
+int16_t uartRead(void)
+{
+  if (uartAvailable() == 0)
+  {
+    return -1;
+  }
+  uint8_t c = rxRing[rxTail];
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    rxTail = rxTail + 1 == rxSize ? 0 : rxTail + 1;
+  }
+  return c;
+}
+
+BaseType_t uartWaitForData(TickType_t timeout)
+{
+  TickType_t start = xTaskGetTickCount();
+  for (;;)
+  {
+    bool empty;
+    // The waiter is set in the same critical section as the check, a byte received
+    // after it notifies the task and the take below returns at once
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      empty = rxHead == rxTail;
+      rxWaiter = empty ? xTaskGetCurrentTaskHandle() : NULL;
+    }
+    if (!empty)
+    {
+      return pdTRUE;
+    }
+    // Notifications left from earlier bytes can wake the task early, the ring decides
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout)
+    {
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        rxWaiter = NULL;
+      }
+      return pdFALSE;
+    }
+    ulTaskNotifyTake(pdTRUE, timeout - waited);
+  }
+}
+
+void getUartStats(UartStats *copy)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *copy = stats;
+  }
+}
+
+ISR(USART0_RX_vect)
+{
+  // Error flags belong to the byte in UDR0 and must be read before it
+  if (UCSR0A & (_BV(FE0) | _BV(DOR0) | _BV(UPE0)))
+  {
+    stats.rxErrors++;
+  }
+  uint8_t c = UDR0;
+  uint16_t next = rxHead + 1 == rxSize ? 0 : rxHead + 1;
+  if (next == rxTail)
+  {
+    stats.rxOverruns++;
+    return;
+  }
+  rxRing[rxHead] = c;
+  rxHead = next;
+  stats.rxBytes++;
+  if (rxWaiter != NULL)
+  {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(rxWaiter, &woken);
+    yieldFromISR(woken);
+  }
+}
+
+ISR(USART0_UDRE_vect)
+{
+#ifdef BENCHMARK
+  uint32_t start = cycleCount();
+#endif
+  BaseType_t woken = pdFALSE;
+  if (txTail != txHead)
+  {
+    UDR0 = txRing[txTail];
+    txTail = txTail + 1 == txSize ? 0 : txTail + 1;
+    stats.txBytes++;
+    if (txWaiter != NULL)
+    {
+      vTaskNotifyGiveFromISR(txWaiter, &woken);
+      txWaiter = NULL;
+    }
+  }
+  else if (queueHead == NULL)
+  {
+    // Nothing left, the interrupt is enabled again by the next write
+    UCSR0B &= ~_BV(UDRIE0);
+#ifdef BENCHMARK
+    txCount(start, 0);
+#endif
+    return;
+  }
+  else
+  {
+    UartBuffer *buffer = queueHead;
+    UDR0 = *buffer->data++;
+    stats.txBytes++;
+    if (--buffer->length == 0)
+    {
+      queueHead = buffer->next;
+      buffer->sent = true;
+      if (buffer->owner != NULL)
+      {
+        vTaskNotifyGiveFromISR(buffer->owner, &woken);
+      }
+    }
+  }
+#ifdef BENCHMARK
+  txCount(start, 1);
+#endif
+  yieldFromISR(woken);
+}
@@ -0,0 +1,175 @@
+#include "WateringQueue.h"
+#include "task.h"
+
+enum JobState
+{
+  JOB_IDLE,
+  JOB_QUEUED,
+  JOB_WATERING
+};
+
+struct WateringJob
+{
+  uint8_t state;
+  uint8_t priority;
+  uint16_t deficit;
+  uint16_t currentMa;
+  TickType_t requested;
+};
+
+static WateringJob jobs[WATERING_ZONES];
+static uint8_t heap[WATERING_ZONES]; // Queued zones, max-heap
+static uint8_t heapIndex[WATERING_ZONES];
+static uint8_t heapSize = 0;
+static uint16_t currentInUse = 0;
+static WateringStats stats;
+
+/// @brief true if zone a should be watered before zone b.
+static bool before(uint8_t a, uint8_t b)
+{
+  if (jobs[a].priority != jobs[b].priority)
+  {
+    return jobs[a].priority > jobs[b].priority;
+  }
+  return jobs[a].deficit > jobs[b].deficit;
+}
+
+static void heapSwap(uint8_t i, uint8_t j)
+{
+  uint8_t zone = heap[i];
+  heap[i] = heap[j];
+  heap[j] = zone;
+  heapIndex[heap[i]] = i;
+  heapIndex[heap[j]] = j;
+}
+
+static void siftUp(uint8_t i)
+{
+  while (i > 0)
+  {
+    uint8_t parent = (i - 1) / 2;
+    if (!before(heap[i], heap[parent]))
+    {
+      return;
+    }
+    heapSwap(i, parent);
+    i = parent;
+  }
+}
+
+static void siftDown(uint8_t i)
+{
+  for (;;)
+  {
+    uint8_t first = i;
+    uint8_t left = 2 * i + 1;
+    uint8_t right = left + 1;
+    if (left < heapSize && before(heap[left], heap[first]))
+    {
+      first = left;
+    }
+    if (right < heapSize && before(heap[right], heap[first]))
+    {
+      first = right;
+    }
+    if (first == i)
+    {
+      return;
+    }
+    heapSwap(i, first);
+    i = first;
+  }
+}
+
+void wateringRequest(uint8_t zone, uint8_t priority, uint16_t deficit, uint16_t currentMa, TickType_t now)
+{
+  taskENTER_CRITICAL();
+  WateringJob *job = &jobs[zone];
+  stats.requests++;
+  if (job->state == JOB_IDLE)
+  {
+    job->state = JOB_QUEUED;
+    job->priority = priority;
+    job->deficit = deficit;
+    job->currentMa = currentMa;
+    job->requested = now;
+    heap[heapSize] = zone;
+    heapIndex[zone] = heapSize;
+    heapSize++;
+    siftUp(heapSize - 1);
+    if (heapSize > stats.maxQueued)
+    {
+      stats.maxQueued = heapSize;
+    }
+  }
+  else
+  {
+    // Queued jobs keep their first request time, the wait is counted from it
+    if (job->state == JOB_QUEUED && deficit > job->deficit)
+    {
+      job->deficit = deficit;
+      siftUp(heapIndex[zone]);
+    }
+    stats.merged++;
+  }
+  taskEXIT_CRITICAL();
+}
+
+bool wateringNext(uint8_t *zone, TickType_t now)
+{
+  bool started = false;
+  taskENTER_CRITICAL();
+  if (heapSize > 0 && stats.running < WATERING_MAX_PUMPS)
+  {
+    WateringJob *job = &jobs[heap[0]];
+    if (stats.running == 0 || currentInUse + job->currentMa <= WATERING_BUDGET_MA)
+    {
+      *zone = heap[0];
+      heapSize--;
+      if (heapSize > 0)
+      {
+        heap[0] = heap[heapSize];
+        heapIndex[heap[0]] = 0;
+        siftDown(0);
+      }
+      job->state = JOB_WATERING;
+      currentInUse += job->currentMa;
+      stats.running++;
+      if (stats.running > stats.maxRunning)
+      {
+        stats.maxRunning = stats.running;
+      }
+      TickType_t wait = now - job->requested;
+      stats.started++;
+      stats.waitSum += wait;
+      if (wait > stats.waitMax)
+      {
+        stats.waitMax = wait;
+      }
+      started = true;
+    }
+  }
+  taskEXIT_CRITICAL();
+  return started;
+}
+
+void wateringDone(uint8_t zone)
+{
+  taskENTER_CRITICAL();
+  if (jobs[zone].state == JOB_WATERING)
+  {
+    jobs[zone].state = JOB_IDLE;
+    currentInUse -= jobs[zone].currentMa;
+    stats.running--;
+    stats.completed++;
+  }
+  taskEXIT_CRITICAL();
+}
+
+void getWateringStats(WateringStats *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  copy->queued = heapSize;
+  taskEXIT_CRITICAL();
+}
@@ -9,35 +9,99 @@ Libraries
 #include <event_groups.h>
 #include <queue.h>
 #include <timers.h>
+#include <avr/sleep.h>
+#include "PeriodicTask.h"
+#include "TaskConfig.h"
+#include "TaskStacks.h"
+#include "PoolAllocator.h"
+#include "Uart.h"
+#include "SensorHistory.h"
+#include "SettingsStore.h"
+#include "BootProfile.h"
+#include "LightEngine.h"
+#include "LightController.h"
+#include "SoilSampler.h"
+#include "WateringQueue.h"
+#include "ProfiledMutex.h"
+#include "Supervisor.h"
+#include "ConfigProtocol.h"
+#include "ControlConfig.h"
+#include "TwiBus.h"
+#include "ModbusMaster.h"
+#ifdef BENCHMARK
+#include <CycleProbe.h>
+#endif
 /*
 Definitions
 */
 #define TASKBIT_MOISTURE_READ (1UL << 0UL)
-#define TASKBIT_LIGHT_READ (1UL << 1UL)
-#define PUMP1 (1UL << 0UL)
-#define PUMP2 (1UL << 1UL)
-#define PUMP3 (1UL << 2UL)
-#define PUMP4 (1UL << 3UL)
-#define PUMP5 (1UL << 4UL)
-#define LEDPIN3 PB6 // 12
-#define LEDPIN2 PB5 // 11
-#define LEDPIN1 PB4 // 10
-#define SOILMOISTURETASK_DELAY 100
-#define LIGHTMANAGETASK_DELAY 1000
+#define TASKBIT_FIRST_SCAN (1UL << 2UL)  // Set once, after the first pump decision
+#define TASKBIT_FIRST_LIGHT (1UL << 3UL) // Set once, after the first light decision
+#define WATER_JOB_QUEUED (1UL << 0UL) // xPumpGroup: MainEventTask queued a watering job
+#define WATER_PUMP_DONE (1UL << 1UL)  // xPumpGroup: a pump stopped
+#define SOILMOISTURETASK_DELAY TASK_PERIOD_SOIL_MOISTURE
+#define LIGHTMANAGETASK_DELAY TASK_PERIOD_LIGHT_MANAGEMENT
+#define TIMEINCREMENTTASK_DELAY TASK_PERIOD_TIME_INCREMENT
+#define REPORTTASK_DELAY TASK_PERIOD_REPORT
+#define SERIAL_BAUD 115200
+#define SERIAL_TX_RING 256
+#define SERIAL_RX_RING 128 // Holds a full configuration frame
+#define SERIAL_READ_TIMEOUT pdMS_TO_TICKS(1000) // Same as Serial.readString()
+#define CONSOLE_START_TIMEOUT pdMS_TO_TICKS(2000) // Console comes up even if a control loop never decides
+#define WATER_IDLE_TIMEOUT pdMS_TO_TICKS(1000)    // WaterControlTask wakes up at least this often for its heartbeat
+#define TIME_MINUTES_PER_RELEASE 20             // Simulated minutes added every TIMEINCREMENTTASK_DELAY
+#define TIME_SAVE_INTERVAL_MS 600000UL          // Real time between saves of the running clock, not simulated time
+/*Light ramps, the simulated hour is 3 s*/
+#define LIGHT_CONTROL_RAMP_MS LIGHTMANAGETASK_DELAY // Controller output is spread over the next period
+#define LIGHT_SUNRISE_RAMP_MS 3000                  // Lights off for the night, scheduled lights on or off
+#define LIGHT_READ_ERROR 0xFFFF
+#ifdef SENSORS_I2C
+// Sensors on the TWI bus (TwiBus.h) instead of the fake ones
+#define MOISTURE_I2C_BASE 0x30        // Zone sensor at MOISTURE_I2C_BASE + sensorAddress
+#define MOISTURE_REGISTER 0x00        // Reading in mV, 16 bit big endian
+#define LUX_I2C_ADDRESS 0x23          // BH1750 with ADDR low
+#define LUX_CONTINUOUS_HIGH_RES 0x10  // 1 lx resolution, a new reading every 120 ms
+#define SENSOR_SCAN_TIMEOUT pdMS_TO_TICKS(50)
+#endif
+#ifdef SENSORS_MODBUS
+// Soil sensors and pumps as Modbus RTU nodes on RS-485 (ModbusMaster.h) instead of the fake ones
+#ifdef SENSORS_I2C
+#error "SENSORS_I2C and SENSORS_MODBUS both read the soil sensors, choose one"
+#endif
+#ifndef MODBUS_BAUD
+#define MODBUS_BAUD 19200
+#endif
+#define MODBUS_SENSOR_NODE_BASE 1     // Zone sensor at MODBUS_SENSOR_NODE_BASE + sensorAddress
+#define MODBUS_MOISTURE_REGISTER 0    // Input register, reading in mV
+#define MODBUS_PUMP_NODE_BASE 17      // Pump at MODBUS_PUMP_NODE_BASE + pumpAddress
+#define MODBUS_PUMP_REGISTER 0        // Holding register, 1 runs the pump
+#define MODBUS_PUMP_RETRIES 3
+#endif
+/*Sensor history, one sample per zone every SOILMOISTURETASK_DELAY*/
+#define HISTORY_SAMPLES_PER_HOUR (60 / (TIME_MINUTES_PER_RELEASE * SOILMOISTURETASK_DELAY / TIMEINCREMENTTASK_DELAY))
+#define HISTORY_SAMPLES_PER_DAY (24 * HISTORY_SAMPLES_PER_HOUR)
+#define HISTORY_DECISION_SAMPLES 4 // Pumps start on the average of the last this many samples
 /*
 Macros
 */
+/*Priority ceilings from tools/rta.py, only with -D MUTEX_PRIORITY_CEILING*/
+#ifdef MUTEX_PRIORITY_CEILING
+#define MUTEX_CEILING(ceiling) (ceiling)
+#else
+#define MUTEX_CEILING(ceiling) MUTEX_NO_CEILING
+#endif
 /*Macros for Serial.print()*/
 #define write(msg) ThreadSafePrintMessage(msg, 0)
 #define writeLine(msg) ThreadSafePrintMessage(msg, 1)
+/*Print before the scheduler runs, msg must be a string literal*/
+#define setupLine(msg) uartWrite((const uint8_t *)msg "\r\n", sizeof(msg "\r\n") - 1, 0)
 
 /*
 Globals
 */
-SemaphoreHandle_t xSerialSemaphore, xSensorsSemaphore, xTimeSemaphore;
+ProfiledMutex xSerialSemaphore, xSensorsSemaphore;
 EventGroupHandle_t xEventGroup, xPumpGroup;
-QueueHandle_t xQueue;
-TaskHandle_t MoistureTaskHandle, reportTaskHandle, UItaskHandle;
+TaskHandle_t MoistureTaskHandle, reportTaskHandle, UItaskHandle, mainEventTaskHandle, waterControlTaskHandle;
 
 enum currentTimeofDay
 {
@@ -48,11 +112,19 @@ enum currentTimeofDay
   seconds
 };
 
-volatile uint8_t day_night = day;
-uint8_t manual_automatic = 0;
-uint8_t lights_off = 18;
-uint8_t lights_on = 6;
+/*Tasks watched by the supervisor*/
+enum supervisedTask
+{
+  SUPERVISE_SOIL,
+  SUPERVISE_LIGHT,
+  SUPERVISE_MAIN,
+  SUPERVISE_WATER,
+  SUPERVISE_TIME,
+  SUPERVISE_REPORT,
+  SUPERVISE_INPUT
+};
 
+static uint16_t lightReadFailures = 0; // Only written by LightManagementTask
 static uint8_t sensorCount = 0;
 static struct
 {
@@ -60,110 +132,192 @@ static struct
   uint8_t sensorAddress;
   uint8_t pumpAddress;
   uint16_t pumpTreshold = 450;
+  uint8_t pumpPriority = 0; // Watering order between zones, higher first
+  uint16_t pumpCurrent = WATERING_PUMP_MA;
   uint16_t reading = 0;
 } globalSensors[5];
 
-struct timeStruct
-{
-  uint8_t hour = 6;
-  uint8_t min = 0;
-  uint8_t sec = 0;
-};
+/*Light mode, light hours and time of day, read lock-free by the control tasks (ControlConfig.h)*/
+static const ControlConfig controlDefaults = {0, day, 0, 6, 18, 6, 0, 0, 0};
 
-volatile timeStruct currentTime;
+/*Last configuration frame, only used by UserInputTask*/
+static ConfigFrame configFrame;
+
+/*Rings of the USART0 driver*/
+static uint8_t serialTxRing[SERIAL_TX_RING];
+static uint8_t serialRxRing[SERIAL_RX_RING];
+
+#ifdef BENCHMARK
+/*Cycle probes read by tools/bench.py*/
+PROBE(context_switch); // SoilMoistureTask sets the moisture bit until MainEventTask runs
+PROBE(mutex_take);
+PROBE(mutex_give);
+PROBE(print_message);
+PROBE(sensor_scan);
+PROBE(report);
+#endif
 
 /*
 Function declarations
 */
-void SoilMoistureTask(void *pvParameters);
-void LightManagementTask(void *pvParameters);
+void SoilMoistureSetup(void);
+void SoilMoistureTask(void);
+void LightManagementSetup(void);
+void LightManagementTask(void);
+static void setLights(uint8_t, uint8_t, uint8_t, uint16_t);
 void WaterControlTask(void *pvParameters);
 void UserInputTask(void *pvParameters);
-void ReportTask(void *pvParameters);
+void ReportTask(void);
 void pumpTask(void *pvParameters);
 void MainEventTask(void *pvParameters);
-void timeIncrementTask(void *pvParameters);
+void timeIncrementTask(void);
+void printPeriodicStats(const PeriodicTask *);
+void printStackStats(TaskHandle_t);
+void printHeapStats(void);
+void printUartStats(void);
+void printHistoryStats(void);
+void printLightControlStats(void);
+void printSettingsStats(void);
+void restoreSettings(void);
+void printBootProfile(void);
+void saveTime(void);
+void printHistory(void);
+void printTrend(uint8_t, const char *, const HistoryAggregate *);
 void updateTime(uint8_t, uint8_t);
 void setTime(uint8_t, uint8_t);
 static void addSensor(String, uint8_t, uint8_t);
 void ThreadSafePrintMessage(String, uint8_t);
+String readString(void);
+void handleConfigFrame(void);
+void applyConfig(ConfigFrame *);
+static void setConfigValue(ControlConfig *, uint8_t, uint32_t);
+static uint32_t getConfigValue(const ControlConfig *, uint8_t);
+static uint8_t timeOfDay(uint8_t);
+void printConfigStats(void);
+void printControlConfigStats(void);
+#ifdef SENSORS_I2C
+void printTwiStats(void);
+#endif
+#ifdef SENSORS_MODBUS
+static bool modbusPump(uint8_t, uint16_t);
+void printModbusStats(void);
+#endif
 uint16_t readSensor(uint8_t);
+void readSensors(const uint8_t *, uint8_t, uint16_t *);
+static uint32_t soilTickNow(void);
+void soilModelAdvance(uint32_t);
+uint16_t soilModelValue(uint8_t);
+void soilModelWater(uint8_t);
+void printSamplerStats(void);
+void printWateringStats(void);
+void printMutexStats(const ProfiledMutex *);
+void printSupervisorStats(void);
+void printSupervisorMisses(const char *, uint8_t);
 uint16_t readLightLevel(void);
 void setup(void);
 void loop(void);
+
+/*
+Periodic tasks: name, period, deadline, setup, body
+Deadline equals the period for all of them.
+*/
+PeriodicTask soilMoisturePeriodic = {"Soil", SOILMOISTURETASK_DELAY / portTICK_PERIOD_MS, SOILMOISTURETASK_DELAY / portTICK_PERIOD_MS, SoilMoistureSetup, SoilMoistureTask};
+PeriodicTask lightManagementPeriodic = {"Light", LIGHTMANAGETASK_DELAY / portTICK_PERIOD_MS, LIGHTMANAGETASK_DELAY / portTICK_PERIOD_MS, LightManagementSetup, LightManagementTask};
+PeriodicTask reportPeriodic = {"Report", REPORTTASK_DELAY / portTICK_PERIOD_MS, REPORTTASK_DELAY / portTICK_PERIOD_MS, NULL, ReportTask};
+PeriodicTask timeIncrementPeriodic = {"Time", TIMEINCREMENTTASK_DELAY / portTICK_PERIOD_MS, TIMEINCREMENTTASK_DELAY / portTICK_PERIOD_MS, NULL, timeIncrementTask};
+PeriodicTask *const periodicTasks[] = {&soilMoisturePeriodic, &lightManagementPeriodic, &reportPeriodic, &timeIncrementPeriodic};
+static uint32_t soilTicks = 0; // Releases of SoilMoistureTask, written by it, read with soilTickNow
+#ifdef SIM_RANDOM_SEED
+// tools/fleet.py gives every instance its own seed by patching this word in a copy of the ELF,
+// used and externally_visible keep the symbol under LTO
+volatile uint32_t simRandomSeed __attribute__((used, externally_visible)) = SIM_RANDOM_SEED;
+#endif
+
 /*
 Function Definitions
 */
 void setup(void)
 {
+  bootMark(BOOT_SETUP);
+#ifdef SIM_RANDOM_SEED
+  // Same sensor readings on every run of the simulation build
+  randomSeed(simRandomSeed);
+#endif
+
   // Setup Serial and related semaphore
-  Serial.begin(9600);
-  Serial.println("Setup Start");
+  uartBegin(SERIAL_BAUD, serialTxRing, sizeof(serialTxRing), serialRxRing, sizeof(serialRxRing));
+  setupLine("Setup Start");
+#ifdef SENSORS_I2C
+  twiBegin(TWI_DEFAULT_HZ);
+#endif
+#ifdef SENSORS_MODBUS
+  modbusBegin(MODBUS_BAUD);
+#endif
+  controlConfigBegin(&controlDefaults);
+  restoreSettings();
+  bootMark(BOOT_SETTINGS);
 
   // MUTEX for serial
-  if (xSerialSemaphore == NULL)
+  if (!mutexCreate(&xSerialSemaphore, "Serial", MUTEX_CEILING(TASK_CEILING_SERIAL_SEMAPHORE)))
   {
-    xSerialSemaphore = xSemaphoreCreateMutex();
-    if ((xSerialSemaphore) != NULL)
-    {
-      xSemaphoreGive((xSerialSemaphore));
-    }
-    else
-    {
-      Serial.println("Failed to create xSerialSemaphore");
-    }
+    setupLine("Failed to create xSerialSemaphore");
   }
   // MUTEX for Sensors
-  if (xSensorsSemaphore == NULL)
-  {
-    xSensorsSemaphore = xSemaphoreCreateMutex();
-    if ((xSensorsSemaphore) != NULL)
-    {
-      xSemaphoreGive((xSensorsSemaphore));
-    }
-    else
-    {
-      Serial.println("Failed to create xSensorsSemaphore");
-    }
-  }
-  // MUTEX for Time
-  if (xTimeSemaphore == NULL)
+  if (!mutexCreate(&xSensorsSemaphore, "Sensors", MUTEX_CEILING(TASK_CEILING_SENSORS_SEMAPHORE)))
   {
-    xTimeSemaphore = xSemaphoreCreateMutex();
-    if ((xTimeSemaphore) != NULL)
-    {
-      xSemaphoreGive((xTimeSemaphore));
-    }
-    else
-    {
-      Serial.println("Failed to create xTimeSemaphore");
-    }
+    setupLine("Failed to create xSensorsSemaphore");
   }
   // Create eventgroup for handling timed tasks
   xEventGroup = xEventGroupCreate();
   // Create eventgroup to handle which pump to operate
   xPumpGroup = xEventGroupCreate();
 
-  xQueue = xQueueCreate(5, sizeof(int16_t));
+  // Priorities are generated by tools/rta.py into TaskConfig.h
+  // Stack sizes are generated by tools/stack_usage.py --write into TaskStacks.h, checked on every build
+  xTaskCreate(MainEventTask,"Main",TASK_STACK_MAIN_EVENT,NULL,TASK_PRIO_MAIN_EVENT,&mainEventTaskHandle);
+  createPeriodicTask(&soilMoisturePeriodic,TASK_STACK_SOIL_MOISTURE,TASK_PRIO_SOIL_MOISTURE,&MoistureTaskHandle);
+  createPeriodicTask(&lightManagementPeriodic,TASK_STACK_LIGHT_MANAGEMENT,TASK_PRIO_LIGHT_MANAGEMENT,NULL);
+  xTaskCreate(WaterControlTask,"Water",TASK_STACK_WATER_CONTROL,NULL,TASK_PRIO_WATER_CONTROL,&waterControlTaskHandle);
+  xTaskCreate(UserInputTask,"Input",TASK_STACK_USER_INPUT,NULL,TASK_PRIO_USER_INPUT,&UItaskHandle);
+  createPeriodicTask(&timeIncrementPeriodic,TASK_STACK_TIME_INCREMENT,TASK_PRIO_TIME_INCREMENT,NULL);
+  // ReportTask is created by UserInputTask once the control loops have started
 
-  xTaskCreate(MainEventTask,"",128,NULL,0,NULL);
-  xTaskCreate(SoilMoistureTask,"",128,MoistureTaskHandle,1,NULL);
-  xTaskCreate(LightManagementTask,"",128,NULL,2,NULL);
-  xTaskCreate(WaterControlTask,"",128,NULL,2,NULL);
-  xTaskCreate(UserInputTask,"",128,UItaskHandle,3,NULL);
-  xTaskCreate(ReportTask,"",128,reportTaskHandle,4,NULL);
-  xTaskCreate(timeIncrementTask,"",128,NULL,1,NULL);
+  // Heartbeat windows, a few periods so one late release is not a miss
+  supervisorWatch(SUPERVISE_SOIL, "Soil", 4 * SOILMOISTURETASK_DELAY);
+  supervisorWatch(SUPERVISE_LIGHT, "Light", 4 * LIGHTMANAGETASK_DELAY);
+  supervisorWatch(SUPERVISE_MAIN, "Main", 4 * SOILMOISTURETASK_DELAY);
+  supervisorWatch(SUPERVISE_WATER, "Water", 2 * WATER_IDLE_TIMEOUT * portTICK_PERIOD_MS);
+  supervisorWatch(SUPERVISE_TIME, "Time", 4 * TIMEINCREMENTTASK_DELAY);
+  supervisorWatch(SUPERVISE_REPORT, "Report", 2 * REPORTTASK_DELAY);
+  supervisorWatch(SUPERVISE_INPUT, "Input", 2 * SETTINGS_QUIET_TICKS * portTICK_PERIOD_MS);
+  if (!supervisorBegin())
+  {
+    setupLine("Failed to start the supervisor");
+  }
 
-  Serial.println("Starting Task Scheduler");
+#ifdef BENCHMARK
+  probeBegin(uartPollWrite);
+#endif
+  setupLine("Starting Task Scheduler");
+  bootMark(BOOT_SCHEDULER);
   vTaskStartScheduler();
 }
 
 void loop(void)
 {
-  // Nothing to see here
+  // loop() runs in the idle task: sleep until the next interrupt (tick, UART, timers).
+  // Saves power on the board. simavr waits out the cycles spent asleep in wall-clock
+  // time, tools/sim_run of the repository skips them, so there simulated time runs far
+  // ahead of wall-clock time whenever every task is blocked.
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  sleep_enable();
+  sei();
+  sleep_cpu();
+  sleep_disable();
 }
 
-void SoilMoistureTask(void *pvParameters)
+void SoilMoistureSetup(void)
 {
   /*
   For simulation purposes it's assumed that five capasitive soil-moisture sensors
@@ -176,33 +330,40 @@ void SoilMoistureTask(void *pvParameters)
   Sensor reading is mapped between those values and displayed to user in %.
   Direct measurement values are used within the program.
 
-  Measures and keeps track of each sensors reading.
+  Measures and keeps track of each sensors reading. Each zone is read at its own
+  interval, chosen by the adaptive sampler (SoilSampler.h).
 
   Setup for this task
   */
-  if (xSemaphoreTake(xSensorsSemaphore, portMAX_DELAY) == pdTRUE)
+  if (mutexTake(&xSensorsSemaphore, portMAX_DELAY) == pdTRUE)
   {
     // Construct fake sensors
-    for (int i; i < 5; i++)
+    for (int i = 0; i < 5; i++)
     {
-      String name = "Moisture_sensor_" + i;
+      String name = "Moisture_sensor_" + String(i);
       addSensor(name, i, i);
     }
-    writeLine("Sensors created!");
-    xSemaphoreGive(xSensorsSemaphore);
+    samplerBegin();
+    mutexGive(&xSensorsSemaphore);
   }
+}
 
-  for (;;)
-  {
-    /*
-    Running tasks
-    */
-    xEventGroupSetBits(xEventGroup, TASKBIT_MOISTURE_READ);
-    vTaskDelay(SOILMOISTURETASK_DELAY / portTICK_PERIOD_MS);
-  }
+void SoilMoistureTask(void)
+{
+  /*
+  Running tasks, released every SOILMOISTURETASK_DELAY
+  */
+  supervisorBeat(SUPERVISE_SOIL);
+#ifdef BENCHMARK
+  PROBE_START(context_switch);
+#endif
+  taskENTER_CRITICAL();
+  soilTicks++;
+  taskEXIT_CRITICAL();
+  xEventGroupSetBits(xEventGroup, TASKBIT_MOISTURE_READ);
 }
 
-void LightManagementTask(void *pvParameters)
+void LightManagementSetup(void)
 {
   /*
   Light management is divided in two different parts:
@@ -211,93 +372,113 @@ void LightManagementTask(void *pvParameters)
   Real time:
     Night time: All lights off
     Day time: Light level is measured and amount of lights is adjusted to.
+              A PI controller (LightController.h) keeps the measured level at
+              LIGHT_SETPOINT, one step per release.
 
   Setup for this task
   */
-  int16_t light_level;
-  DDRB |= (_BV(LEDPIN1) | _BV(LEDPIN2) | _BV(LEDPIN3));  // LEDPINs output
-  PORTB &= (_BV(LEDPIN1) | _BV(LEDPIN2) | _BV(LEDPIN3)); // Turn LEDs off
-  writeLine("LED setup Done!");
-  for (;;)
+  lightBegin(); // PWM on the LED pins, lights off
+#ifdef SENSORS_I2C
+  static const uint8_t luxMode = LUX_CONTINUOUS_HIGH_RES;
+  TwiTransfer mode = {LUX_I2C_ADDRESS, &luxMode, 1, NULL, 0, TWI_PENDING};
+  TwiBatch batch = {&mode, 1, xTaskGetCurrentTaskHandle(), false, 0, 0, NULL};
+  twiSubmit(&batch);
+  twiWait(&batch, SENSOR_SCAN_TIMEOUT); // A sensor that missed it reads as an error later
+#endif
+}
+
+void LightManagementTask(void)
+{
+  /*
+  Running tasks, released every LIGHTMANAGETASK_DELAY
+  */
+  supervisorBeat(SUPERVISE_LIGHT);
+  ControlConfig config;
+  controlConfigRead(&config);
+  switch (config.lightMode)
   {
-    /*
-    Running tasks
-    */
-    switch (manual_automatic)
+  case 0:
+    switch (config.dayNight)
     {
-    case 0:
-      switch (day_night)
+    case day:
+      /*
+      Monitor light level live and adjust the amount of light given by LEDs
+      */
       {
-      case day:
-        /*
-        Monitor light level live and adjust the amount of light given by LEDs
-        */
-        // Start Light mesuring in the event tast
-        xEventGroupSetBits(xEventGroup, TASKBIT_LIGHT_READ);
-        // Wait for result from queue
-        if (xQueueReceive(xQueue, &light_level, portMAX_DELAY) == pdPASS)
+        uint16_t light_level = readLightLevel();
+        if (light_level == LIGHT_READ_ERROR)
         {
-          if (light_level == -1)
-          {
-            writeLine("Light level reading failed!");
-          }
-          else if (light_level < 20)
-          {
-            // Turn on all LEDs for low light levels
-            PORTB |= (_BV(LEDPIN1) | _BV(LEDPIN2) | _BV(LEDPIN3));
-          }
-          else if (light_level < 60)
-          {
-            // Turn on first two LEDs for medium light levels
-            PORTB |= (_BV(LEDPIN1) | _BV(LEDPIN2));
-            PORTB &= (_BV(LEDPIN3));
-          }
-          else if (light_level < 100)
-          {
-            // Turn on the first LED for high light levels
-            PORTB |= _BV(LEDPIN1);
-            PORTB &= (_BV(LEDPIN2) | _BV(LEDPIN3));
-          }
-          else
+          // Lights stay as they are, counted instead of printed to keep the control loop off the serial mutex
+          lightReadFailures++;
+        }
+        else
+        {
+          // Controller output is the total of the three lights, the first LED fills up first, then the second and third
+          uint16_t needed = lightControlStep(light_level);
+          uint8_t level[3];
+          for (uint8_t i = 0; i < 3; i++)
           {
-            // Turn off all LEDs for very high light levels
-            PORTB &= (_BV(LEDPIN1) | _BV(LEDPIN2) | _BV(LEDPIN3)); // Turn LEDs off
+            level[i] = needed > 255 ? 255 : needed;
+            needed -= level[i];
           }
+          setLights(level[0], level[1], level[2], LIGHT_CONTROL_RAMP_MS);
         }
-        break;
-
-      case night:
-        /*
-        Lights off during night
-        Night-time 18:00 - 6:00
-        */
-        PORTB &= (_BV(LEDPIN1) | _BV(LEDPIN2) | _BV(LEDPIN3)); // Turn LEDs off
-        break;
-
-      default:
-        break;
       }
       break;
-    case 1:
-      if ((currentTime.hour > lights_off) || (currentTime.hour < lights_on))
-      {
-        PORTB &= (_BV(LEDPIN1) | _BV(LEDPIN2) | _BV(LEDPIN3)); // Turn LEDs off
-      }
-      else if ((currentTime.hour < lights_off) || (currentTime.hour > lights_on))
-      {
-        PORTB |= (_BV(LEDPIN1) | _BV(LEDPIN2) | _BV(LEDPIN3)); // Turn LEDs on
-      }
-      else
-      {
-        PORTB |= _BV(LEDPIN3);
-        PORTB &= (_BV(LEDPIN2) | _BV(LEDPIN1));
-      }
 
+    case night:
+      /*
+      Lights off during night
+      Night-time 18:00 - 6:00
+      */
+      lightControlReset();
+      setLights(0, 0, 0, LIGHT_SUNRISE_RAMP_MS); // Sunset
       break;
+
     default:
       break;
     }
-    vTaskDelay(LIGHTMANAGETASK_DELAY / portTICK_PERIOD_MS);
+    break;
+  case 1:
+    lightControlReset();
+    if ((config.hour > config.lightsOff) || (config.hour < config.lightsOn))
+    {
+      setLights(0, 0, 0, LIGHT_SUNRISE_RAMP_MS); // Turn LEDs off
+    }
+    else if ((config.hour < config.lightsOff) || (config.hour > config.lightsOn))
+    {
+      setLights(255, 255, 255, LIGHT_SUNRISE_RAMP_MS); // Turn LEDs on
+    }
+    else
+    {
+      setLights(0, 0, 255, LIGHT_SUNRISE_RAMP_MS);
+    }
+
+    break;
+  default:
+    break;
+  }
+  if (bootTime(BOOT_FIRST_LIGHT) == 0)
+  {
+    bootMark(BOOT_FIRST_LIGHT);
+    xEventGroupSetBits(xEventGroup, TASKBIT_FIRST_LIGHT);
+  }
+}
+
+/// @brief Starts ramps of the three lights, a light already heading for its level is left alone.
+/// @param level1 Brightness of the first light, 0-255.
+/// @param level2 Brightness of the second light, 0-255.
+/// @param level3 Brightness of the third light, 0-255.
+/// @param rampMs Time the ramps take.
+static void setLights(uint8_t level1, uint8_t level2, uint8_t level3, uint16_t rampMs)
+{
+  const uint8_t level[3] = {level1, level2, level3};
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    if (lightTarget(i) != level[i])
+    {
+      lightSet(i, level[i], rampMs);
+    }
   }
 }
 
@@ -306,63 +487,47 @@ void WaterControlTask(void *pvParameters)
   /*
   There are five pumps, each assosiated with one of the moisture-sensors.
 
-  Keeps track of when to pump water from each pump
+  Keeps track of when to pump water from each pump. Jobs are queued by MainEventTask
+  and started here in order of zone priority and dryness, at most WATERING_MAX_PUMPS
+  at a time within WATERING_BUDGET_MA (WateringQueue.h).
 
   Setup for this task
   */
-  const EventBits_t xBitsToWaitFor = (PUMP1 | PUMP2 | PUMP3 | PUMP4 | PUMP5);
-  EventBits_t xEventGroupValue;
-  int *pumpNum;
+  const EventBits_t xBitsToWaitFor = (WATER_JOB_QUEUED | WATER_PUMP_DONE);
+  uint8_t zone;
   for (;;)
   {
     /*
     Running tasks
     */
 
-    // Wait for any of the specified pump bits to be set in the event group.
-    xEventGroupValue = xEventGroupWaitBits(xPumpGroup,
-                                           xBitsToWaitFor,
-                                           pdTRUE,         // Clear the bits in the event group on exit.
-                                           pdTRUE,         // Wait for all specified bits to be set.
-                                           portMAX_DELAY); // Block indefinitely until the bits are set.
+    // Wait for a new job or a stopped pump, either can let a queued job start.
+    xEventGroupWaitBits(xPumpGroup,
+                        xBitsToWaitFor,
+                        pdTRUE,              // Clear the bits in the event group on exit.
+                        pdFALSE,             // Wait for any of the specified bits.
+                        WATER_IDLE_TIMEOUT); // Wake up for the heartbeat without jobs.
+    supervisorBeat(SUPERVISE_WATER);
 
-    // Check which pump bits are set and create a corresponding pump task.
-    if ((xEventGroupValue & PUMP1) != 0)
-    {
-      int pumpValue = 0;
-      pumpNum = &pumpValue;
-      xTaskCreate(pumpTask, "PumpTask_0", 2048, (void *)pumpNum, 1, NULL);
-    }
-    if ((xEventGroupValue & PUMP2) != 0)
-    {
-      int pumpValue = 1;
-      pumpNum = &pumpValue;
-      xTaskCreate(pumpTask, "PumpTask_1", 2048, (void *)pumpNum, 1, NULL);
-    }
-    if ((xEventGroupValue & PUMP3) != 0)
-    {
-      int pumpValue = 2;
-      pumpNum = &pumpValue;
-      xTaskCreate(pumpTask, "PumpTask_2", 2048, (void *)pumpNum, 1, NULL);
-    }
-    if ((xEventGroupValue & PUMP4) != 0)
-    {
-      int pumpValue = 3;
-      pumpNum = &pumpValue;
-      xTaskCreate(pumpTask, "PumpTask_3", 2048, (void *)pumpNum, 1, NULL);
-    }
-    if ((xEventGroupValue & PUMP5) != 0)
+    // Start queued jobs while the pump limits allow
+    while (wateringNext(&zone, xTaskGetTickCount()))
     {
-      int pumpValue = 4;
-      pumpNum = &pumpValue;
-      xTaskCreate(pumpTask, "PumpTask_4", 2048, (void *)pumpNum, 1, NULL);
+      char name[] = "PumpTask_0";
+      name[sizeof(name) - 2] = '0' + zone;
+      // The zone is passed by value, the task outlives this loop
+      if (xTaskCreate(pumpTask, name, TASK_STACK_PUMP, (void *)(uintptr_t)zone, TASK_PRIO_PUMP, NULL) != pdPASS)
+      {
+        wateringDone(zone);
+        writeLine("Failed to create pump task");
+        break;
+      }
     }
   }
 }
 
 void MainEventTask(void *pvParameters)
 {
-  const EventBits_t xBitsToWaitFor = (TASKBIT_MOISTURE_READ | TASKBIT_LIGHT_READ);
+  const EventBits_t xBitsToWaitFor = TASKBIT_MOISTURE_READ;
   EventBits_t xEventGroupValue;
   uint16_t localTreshold, localReading;
   for (;;)
@@ -370,52 +535,105 @@ void MainEventTask(void *pvParameters)
     xEventGroupValue = xEventGroupWaitBits(xEventGroup,
                                            xBitsToWaitFor,
                                            pdTRUE,         // Clear the bits in the event group on exit.
-                                           pdTRUE,         // Wait for all specified bits to be set.
+                                           pdFALSE,        // Only one bit, wait all does not matter.
                                            portMAX_DELAY); // Block indefinitely until the bits are set.
+    supervisorBeat(SUPERVISE_MAIN);
     if ((xEventGroupValue & TASKBIT_MOISTURE_READ) != 0)
     {
-      // Since program is already reactin to event flag from SoilMoistureTask that task is suspended
-      writeLine("Soil Moisture Event Flag received\nSuspending SoilMoistureTask");
-      vTaskSuspend(MoistureTaskHandle);
-      if (xSemaphoreTake(xSensorsSemaphore, portMAX_DELAY) == pdTRUE)
+      // SoilMoistureTask keeps its period, a release that comes while sensors are read
+      // sets the already set bit again and is handled on the next pass.
+#ifdef BENCHMARK
+      PROBE_STOP(context_switch);
+#endif
+      writeLine("Soil Moisture Event Flag received");
+#ifdef BENCHMARK
+      PROBE_START(sensor_scan);
+      PROBE_START(mutex_take);
+#endif
+      if (mutexTake(&xSensorsSemaphore, portMAX_DELAY) == pdTRUE)
       {
-        // Reading All sensors
-        for (int i; i < 5; i++)
+#ifdef BENCHMARK
+        PROBE_STOP(mutex_take);
+#endif
+        uint32_t now = soilTickNow();
+        bool fresh[5] = {false};
+        uint8_t due[SAMPLER_ZONES];
+        uint16_t readings[SAMPLER_ZONES];
+        uint8_t i;
+        soilModelAdvance(now);
+        for (i = 0; i < 5; i++)
+        {
+          // Known only in the simulation, for the detection lag
+          samplerTruth(i, now, soilModelValue(i) > globalSensors[i].pumpTreshold);
+        }
+        // Reading the sensors due in this tick, in one scan
+        uint8_t reads = samplerDue(now, due);
+        readSensors(due, reads, readings);
+        for (uint8_t k = 0; k < reads; k++)
         {
+          i = due[k];
           // Read set pumping treshold for i pump
           localTreshold = globalSensors[i].pumpTreshold;
-          // Perform sensor read
-          localReading = readSensor(globalSensors[i].sensorAddress);
+          localReading = readings[k];
+          bootMark(BOOT_FIRST_SAMPLE);
           if (localReading > 0) // If reading sensor was succesfull. -1 == ERROR
           {
             // Save value from sensor to i sensors data
             globalSensors[i].reading = localReading;
-            // Test if i pump need to be turned on
-            if (localReading > localTreshold)
-            {
-              // Set start pump bit
-              xEventGroupSetBits(xPumpGroup, (1UL << i));
-            }
+            samplerUpdate(i, now, localReading, localTreshold);
+            fresh[i] = true;
           }
           else
           {
+            samplerRetry(i, now);
             write("Error while reading sensor number: ");
             String str = (String)i;
             writeLine(str);
           }
         }
-        writeLine("Reading Sensors Done resuming SoilMoistureTask");
-        xSemaphoreGive(xSensorsSemaphore);
-        vTaskResume(MoistureTaskHandle);
+        for (i = 0; i < 5; i++)
+        {
+          if (globalSensors[i].reading == 0)
+          {
+            continue; // Not read yet
+          }
+          // One history sample per zone and tick, a zone not read in this tick repeats its last reading
+          historyAdd(i, globalSensors[i].reading);
+          if (fresh[i])
+          {
+            // Test if i pump need to be turned on, on the recent average so one noisy sample doesn't start it
+            HistoryAggregate recent;
+            historyQuery(i, HISTORY_DECISION_SAMPLES, &recent);
+            if (recent.avg > globalSensors[i].pumpTreshold)
+            {
+              // Queue a watering job, WaterControlTask starts it when the pump budget allows
+              wateringRequest(i, globalSensors[i].pumpPriority, recent.avg - globalSensors[i].pumpTreshold, globalSensors[i].pumpCurrent,
+                              xTaskGetTickCount());
+              xEventGroupSetBits(xPumpGroup, WATER_JOB_QUEUED);
+              samplerDetected(i, now);
+              samplerWatering(i, now);
+            }
+          }
+        }
+        if (bootTime(BOOT_FIRST_DECISION) == 0)
+        {
+          bootMark(BOOT_FIRST_DECISION);
+          xEventGroupSetBits(xEventGroup, TASKBIT_FIRST_SCAN);
+        }
+        if (reads > 0)
+        {
+          writeLine("Reading Sensors Done");
+        }
+#ifdef BENCHMARK
+        PROBE_START(mutex_give);
+#endif
+        mutexGive(&xSensorsSemaphore);
+#ifdef BENCHMARK
+        PROBE_STOP(mutex_give);
+        PROBE_STOP(sensor_scan);
+#endif
       }
     }
-    if ((xEventGroupValue & TASKBIT_LIGHT_READ) != 0)
-    {
-      uint16_t lValueToSend;
-      lValueToSend = readLightLevel();
-      xQueueSend(xQueue, &lValueToSend, portMAX_DELAY);
-      taskYIELD();
-    }
   }
 }
 
@@ -426,87 +644,187 @@ void UserInputTask(void *pvParameters)
 
   Setup for this task
   */
+  // Console and reporting come up lazily, after the control loops have made their first decisions
+  xEventGroupWaitBits(xEventGroup, TASKBIT_FIRST_SCAN | TASKBIT_FIRST_LIGHT, pdFALSE, pdTRUE, CONSOLE_START_TIMEOUT);
+  createPeriodicTask(&reportPeriodic, TASK_STACK_REPORT, TASK_PRIO_REPORT, &reportTaskHandle);
+  bootMark(BOOT_CONSOLE);
+  printBootProfile();
+  printSupervisorMisses("Supervisor reset the board, missed: ", supervisorResetCause());
   writeLine("At any point while running the program User can change its parameters by sending a command");
   writeLine("Awailable commands:");
   writeLine("Change light mode: l");
   writeLine("Change pump treshold value: p");
   writeLine("Set system time: t");
+  writeLine("Show task statistics: s");
+  writeLine("Show sensor history: h");
+  writeLine("Batched changes: tools/config_cli.py");
   for (;;)
   {
     /*
     Running tasks
     */
-    if (Serial.available() > 0)
+    // Wakes up without a command every SETTINGS_QUIET_TICKS to write changed settings
+    bool command = uartWaitForData(SETTINGS_QUIET_TICKS) == pdTRUE;
+    supervisorBeat(SUPERVISE_INPUT);
+    if (command && uartAvailable() > 0)
     {
+      int16_t first = uartRead();
+      if (first == CONFIG_REQUEST_SYNC)
+      {
+        handleConfigFrame();
+        continue;
+      }
       vTaskSuspend(reportTaskHandle);
 
       // read the incoming String:
-      String str = Serial.readString();
+      String str = String((char)first) + readString();
       str.trim();
       if (str == "l")
       {
         writeLine("Set light mode to automatic or manual: a / m");
-        str = Serial.readString();
+        str = readString();
+        ControlConfig config;
+        controlConfigRead(&config);
         if (str == "a")
         {
-          manual_automatic = 0;
+          controlConfigEdit()->lightMode = 0;
+          controlConfigPublish();
         }
         else if (str == "m")
         {
-          manual_automatic = 1;
-          str = "Currently lights go on at " + (String)lights_on;
+          controlConfigEdit()->lightMode = 1;
+          controlConfigPublish();
+          str = "Currently lights go on at " + (String)config.lightsOn;
           write(str);
           writeLine(" edit? y/n");
-          str = Serial.readString();
+          str = readString();
           if (str == "y")
           {
             writeLine("Lights on: ");
-            str = Serial.readString();
-            lights_on = str.toInt();
+            str = readString();
+            uint32_t hour = str.toInt();
+            if (configCheck(CONFIG_KEY_LIGHTS_ON, hour, sensorCount) == CONFIG_OK)
+            {
+              controlConfigEdit()->lightsOn = hour;
+              controlConfigPublish();
+            }
+            else
+            {
+              writeLine("Hour must be 0-23");
+            }
           }
-          str = "Currently lights go off at " + (String)lights_off;
+          str = "Currently lights go off at " + (String)config.lightsOff;
           write(str);
           writeLine(" edit? y/n");
-          str = Serial.readString();
+          str = readString();
           if (str == "y")
           {
             writeLine("Lights off: ");
-            str = Serial.readString();
-            lights_on = str.toInt();
+            str = readString();
+            uint32_t hour = str.toInt();
+            if (configCheck(CONFIG_KEY_LIGHTS_OFF, hour, sensorCount) == CONFIG_OK)
+            {
+              controlConfigEdit()->lightsOff = hour;
+              controlConfigPublish();
+            }
+            else
+            {
+              writeLine("Hour must be 0-23");
+            }
           }
         }
         else
         {
           writeLine("Not recognised as command");
         }
+        controlConfigRead(&config);
+        settingsSet(SETTING_LIGHT_MODE, config.lightMode);
+        settingsSet(SETTING_LIGHTS_ON, config.lightsOn);
+        settingsSet(SETTING_LIGHTS_OFF, config.lightsOff);
       }
       else if (str == "p")
       {
         writeLine("Which pump to change? 1-5");
-        str = Serial.readString();
-        uint8_t pump = str.toInt();
-        writeLine("New treshold?");
-        str = Serial.readString();
-        globalSensors[pump - 1].pumpTreshold = str.toInt();
+        str = readString();
+        long pump = str.toInt();
+        if (pump < 1 || pump > sensorCount)
+        {
+          writeLine("No such pump");
+        }
+        else
+        {
+          writeLine("New treshold?");
+          str = readString();
+          uint32_t treshold = str.toInt();
+          if (configCheck(CONFIG_KEY_THRESHOLD + pump - 1, treshold, sensorCount) == CONFIG_OK)
+          {
+            if (mutexTake(&xSensorsSemaphore, portMAX_DELAY) == pdTRUE)
+            {
+              globalSensors[pump - 1].pumpTreshold = treshold;
+              mutexGive(&xSensorsSemaphore);
+            }
+            settingsSet(SETTING_THRESHOLD_1 + pump - 1, treshold);
+          }
+          else
+          {
+            writeLine("Treshold must be 0-1023");
+          }
+        }
       }
       else if (str == "t")
       {
         writeLine("Which value to change? h/m/s");
-        String unit = Serial.readString();
+        String unit = readString();
         writeLine("New value?");
-        String value = Serial.readString();
-        if (unit == "h")
+        long value = readString().toInt();
+        // Checked like the time key of a configuration frame, with the other parts 0
+        uint8_t shift = unit == "h" ? 16 : unit == "m" ? 8 : 0;
+        if (!(unit == "h" || unit == "m" || unit == "s"))
         {
-          setTime(hours, value.toInt());
+          writeLine("Not recognised as command");
         }
-        else if (unit == "m")
+        else if (value < 0 || value > 0xFF || configCheck(CONFIG_KEY_TIME, (uint32_t)value << shift, sensorCount) != CONFIG_OK)
+        {
+          writeLine(unit == "h" ? "Hour must be 0-23" : "Value must be 0-59");
+        }
+        else
         {
-          setTime(minutes, value.toInt());
+          setTime(unit == "h" ? hours : unit == "m" ? minutes : seconds, value);
         }
-        else if (unit == "s")
+      }
+      else if (str == "s")
+      {
+        for (uint8_t i = 0; i < sizeof(periodicTasks) / sizeof(periodicTasks[0]); i++)
         {
-          setTime(seconds, value.toInt());
+          printPeriodicStats(periodicTasks[i]);
+          printStackStats(periodicTasks[i]->handle);
         }
+        printStackStats(mainEventTaskHandle);
+        printStackStats(waterControlTaskHandle);
+        printStackStats(UItaskHandle);
+        printHeapStats();
+        printUartStats();
+        printHistoryStats();
+        printLightControlStats();
+        printSamplerStats();
+        printWateringStats();
+        printMutexStats(&xSerialSemaphore);
+        printMutexStats(&xSensorsSemaphore);
+        printSupervisorStats();
+        printSettingsStats();
+        printConfigStats();
+        printControlConfigStats();
+#ifdef SENSORS_I2C
+        printTwiStats();
+#endif
+#ifdef SENSORS_MODBUS
+        printModbusStats();
+#endif
+        printBootProfile();
+      }
+      else if (str == "h")
+      {
+        printHistory();
       }
       else
       {
@@ -515,80 +833,140 @@ void UserInputTask(void *pvParameters)
 
       vTaskResume(reportTaskHandle);
     }
+    else
+    {
+      // Lowest priority task, the EEPROM writes don't delay the control tasks
+      settingsFlush();
+    }
   }
 }
 
-void ReportTask(void *pvParameters)
+void ReportTask(void)
 {
   /*
   Print current status of the program and its variables for user on set interval
   Will not run while UserInputTask is being actively used.
 
-  Setup for this task
+  Running tasks, released every REPORTTASK_DELAY
   */
+  supervisorBeat(SUPERVISE_REPORT);
+#ifdef BENCHMARK
+  PROBE_START(report);
+#endif
+  vTaskSuspend(UItaskHandle);
 
-  for (;;)
+  writeLine("================================================================");
+  writeLine("System report");
+  writeLine("================================================================");
+  // One snapshot for the whole report, the time and the light settings belong together
+  ControlConfig config;
+  controlConfigRead(&config);
+  String str = "Time: " + (String)config.hour + "h " + (String)config.min + "min " + (String)config.sec + "sec\n";
+  writeLine(str);
+  writeLine("Current sensor readings:");
+  str = "";
+  for (uint8_t i = 0; i < 5; i++)
+  {
+    str = str + "Sensor" + (String)(i + 1) + ": " + (String)globalSensors[i].reading + "\n";
+  }
+  writeLine(str);
+  // Queries are copied out first, printing under the sensor mutex would block MainEventTask
+  HistoryAggregate hourTrend[5], dayTrend[5];
+  if (mutexTake(&xSensorsSemaphore, portMAX_DELAY) == pdTRUE)
   {
-    /*
-    Running tasks
-    */
-    vTaskDelay(5000 / portTICK_PERIOD_MS);
-    vTaskSuspend(UItaskHandle);
-
-    writeLine("================================================================");
-    writeLine("System report");
-    writeLine("================================================================");
-    String str = "Time: " + (String)currentTime.hour + "h " + (String)currentTime.min + "min " + (String)currentTime.sec + "sec\n";
-    writeLine(str);
-    writeLine("Current sensor readings:");
-    str = "";
     for (uint8_t i = 0; i < 5; i++)
     {
-      str = str + "Sensor" + (String)(i + 1) + ": " + (String)globalSensors[i].reading + "\n";
+      historyQuery(i, HISTORY_SAMPLES_PER_HOUR, &hourTrend[i]);
+      historyQuery(i, HISTORY_SAMPLES_PER_DAY, &dayTrend[i]);
     }
-    writeLine(str);
-    write("Current light mode: ");
-    if (manual_automatic == 0)
-    {
-      writeLine("Automatic");
-    }
-    else
+    mutexGive(&xSensorsSemaphore);
+    for (uint8_t i = 0; i < 5; i++)
     {
-      write("Manual\nLights go on: ");
-      str = (String)lights_on;
-      write(str);
-      write("\nLights go off: ");
-      str = (String)lights_off;
-      writeLine(str);
+      printTrend(i, "hour", &hourTrend[i]);
+      printTrend(i, "day", &dayTrend[i]);
     }
-    writeLine("================================================================");
-
-    vTaskResume(UItaskHandle);
   }
+  printSupervisorMisses("Missed heartbeat: ", supervisorTakeMissed());
+  write("Current light mode: ");
+  if (config.lightMode == 0)
+  {
+    writeLine("Automatic");
+  }
+  else
+  {
+    write("Manual\nLights go on: ");
+    str = (String)config.lightsOn;
+    write(str);
+    write("\nLights go off: ");
+    str = (String)config.lightsOff;
+    writeLine(str);
+  }
+  writeLine("================================================================");
+
+  vTaskResume(UItaskHandle);
+#ifdef BENCHMARK
+  PROBE_STOP(report);
+#endif
 }
 
-void timeIncrementTask(void *pvParameters)
+void timeIncrementTask(void)
 {
   /*
   Increments Time struct by 1 second when ever 1 second has passed
 
-  Setup for this task
+  Running tasks, released every TIMEINCREMENTTASK_DELAY
   */
+  supervisorBeat(SUPERVISE_TIME);
 
-  for (;;)
+  // Running simulation at higher speed, 1h / 3sec
+  updateTime(minutes, TIME_MINUTES_PER_RELEASE);
+
+  // Counted in releases, real time, so the EEPROM wear doesn't follow the speed of the simulated clock
+  static uint16_t releasesSinceSave = 0;
+  if (++releasesSinceSave >= TIME_SAVE_INTERVAL_MS / TIMEINCREMENTTASK_DELAY)
   {
-    /*
-    Running tasks
-    */
+    releasesSinceSave = 0;
+    saveTime();
+  }
 
-    // Running simulation at higher speed, 1h / 3sec
-    updateTime(minutes, 20);
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
+#ifdef SIM_DAYS
+  // End of the simulation build, sleeping with interrupts disabled makes simavr exit
+  ControlConfig config;
+  controlConfigRead(&config);
+#ifdef SIM_SOAK
+  // Heap and pools once a simulated day, tools/sim.py --soak checks they stay bounded
+  static uint16_t soakDay;
+  if (config.dayCount != soakDay)
+  {
+    soakDay = config.dayCount;
+    writeLine("Soak day " + (String)soakDay + ", soil tick " + (String)soilTickNow());
+    printHeapStats();
   }
+#endif
+  if (config.dayCount >= SIM_DAYS)
+  {
+    printSamplerStats();
+    printWateringStats();
+    printMutexStats(&xSerialSemaphore);
+    printMutexStats(&xSensorsSemaphore);
+    printControlConfigStats();
+    printSupervisorStats();
+#ifdef SENSORS_I2C
+    printTwiStats();
+#endif
+#ifdef SENSORS_MODBUS
+    printModbusStats();
+#endif
+    writeLine("SIM done");
+    cli();
+    sleep_enable();
+    sleep_cpu();
+  }
+#endif
 }
 
 /// @brief Task function to control a pump.
-/// @param pvParameters A pointer to the pump number (integer) passed as a task parameter.
+/// @param pvParameters The pump number, passed as the pointer value.
 void pumpTask(void *pvParameters)
 {
   /*
@@ -597,135 +975,678 @@ void pumpTask(void *pvParameters)
   Setup for this task
   */
   // Extract the pump number from the task parameters.
-  int *local_pumpNum;
-  local_pumpNum = (int *)pvParameters;
+  uint8_t local_pumpNum = (uintptr_t)pvParameters;
   // Generate a message string indicating the pump number.
-  String msg = "Pump_" + String(*local_pumpNum) + " ";
+  String msg = "Pump_" + String(local_pumpNum) + " ";
+  soilModelWater(local_pumpNum);
 
   /*
   Running task
   */
   // Perform pump start operations.
   write(msg);
+#ifdef SENSORS_MODBUS
+  writeLine(modbusPump(local_pumpNum, 1) ? "Start" : "Start failed, node not answering");
+#else
   writeLine("Start");
+#endif
   // Delay for running the pump
   vTaskDelay(30 / portTICK_PERIOD_MS);
   // Perform pump stop operations.
   write(msg);
+#ifdef SENSORS_MODBUS
+  writeLine(modbusPump(local_pumpNum, 0) ? "Stop. Deleting task" : "Stop failed, node not answering. Deleting task");
+#else
   writeLine("Stop. Deleting task");
+#endif
+  // Let WaterControlTask start the next queued job
+  wateringDone(local_pumpNum);
+  xEventGroupSetBits(xPumpGroup, WATER_PUMP_DONE);
   // Delete the task. This is typically done to self-terminate the task.
   vTaskDelete(NULL);
 }
 
-/// @brief Fake sensor responce
+#ifdef SENSORS_MODBUS
+static struct
+{
+  uint32_t count;
+  uint32_t zones;
+  uint32_t us;
+} modbusScans; // Soil scans over Modbus, written by MainEventTask
+
+/// @brief Switches the pump of a zone on its Modbus node, with retries, a pump left running is worse than a late one.
+/// @param zone Zone of the pump
+/// @param on 1 to run the pump, 0 to stop it
+/// @return true if the node confirmed the write
+static bool modbusPump(uint8_t zone, uint16_t on)
+{
+  uint16_t value = on;
+  // pumpAddress is set in setup and never written again
+  ModbusRequest request = {(uint8_t)(MODBUS_PUMP_NODE_BASE + globalSensors[zone].pumpAddress), MODBUS_WRITE_REGISTER,
+                           MODBUS_PUMP_REGISTER, 1, &value, MODBUS_PENDING, 0};
+  ModbusBatch batch = {&request, 1, xTaskGetCurrentTaskHandle(), false, NULL};
+  for (uint8_t attempt = 0; attempt < MODBUS_PUMP_RETRIES; attempt++)
+  {
+    modbusSubmit(&batch);
+    if (modbusWait(&batch, modbusBatchTimeout(&batch)) == pdTRUE && request.status == MODBUS_OK)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
+#ifdef SENSORS_I2C
+static struct
+{
+  uint32_t count;
+  uint32_t busUs;
+  uint32_t cpuCycles;
+} sensorScans; // Soil scans over I2C, written by MainEventTask
+
+static uint8_t luxData[2]; // Only used by LightManagementTask
+static TwiTransfer luxTransfer = {LUX_I2C_ADDRESS, NULL, 0, luxData, 2, TWI_PENDING};
+static TwiBatch luxBatch = {&luxTransfer, 1, NULL, true, 0, 0, NULL};
+
+/// @brief Light level from the BH1750
+/// @return Light level in lx, LIGHT_READ_ERROR if the sensor did not answer
+uint16_t readLightLevel(void)
+{
+  luxBatch.owner = xTaskGetCurrentTaskHandle();
+  twiSubmit(&luxBatch);
+  if (twiWait(&luxBatch, SENSOR_SCAN_TIMEOUT) != pdTRUE || luxTransfer.status != TWI_OK)
+  {
+    return LIGHT_READ_ERROR;
+  }
+  // 1.2 counts per lx
+  return (((uint16_t)luxData[0] << 8) | luxData[1]) * 5UL / 6;
+}
+#else
+/// @brief Fake sensor responce, daylight drifting between 0 and 100 plus the light of the LEDs
 /// @param
-/// @return random value between 0 and 100
+/// @return daylight plus up to 100 when all LEDs are fully on
 uint16_t readLightLevel(void)
 {
-  int reading = random(0, 100);
+  static int16_t daylight = 50;
+  daylight = constrain(daylight + random(-2, 3), 0, 100);
+  uint16_t leds = 0;
+  for (uint8_t i = 0; i < LIGHT_CHANNELS; i++)
+  {
+    leds += lightLevel(i);
+  }
+  int reading = daylight + (uint32_t)leds * 100 / LIGHT_CONTROL_MAX;
   return reading;
 }
 
+#endif
+
+/// @brief Reads the soil sensors of some zones in one scan
+/// @param zones Zones to read
+/// @param count Number of zones
+/// @param readings Reading of every zone, 0 if it failed
+void readSensors(const uint8_t *zones, uint8_t count, uint16_t *readings)
+{
+#ifdef SENSORS_I2C
+  // One batch for the whole scan, the task sleeps until the last sensor has answered
+  static const uint8_t moistureRegister = MOISTURE_REGISTER;
+  static TwiTransfer transfers[SAMPLER_ZONES]; // Only used by MainEventTask
+  static uint8_t data[SAMPLER_ZONES][2];
+  static TwiBatch batch = {transfers, 0, NULL, true, 0, 0, NULL};
+  if (count == 0)
+  {
+    return;
+  }
+  for (uint8_t k = 0; k < count; k++)
+  {
+    transfers[k].address = MOISTURE_I2C_BASE + globalSensors[zones[k]].sensorAddress;
+    transfers[k].tx = &moistureRegister;
+    transfers[k].txLength = 1;
+    transfers[k].rx = data[k];
+    transfers[k].rxLength = 2;
+  }
+  batch.count = count;
+  batch.owner = xTaskGetCurrentTaskHandle();
+  twiSubmit(&batch);
+  twiWait(&batch, SENSOR_SCAN_TIMEOUT);
+  taskENTER_CRITICAL();
+  sensorScans.count++;
+  sensorScans.busUs += batch.busUs;
+  sensorScans.cpuCycles += batch.cpuCycles;
+  taskEXIT_CRITICAL();
+  for (uint8_t k = 0; k < count; k++)
+  {
+    readings[k] = transfers[k].status == TWI_OK ? ((uint16_t)data[k][0] << 8) | data[k][1] : 0;
+  }
+#elif defined(SENSORS_MODBUS)
+  // One request per node, all queued in one batch and sent back to back by the driver
+  static ModbusRequest requests[SAMPLER_ZONES]; // Only used by MainEventTask
+  static ModbusBatch batch = {requests, 0, NULL, true, NULL};
+  if (count == 0)
+  {
+    return;
+  }
+  for (uint8_t k = 0; k < count; k++)
+  {
+    requests[k].node = MODBUS_SENSOR_NODE_BASE + globalSensors[zones[k]].sensorAddress;
+    requests[k].function = MODBUS_READ_INPUT_REGISTERS;
+    requests[k].address = MODBUS_MOISTURE_REGISTER;
+    requests[k].quantity = 1;
+    requests[k].values = &readings[k];
+  }
+  batch.count = count;
+  batch.owner = xTaskGetCurrentTaskHandle();
+  uint32_t start = micros();
+  modbusSubmit(&batch);
+  modbusWait(&batch, modbusBatchTimeout(&batch));
+  uint32_t us = micros() - start;
+  taskENTER_CRITICAL();
+  modbusScans.count++;
+  modbusScans.zones += count;
+  modbusScans.us += us;
+  taskEXIT_CRITICAL();
+  for (uint8_t k = 0; k < count; k++)
+  {
+    if (requests[k].status != MODBUS_OK)
+    {
+      readings[k] = 0;
+    }
+  }
+#else
+  for (uint8_t k = 0; k < count; k++)
+  {
+    readings[k] = readSensor(globalSensors[zones[k]].sensorAddress);
+  }
+#endif
+}
+
 /// @brief Fake sensor responce
 /// @param address Address of the sensor being read
 /// @return random value between 250 and 500
 uint16_t readSensor(uint8_t address)
 {
-  int reading = random(250, 500);
+  int reading = soilModelValue(address) + random(-4, 5);
   return reading;
 }
 
+/*
+Fake soil: every zone dries at its own rate, in mV per soil tick with 8 fraction bits,
+and a pump run wets it by SOIL_WATER_MV.
+*/
+#define SOIL_WET_MV 250
+#define SOIL_DRY_MV 500
+#define SOIL_WATER_MV 150
+static const uint8_t soilDryRateQ8[5] = {64, 96, 128, 160, 192};
+static uint32_t soilQ8[5] = {300UL << 8, 330UL << 8, 360UL << 8, 390UL << 8, 420UL << 8};
+static uint32_t soilTick = 0;
+
+/// @brief Soil ticks since boot, one per release of SoilMoistureTask.
+/// @return Tick count of the sampler and the soil model. Counted in 32 bits, the 16-bit
+/// kernel tick count wraps every 65536 ticks, about 16 minutes.
+static uint32_t soilTickNow(void)
+{
+  taskENTER_CRITICAL();
+  uint32_t now = soilTicks;
+  taskEXIT_CRITICAL();
+  return now;
+}
+
+/// @brief Dries the fake soil up to a soil tick.
+/// @param now Current soil tick.
+void soilModelAdvance(uint32_t now)
+{
+  taskENTER_CRITICAL();
+  uint32_t elapsed = now - soilTick;
+  soilTick = now;
+  for (uint8_t i = 0; i < 5; i++)
+  {
+    soilQ8[i] = min(soilQ8[i] + elapsed * soilDryRateQ8[i], (uint32_t)SOIL_DRY_MV << 8);
+  }
+  taskEXIT_CRITICAL();
+}
+
+/// @brief True moisture of the fake soil, without sensor noise.
+/// @param zone Zone.
+/// @return Sensor voltage in mV.
+uint16_t soilModelValue(uint8_t zone)
+{
+  taskENTER_CRITICAL();
+  uint16_t value = soilQ8[zone] >> 8;
+  taskEXIT_CRITICAL();
+  return value;
+}
+
+/// @brief Wets the fake soil of a zone by one pump run.
+/// @param zone Zone watered.
+void soilModelWater(uint8_t zone)
+{
+  taskENTER_CRITICAL();
+  uint32_t wet = (uint32_t)(SOIL_WET_MV + SOIL_WATER_MV) << 8;
+  soilQ8[zone] = soilQ8[zone] > wet ? soilQ8[zone] - ((uint32_t)SOIL_WATER_MV << 8) : (uint32_t)SOIL_WET_MV << 8;
+  taskEXIT_CRITICAL();
+}
+
 /// @brief Update the time based on the specified part (hours, minutes, or seconds).
 /// @param part The time part to update (hours, minutes, or seconds).
 /// @param amount The amount by which is added to the specified time part.
 void updateTime(uint8_t part, uint8_t amount)
 {
-  if (xSemaphoreTake(xTimeSemaphore, portMAX_DELAY) == pdTRUE)
+  if (part != hours && part != minutes && part != seconds)
   {
-    if (part == hours)
-    {
-      uint8_t h = currentTime.hour + amount;
-      if (h >= 24)
-      {
-        h = h - 24;
-      }
-      if (day_night == day && (h >= 18 || h < 6))
-      {
-        day_night = night;
-      }
-      else if (day_night == night && (h >= 6 && h < 18))
-      {
-        day_night = day;
-      }
+    /// @note This case is reached when the specified 'part' is invalid.
+    writeLine("Time update failed!");
+    return;
+  }
+  // The carry goes up to the hour in the same update, readers never see 6:60
+  uint16_t carry = amount;
+  ControlConfig *config = controlConfigEdit();
+  if (part == seconds)
+  {
+    carry += config->sec;
+    config->sec = carry % 60;
+    carry /= 60;
+  }
+  if (part != hours)
+  {
+    carry += config->min;
+    config->min = carry % 60;
+    carry /= 60;
+  }
+  if (carry > 0)
+  {
+    carry += config->hour;
+    config->dayCount += carry / 24;
+    config->hour = carry % 24;
+    config->dayNight = timeOfDay(config->hour);
+  }
+  controlConfigPublish();
+}
 
-      currentTime.hour = h;
-      xSemaphoreGive(xTimeSemaphore);
-    }
-    else if (part == minutes)
-    {
-      uint8_t m = currentTime.min + amount;
-      if (m >= 60)
-      {
-        currentTime.min = m - 60;
-        xSemaphoreGive(xTimeSemaphore);
-        updateTime(hours, (uint8_t)1);
-      }
-      else
-      {
-        currentTime.hour = m;
-        xSemaphoreGive(xTimeSemaphore);
-      }
-    }
-    else if (part == seconds)
+/// @brief Set the time based on the specified part (hours, minutes, or saeconds).
+/// @param part The time part to update (hours, minutes, or seconds).
+/// @param amount The amount by which the specified time part is set to.
+void setTime(uint8_t part, uint8_t amount)
+{
+  if (part != hours && part != minutes && part != seconds)
+  {
+    /// @note This case is reached when the specified 'part' is invalid.
+    writeLine("Time update failed!");
+    return;
+  }
+  ControlConfig *config = controlConfigEdit();
+  if (part == hours)
+  {
+    config->hour = amount;
+    config->dayNight = timeOfDay(amount);
+  }
+  else if (part == minutes)
+  {
+    config->min = amount;
+  }
+  else
+  {
+    config->sec = amount;
+  }
+  controlConfigPublish();
+  saveTime();
+}
+
+/// @brief Day or night at an hour, night is 18:00 - 6:00.
+static uint8_t timeOfDay(uint8_t hour)
+{
+  return (hour >= 18 || hour < 6) ? night : day;
+}
+
+/// @brief Prints release count, deadline misses, lateness and execution time of a periodic task.
+/// @param task The periodic task to print.
+void printPeriodicStats(const PeriodicTask *task)
+{
+  PeriodicStats stats;
+  getPeriodicStats(task, &stats);
+  String str = (String)task->name + ": releases " + (String)stats.releases +
+               ", misses " + (String)stats.deadlineMisses +
+               ", overruns " + (String)stats.overruns +
+               ", lateness " + (String)(stats.lastLateness * portTICK_PERIOD_MS) + "/" + (String)(stats.maxLateness * portTICK_PERIOD_MS) + "ms" +
+               ", exec " + (String)stats.lastExecUs + "/" + (String)stats.maxExecUs + "us";
+  writeLine(str);
+}
+
+/// @brief Prints how many bytes of the stack of a task have never been used.
+/// @param task Handle of the task.
+void printStackStats(TaskHandle_t task)
+{
+  String str = (String)pcTaskGetName(task) + ": stack free " + (String)uxTaskGetStackHighWaterMark(task);
+  writeLine(str);
+}
+
+/// @brief Prints usage of every pool size class and free space and fragmentation of the heap.
+void printHeapStats(void)
+{
+  PoolClassStats pool;
+  for (uint8_t c = 0; c < POOL_CLASS_COUNT; c++)
+  {
+    getPoolStats(c, &pool);
+    String str = "Pool " + (String)pool.blockSize + "B: used " + (String)pool.inUse + "/" + (String)pool.blocks +
+                 ", peak " + (String)pool.highWater + ", allocs " + (String)pool.allocs + ", full " + (String)pool.fallbacks;
+    writeLine(str);
+  }
+  HeapStats heap;
+  getHeapStats(&heap);
+  String str = "Heap: free " + (String)heap.freeBytes + "B, largest " + (String)heap.largestFreeBlock +
+               "B, fragmentation " + (String)heap.fragmentation + "%, blocks " + (String)heap.allocs + ", failed " + (String)heap.failures;
+  writeLine(str);
+}
+
+/// @brief Prints the byte and error counters of the USART0 driver.
+void printUartStats(void)
+{
+  UartStats uart;
+  getUartStats(&uart);
+  String str = "Uart: tx " + (String)uart.txBytes + "B, rx " + (String)uart.rxBytes + "B, rx lost " + (String)uart.rxOverruns +
+               ", rx errors " + (String)uart.rxErrors;
+  writeLine(str);
+}
+
+/// @brief Prints min, max and average of a window of the history of a zone.
+/// @param zone Zone of the sensor.
+/// @param window Name of the window.
+/// @param trend Result of historyQuery for the window.
+void printTrend(uint8_t zone, const char *window, const HistoryAggregate *trend)
+{
+  String str = "Trend" + (String)(zone + 1) + " " + window + ": avg " + (String)trend->avg + ", min " + (String)trend->min +
+               ", max " + (String)trend->max + " over " + (String)trend->count + " samples";
+  writeLine(str);
+}
+
+/// @brief Prints how much memory the sensor history of every zone takes.
+void printHistoryStats(void)
+{
+  HistoryStats history;
+  for (uint8_t i = 0; i < 5; i++)
+  {
+    getHistoryStats(i, &history);
+    // Compressed bytes one hour of samples takes at the current compression ratio
+    uint16_t perHour = (uint32_t)history.bitsPerSample10 * HISTORY_SAMPLES_PER_HOUR / 80;
+    String str = "History" + (String)(i + 1) + ": " + (String)history.samples + " samples in " + (String)history.blocks + " blocks, " +
+                 (String)history.dataBytes + "/" + (String)HISTORY_DATA_BYTES + "B, " + (String)(history.bitsPerSample10 / 10) + "." +
+                 (String)(history.bitsPerSample10 % 10) + " bits/sample, " + (String)perHour + "B/hour, zone " + (String)history.zoneBytes + "B";
+    writeLine(str);
+  }
+}
+
+/// @brief Prints the steps, loop timing and output of the light PI controller.
+void printLightControlStats(void)
+{
+  LightControlStats control;
+  getLightControlStats(&control);
+  // Spread of the loop period is the release jitter
+  uint32_t minInterval = control.steps > 1 ? control.minIntervalUs : 0;
+  String str = "LightPI: steps " + (String)control.steps + ", period " + (String)minInterval + "-" + (String)control.maxIntervalUs + "us" +
+               ", cycles " + (String)control.lastCycles + "/" + (String)control.maxCycles + ", saturated " + (String)control.saturated +
+               ", level " + (String)(control.filtered >> 8) + "/" + (String)LIGHT_SETPOINT + ", output " + (String)control.output +
+               ", read failures " + (String)lightReadFailures;
+  writeLine(str);
+}
+
+/// @brief Prints the scans, reads and detection lag of the adaptive soil sampler.
+void printSamplerStats(void)
+{
+  SamplerStats sampler;
+  getSamplerStats(&sampler);
+  // Lag in simulated minutes, from the true moisture crossing the threshold to the pump decision
+  uint16_t minutesPerTick = TIME_MINUTES_PER_RELEASE * SOILMOISTURETASK_DELAY / TIMEINCREMENTTASK_DELAY;
+  uint32_t lagAvg = sampler.detections ? sampler.lagSum * minutesPerTick / sampler.detections : 0;
+  String str = "Sampler: scans " + (String)sampler.scans + ", reads " + (String)sampler.reads + ", detections " + (String)sampler.detections +
+               ", lag " + (String)lagAvg + "/" + (String)(sampler.lagMax * minutesPerTick) + "min, intervals";
+  for (uint8_t i = 0; i < SAMPLER_ZONES; i++)
+  {
+    str += " " + (String)sampler.interval[i];
+  }
+  writeLine(str);
+}
+
+/// @brief Prints the requests, merges, queue wait and concurrency of the watering jobs.
+void printWateringStats(void)
+{
+  WateringStats watering;
+  getWateringStats(&watering);
+  uint32_t waitAvg = watering.started ? watering.waitSum * portTICK_PERIOD_MS / watering.started : 0;
+  String str = "Watering: requests " + (String)watering.requests + ", merged " + (String)watering.merged + ", started " + (String)watering.started +
+               ", completed " + (String)watering.completed + ", wait " + (String)waitAvg + "/" + (String)(watering.waitMax * portTICK_PERIOD_MS) + "ms" +
+               ", queued " + (String)watering.queued + "/" + (String)watering.maxQueued + ", running " + (String)watering.running + "/" +
+               (String)watering.maxRunning;
+  writeLine(str);
+}
+
+/// @brief Prints takes, contention and the wait and hold histograms of a profiled mutex.
+/// @param mutex Mutex to print.
+void printMutexStats(const ProfiledMutex *mutex)
+{
+  MutexStats stats;
+  getMutexStats(mutex, &stats);
+  // Histograms are counts per bucket, bucket bounds 64us * 4^n
+  String str = "Mutex " + (String)mutex->name + ": takes " + (String)stats.takes + ", contended " + (String)stats.contended +
+               ", timeouts " + (String)stats.timeouts + ", wait max " + (String)stats.maxWaitUs + "us, hold max " + (String)stats.maxHoldUs +
+               "us, wait";
+  for (uint8_t i = 0; i < MUTEX_HIST_BUCKETS; i++)
+  {
+    str += " " + (String)stats.waitHist[i];
+  }
+  str += ", hold";
+  for (uint8_t i = 0; i < MUTEX_HIST_BUCKETS; i++)
+  {
+    str += " " + (String)stats.holdHist[i];
+  }
+  writeLine(str);
+}
+
+/// @brief Prints the checks of the supervisor and the deadlines every watched task missed.
+void printSupervisorStats(void)
+{
+  SupervisorStats supervisor;
+  getSupervisorStats(&supervisor);
+  String str = "Supervisor: checks " + (String)supervisor.checks + ", missed";
+  for (uint8_t i = 0; i < SUPERVISOR_TASKS; i++)
+  {
+    if (supervisor.watched & (1U << i))
     {
-      uint8_t s = currentTime.min + amount;
-      if (s >= 60)
-      {
-        currentTime.sec = s - 60;
-        xSemaphoreGive(xTimeSemaphore);
-        updateTime(minutes, (uint8_t)1);
-      }
-      else
-      {
-        currentTime.hour = s;
-        xSemaphoreGive(xTimeSemaphore);
-      }
+      str += " " + (String)supervisorName(i) + " " + (String)supervisor.misses[i];
     }
-    else
+  }
+  writeLine(str);
+}
+
+/// @brief Prints the names of the supervised tasks in a mask, nothing if the mask is empty.
+/// @param text Text before the names.
+/// @param missed Mask of task ids.
+void printSupervisorMisses(const char *text, uint8_t missed)
+{
+  if (missed == 0)
+  {
+    return;
+  }
+  String str = text;
+  for (uint8_t i = 0; i < SUPERVISOR_TASKS; i++)
+  {
+    if (missed & (1U << i))
     {
-      /// @note This case is reached when the specified 'part' is invalid.
-      xSemaphoreGive(xTimeSemaphore);
-      writeLine("Time update failed!");
+      str += (String)supervisorName(i) + " ";
     }
   }
+  writeLine(str);
 }
 
-/// @brief Set the time based on the specified part (hours, minutes, or saeconds).
-/// @param part The time part to update (hours, minutes, or seconds).
-/// @param amount The amount by which the specified time part is set to.
-void setTime(uint8_t part, uint8_t amount)
+/// @brief Prints the last hour of decompressed samples of every zone.
+void printHistory(void)
 {
-  if (xSemaphoreTake(xTimeSemaphore, portMAX_DELAY) == pdTRUE)
+  uint16_t samples[HISTORY_SAMPLES_PER_HOUR];
+  for (uint8_t i = 0; i < 5; i++)
   {
-    if (part == hours)
+    uint16_t count = 0;
+    if (mutexTake(&xSensorsSemaphore, portMAX_DELAY) == pdTRUE)
     {
-      currentTime.hour = amount;
+      count = historyRecent(i, samples, HISTORY_SAMPLES_PER_HOUR);
+      mutexGive(&xSensorsSemaphore);
     }
-    else if (part == minutes)
+    String str = "History" + (String)(i + 1) + ":";
+    for (uint16_t j = 0; j < count; j++)
     {
-      currentTime.min = amount;
+      str += " " + (String)samples[j];
     }
-    else if (part == seconds)
+    writeLine(str);
+  }
+}
+
+/// @brief Prints boot restore time and write counters of the settings store.
+void printSettingsStats(void)
+{
+  SettingsStats settings;
+  getSettingsStats(&settings);
+  String str = "Settings: restored " + (String)settings.restored + " in " + (String)settings.restoreUs + "us, crc errors " +
+               (String)settings.crcErrors + ", writes " + (String)settings.writes + ", relocations " + (String)settings.relocations +
+               ", head " + (String)settings.head + "/" + (String)SETTINGS_SLOTS;
+  writeLine(str);
+}
+
+/// @brief Prints the counters of the configuration protocol.
+void printConfigStats(void)
+{
+  ConfigStats config;
+  getConfigStats(&config);
+  String str = "Config: frames " + (String)config.frames + ", sets " + (String)config.sets + ", gets " + (String)config.gets +
+               ", rejected " + (String)config.rejected + ", crc errors " + (String)config.crcErrors + ", timeouts " +
+               (String)config.timeouts + ", max " + (String)config.maxFrameUs + "us";
+  writeLine(str);
+}
+
+/// @brief Prints the version of the control block, its publishes and the reads that had to copy it again.
+void printControlConfigStats(void)
+{
+  ControlConfigStats control;
+  getControlConfigStats(&control);
+  String str = "Control config: version " + (String)control.version + ", publishes " + (String)control.publishes +
+               ", read retries " + (String)control.retries;
+  writeLine(str);
+}
+
+#ifdef SENSORS_I2C
+/// @brief Prints the counters of the TWI bus and the bus and CPU time of a soil scan, a blocking read spins for the bus time.
+void printTwiStats(void)
+{
+  TwiStats twi;
+  getTwiStats(&twi);
+  taskENTER_CRITICAL();
+  uint32_t scans = sensorScans.count;
+  uint32_t busUs = sensorScans.busUs;
+  uint32_t cpuCycles = sensorScans.cpuCycles;
+  taskEXIT_CRITICAL();
+  uint32_t n = scans ? scans : 1;
+  String str = "I2C: batches " + (String)twi.batches + ", transfers " + (String)twi.transfers + ", nacks " + (String)twi.nacks +
+               ", bus errors " + (String)twi.busErrors + ", timeouts " + (String)twi.timeouts + ", interrupts " +
+               (String)twi.interrupts + ", scans " + (String)scans + ", bus " + (String)(busUs / n) + "us, cpu " +
+               (String)(cpuCycles / (F_CPU / 1000000UL) / n) + "us per scan";
+  writeLine(str);
+}
+#endif
+
+#ifdef SENSORS_MODBUS
+/// @brief Prints the counters of the Modbus bus, the zones read per second of scan time and every node that was polled.
+void printModbusStats(void)
+{
+  ModbusStats modbus;
+  getModbusStats(&modbus);
+  taskENTER_CRITICAL();
+  uint32_t scans = modbusScans.count;
+  uint32_t zones = modbusScans.zones;
+  uint32_t us = modbusScans.us;
+  taskEXIT_CRITICAL();
+  String str = "Modbus: batches " + (String)modbus.batches + ", requests " + (String)modbus.requests + ", gaps " +
+               (String)modbus.gaps + ", overruns " + (String)modbus.overruns + ", cancelled " + (String)modbus.cancelled +
+               ", scans " + (String)scans + ", " + (String)(us >= 1000 ? zones * 1000 / (us / 1000) : 0) + " zones/s";
+  writeLine(str);
+  for (uint8_t node = 1; node <= MODBUS_MAX_NODE; node++)
+  {
+    ModbusNodeStats stats;
+    if (!getModbusNodeStats(node, &stats) || stats.requests == 0)
     {
-      currentTime.sec = amount;
+      continue;
     }
-    else
+    str = "  Node " + (String)node + ": requests " + (String)stats.requests + ", timeouts " + (String)stats.timeouts +
+          ", errors " + (String)stats.errors + ", exceptions " + (String)stats.exceptions + ", latency " +
+          (String)(stats.responses ? stats.latencySumUs / stats.responses : 0) + "us, max " + (String)stats.latencyMaxUs + "us";
+    writeLine(str);
+  }
+}
+#endif
+
+/// @brief Prints the time from reset to every boot mark.
+void printBootProfile(void)
+{
+  String str = "Boot:";
+  for (uint8_t mark = 0; mark < BOOT_MARK_COUNT; mark++)
+  {
+    uint32_t us = bootTime(mark);
+    str += (String)(mark ? ", " : " ") + bootMarkName(mark) + " ";
+    str += us ? (String)(us / 1000) + "." + (String)(us / 100 % 10) + "ms" : "-";
+  }
+  writeLine(str);
+}
+
+/// @brief Restores the settings saved in EEPROM, runs before the scheduler starts.
+void restoreSettings(void)
+{
+  uint32_t value;
+  settingsBegin();
+  for (uint8_t i = 0; i < 5; i++)
+  {
+    if (settingsGet(SETTING_THRESHOLD_1 + i, &value))
     {
-      /// @note This case is reached when the specified 'part' is invalid.
-      writeLine("Time update failed!");
+      globalSensors[i].pumpTreshold = value;
     }
   }
-  xSemaphoreGive(xTimeSemaphore);
+  ControlConfig *config = controlConfigEdit();
+  if (settingsGet(SETTING_LIGHTS_ON, &value))
+  {
+    config->lightsOn = value;
+  }
+  if (settingsGet(SETTING_LIGHTS_OFF, &value))
+  {
+    config->lightsOff = value;
+  }
+  if (settingsGet(SETTING_LIGHT_MODE, &value))
+  {
+    config->lightMode = value;
+  }
+  if (settingsGet(SETTING_TIME, &value))
+  {
+    setConfigValue(config, CONFIG_KEY_TIME, value);
+  }
+  controlConfigPublish();
+}
+
+/// @brief Saves the current time.
+/// @note Saved when the user sets it and every TIME_SAVE_INTERVAL_MS of real time, with no clock
+/// running during a reset the restored time is behind by what the clock ran since the last save.
+void saveTime(void)
+{
+  ControlConfig config;
+  controlConfigRead(&config);
+  settingsSet(SETTING_TIME, getConfigValue(&config, CONFIG_KEY_TIME));
+}
+
+/// @brief Called by the kernel when it finds a task stack overflowed (configCHECK_FOR_STACK_OVERFLOW).
+/// @param xTask Handle of the task.
+/// @param pcTaskName Name of the task.
+extern "C" void vApplicationStackOverflowHook(TaskHandle_t xTask, char *pcTaskName)
+{
+  // Called from the context switch with interrupts disabled, so the UART is polled.
+  // The mutex can't be taken here and the stack is already corrupted, so print and stop.
+  uartPollWrite("Stack overflow: ");
+  uartPollWrite(pcTaskName);
+  uartPollWrite("\r\n");
+  for (;;)
+  {
+  }
 }
 
 /// @brief Adds a sensor to the global sensor array.
@@ -745,23 +1666,176 @@ static void addSensor(String name, uint8_t sAddress, uint8_t pAddress)
 /// @param line The line number on the Serial monitor (1 for println, 0 for print).
 void ThreadSafePrintMessage(String msg, uint8_t line)
 {
+#ifdef BENCHMARK
+  PROBE_START(print_message);
+#endif
   // Attempt to take the serial access semaphore with a timeout of 5 ticks.
-  if (xSemaphoreTake(xSerialSemaphore, (TickType_t)5) == pdTRUE)
+  if (mutexTake(&xSerialSemaphore, (TickType_t)5) == pdTRUE)
   {
     // Successfully acquired the semaphore, safe to print to Serial.
+    // The message is sent straight from the String buffer without copying,
+    // the task sleeps until the UART interrupt has sent the last byte.
+    UartBuffer text = {(const uint8_t *)msg.c_str(), (uint16_t)msg.length(), xTaskGetCurrentTaskHandle()};
+    UartBuffer newline = {(const uint8_t *)"\r\n", 2, xTaskGetCurrentTaskHandle()};
+    uartQueue(&text);
     if (line == 1)
     {
       // Print the message followed by a newline.
-      Serial.println(msg);
+      uartQueue(&newline);
+      uartWaitSent(&newline, portMAX_DELAY);
     }
     else
     {
-      // Print the message without a newline.
-      Serial.print(msg);
+      uartWaitSent(&text, portMAX_DELAY);
     }
     // Release the serial access semaphore.
-    xSemaphoreGive(xSerialSemaphore);
+    mutexGive(&xSerialSemaphore);
   }
-  // Unable to acquire the semaphore within the timeout.
+  // Unable to acquire the semaphore within the timeout, counted in the timeouts of the Serial mutex.
   /// @todo create retry mechanism
+#ifdef BENCHMARK
+  PROBE_STOP(print_message);
+#endif
+}
+
+/// @brief Reads one configuration frame after its sync byte, applies it and sends the response.
+void handleConfigFrame(void)
+{
+  uint8_t bad = 0;
+  uint8_t status = configReceive(&configFrame);
+  if (status == CONFIG_TIMEOUT)
+  {
+    return;
+  }
+  if (status == CONFIG_OK)
+  {
+    status = configValidate(&configFrame, sensorCount, &bad);
+  }
+  if (status == CONFIG_OK)
+  {
+    applyConfig(&configFrame);
+  }
+  if (mutexTake(&xSerialSemaphore, portMAX_DELAY) == pdTRUE)
+  {
+    configRespond(&configFrame, status, bad);
+    mutexGive(&xSerialSemaphore);
+  }
+}
+
+/// @brief Applies every set of a checked frame as one change and replaces the value of every operation with the
+/// value of its key afterwards.
+/// @param frame Frame checked by configValidate.
+void applyConfig(ConfigFrame *frame)
+{
+  // The thresholds are under the sensor mutex, the rest is published as one new control block
+  mutexTake(&xSensorsSemaphore, portMAX_DELAY);
+  ControlConfig *config = controlConfigEdit();
+  for (uint8_t i = 0; i < frame->count; i++)
+  {
+    if (frame->ops[i].key & CONFIG_OP_SET)
+    {
+      setConfigValue(config, frame->ops[i].key & CONFIG_KEY_MASK, frame->ops[i].value);
+    }
+  }
+  for (uint8_t i = 0; i < frame->count; i++)
+  {
+    frame->ops[i].value = getConfigValue(config, frame->ops[i].key & CONFIG_KEY_MASK);
+  }
+  controlConfigPublish();
+
+  for (uint8_t i = 0; i < frame->count; i++)
+  {
+    uint8_t key = frame->ops[i].key & CONFIG_KEY_MASK;
+    if (!(frame->ops[i].key & CONFIG_OP_SET))
+    {
+      continue;
+    }
+    if (key < CONFIG_KEY_LIGHTS_ON)
+    {
+      settingsSet(SETTING_THRESHOLD_1 + key - CONFIG_KEY_THRESHOLD, frame->ops[i].value);
+    }
+    else if (key == CONFIG_KEY_LIGHTS_ON)
+    {
+      settingsSet(SETTING_LIGHTS_ON, frame->ops[i].value);
+    }
+    else if (key == CONFIG_KEY_LIGHTS_OFF)
+    {
+      settingsSet(SETTING_LIGHTS_OFF, frame->ops[i].value);
+    }
+    else if (key == CONFIG_KEY_LIGHT_MODE)
+    {
+      settingsSet(SETTING_LIGHT_MODE, frame->ops[i].value);
+    }
+    else if (key == CONFIG_KEY_TIME)
+    {
+      saveTime();
+    }
+  }
+  mutexGive(&xSensorsSemaphore);
+}
+
+/// @brief Sets the variable behind a configuration key, the caller holds xSensorsSemaphore for the thresholds.
+/// @param config Block from controlConfigEdit for the other keys.
+static void setConfigValue(ControlConfig *config, uint8_t key, uint32_t value)
+{
+  if (key < CONFIG_KEY_LIGHTS_ON)
+  {
+    globalSensors[key - CONFIG_KEY_THRESHOLD].pumpTreshold = value;
+  }
+  else if (key == CONFIG_KEY_LIGHTS_ON)
+  {
+    config->lightsOn = value;
+  }
+  else if (key == CONFIG_KEY_LIGHTS_OFF)
+  {
+    config->lightsOff = value;
+  }
+  else if (key == CONFIG_KEY_LIGHT_MODE)
+  {
+    config->lightMode = value;
+  }
+  else if (key == CONFIG_KEY_TIME)
+  {
+    config->hour = value >> 16;
+    config->min = value >> 8;
+    config->sec = value;
+    config->dayNight = timeOfDay(config->hour);
+  }
+}
+
+/// @brief Reads the variable behind a configuration key, the caller holds xSensorsSemaphore for the thresholds.
+/// @param config Block for the other keys.
+static uint32_t getConfigValue(const ControlConfig *config, uint8_t key)
+{
+  if (key < CONFIG_KEY_LIGHTS_ON)
+  {
+    return globalSensors[key - CONFIG_KEY_THRESHOLD].pumpTreshold;
+  }
+  switch (key)
+  {
+  case CONFIG_KEY_LIGHTS_ON:
+    return config->lightsOn;
+  case CONFIG_KEY_LIGHTS_OFF:
+    return config->lightsOff;
+  case CONFIG_KEY_LIGHT_MODE:
+    return config->lightMode;
+  case CONFIG_KEY_TIME:
+    return ((uint32_t)config->hour << 16) | ((uint16_t)config->min << 8) | config->sec;
+  case CONFIG_KEY_ZONES:
+    return sensorCount;
+  default:
+    return 0;
+  }
+}
+
+/// @brief Reads characters until none has arrived for SERIAL_READ_TIMEOUT, like Serial.readString().
+/// @return The characters read.
+String readString(void)
+{
+  String str;
+  while (uartWaitForData(SERIAL_READ_TIMEOUT) == pdTRUE)
+  {
+    str += (char)uartRead();
+  }
+  return str;
 }
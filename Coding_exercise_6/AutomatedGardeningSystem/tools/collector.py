@@ -0,0 +1,379 @@
+#!/usr/bin/env python3
+"""
+Telemetry collector: ingests the System report from many controllers into a columnar store.
+
+Every endpoint (serial port, pty or fifo) is registered with one epoll instance. Data is
+read with readv straight into a fixed per-endpoint buffer and the report lines are parsed
+in place, so only the few digits of each value are ever copied. Parsed readings are
+batched and appended to one file per column:
+
+  host_ms.i64   host receive time in ms since the epoch
+  endpoint.u16  index into endpoints.json
+  day_sec.u32   controller time of day in seconds
+  zone.u8       sensor number, 1 based like the report
+  value.u16     sensor reading
+
+Ingest rate, readings, completed reports and parse errors are printed every
+--stats-interval seconds and written to stats.json on exit.
+
+Endpoints come from the command line or from the manifest written by tools/fleet.py.
+--self-test N drives N local ptys with generated reports (some deliberately corrupted),
+checks every count and reads the column files back to compare their size and every
+stored value, so the collector can be exercised without hardware. The self-test writes
+to a temporary directory, not --out.
+
+Usage:
+  python3 tools/collector.py [--manifest fleet.json] [--out telemetry] [endpoint ...]
+  python3 tools/collector.py --self-test 200
+"""
+
+import argparse
+import array
+import json
+import os
+import pty
+import re
+import select
+import sys
+import tempfile
+import threading
+import time
+import tty
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BUFFER_SIZE = 4096
+MAX_SENSOR_VALUE = 1023
+TIME_LINE = re.compile(rb"Time: (\d+)h (\d+)min (\d+)sec")
+
+# "L" is 8 bytes on 64-bit Linux, so u32 is "I"
+COLUMNS = (("host_ms", "q", "i64"), ("endpoint", "H", "u16"), ("day_sec", "I", "u32"),
+           ("zone", "B", "u8"), ("value", "H", "u16"))
+for _, _code, _suffix in COLUMNS:
+    assert array.array(_code).itemsize * 8 == int(_suffix[1:]), _suffix
+
+# Parser states
+IDLE, HEADER, READINGS = range(3)
+
+
+class Stats:
+    def __init__(self):
+        self.bytes = 0
+        self.readings = 0
+        self.reports = 0
+        self.parse_errors = 0
+        self.overlong_lines = 0
+
+    def as_dict(self):
+        return dict(self.__dict__)
+
+
+class Store:
+    """Appends rows column by column, one file per column."""
+
+    def __init__(self, directory, batch):
+        os.makedirs(directory, exist_ok=True)
+        self.batch = batch
+        self.pending = 0
+        self.columns = [array.array(code) for _, code, _ in COLUMNS]
+        self.fds = [os.open(os.path.join(directory, "%s.%s" % (name, suffix)),
+                            os.O_WRONLY | os.O_CREAT | os.O_APPEND, 0o644)
+                    for name, _, suffix in COLUMNS]
+
+    def append(self, host_ms, endpoint, day_sec, zone, value):
+        for column, item in zip(self.columns, (host_ms, endpoint, day_sec, zone, value)):
+            column.append(item)
+        self.pending += 1
+        if self.pending >= self.batch:
+            self.flush()
+
+    def flush(self):
+        if not self.pending:
+            return
+        for fd, column in zip(self.fds, self.columns):
+            os.write(fd, memoryview(column).cast("B"))
+            del column[:]
+        self.pending = 0
+
+    def close(self):
+        self.flush()
+        for fd in self.fds:
+            os.close(fd)
+
+
+class Endpoint:
+    """Incremental parser for one controller's report stream."""
+
+    def __init__(self, index, path, fd):
+        self.index = index
+        self.path = path
+        self.fd = fd
+        self.buffer = bytearray(BUFFER_SIZE)
+        self.view = memoryview(self.buffer)
+        self.fill = 0
+        self.state = IDLE
+        self.day_sec = 0
+        self.readings = []
+
+    def feed(self, store, stats, now_ms):
+        """Reads what is available and parses every complete line, returns False on end of stream."""
+        try:
+            count = os.readv(self.fd, [self.view[self.fill:]])
+        except BlockingIOError:
+            return True
+        except OSError:
+            return False  # EIO once the pty writer has gone
+        if count == 0:
+            return False
+        stats.bytes += count
+        self.fill += count
+
+        buf = self.buffer
+        start = 0
+        while True:
+            end = buf.find(b"\n", start, self.fill)
+            if end < 0:
+                break
+            stop = end - 1 if end > start and buf[end - 1] == 0x0D else end
+            self.line(start, stop, store, stats, now_ms)
+            start = end + 1
+
+        if start:
+            # Keep the unfinished line at the front of the buffer
+            self.buffer[:self.fill - start] = self.view[start:self.fill]
+            self.fill -= start
+        elif self.fill == BUFFER_SIZE:
+            # No newline in a full buffer, nothing the controller prints is this long
+            stats.overlong_lines += 1
+            stats.parse_errors += 1
+            self.fill = 0
+            self.state = IDLE
+        return True
+
+    def line(self, start, stop, store, stats, now_ms):
+        buf = self.buffer
+        if start == stop:
+            return
+        if buf.startswith(b"System report", start, stop):
+            if self.state != IDLE:
+                stats.parse_errors += 1  # Previous report never finished
+            self.state = HEADER
+            self.readings = []
+        elif self.state == HEADER and buf.startswith(b"Time: ", start, stop):
+            match = TIME_LINE.match(self.view[start:stop].tobytes())
+            if match is None:
+                stats.parse_errors += 1
+                self.state = IDLE
+                return
+            hour, minute, second = (int(group) for group in match.groups())
+            self.day_sec = hour * 3600 + minute * 60 + second
+            self.state = READINGS
+        elif self.state == READINGS and buf.startswith(b"Sensor", start, stop):
+            colon = buf.find(b": ", start, stop)
+            if colon < 0:
+                stats.parse_errors += 1
+                return
+            try:
+                zone = int(self.view[start + 6:colon].tobytes())
+                value = int(self.view[colon + 2:stop].tobytes())
+            except ValueError:
+                stats.parse_errors += 1
+                return
+            if not 0 < zone < 256 or not 0 <= value <= MAX_SENSOR_VALUE:
+                stats.parse_errors += 1
+                return
+            self.readings.append((zone, value))
+        elif self.state == READINGS and buf.startswith(b"====", start, stop):
+            for zone, value in self.readings:
+                store.append(now_ms, self.index, self.day_sec, zone, value)
+            stats.readings += len(self.readings)
+            stats.reports += 1
+            self.state = IDLE
+
+
+def open_endpoint(path):
+    fd = os.open(path, os.O_RDONLY | os.O_NONBLOCK | os.O_NOCTTY)
+    if os.isatty(fd):
+        tty.setraw(fd)
+    return fd
+
+
+def collect(paths, out, batch, stats_interval, duration=0, ready=None, stats=None):
+    stats = stats if stats is not None else Stats()
+    store = Store(out, batch)
+    poller = select.epoll()
+    endpoints = {}
+    for index, path in enumerate(paths):
+        fd = open_endpoint(path)
+        endpoints[fd] = Endpoint(index, path, fd)
+        poller.register(fd, select.EPOLLIN)
+    with open(os.path.join(out, "endpoints.json"), "w") as f:
+        json.dump(paths, f, indent=2)
+    if ready is not None:
+        ready.set()
+
+    start = last = time.time()
+    last_bytes = last_readings = 0
+    try:
+        while endpoints:
+            now = time.time()
+            if duration and now - start >= duration:
+                break
+            now_ms = int(now * 1000)
+            for fd, events in poller.poll(0.5):
+                endpoint = endpoints[fd]
+                if not endpoint.feed(store, stats, now_ms):
+                    poller.unregister(fd)
+                    os.close(fd)
+                    del endpoints[fd]
+            if stats_interval and now - last >= stats_interval:
+                store.flush()
+                print("%.0f bytes/s, %.0f readings/s, %d reports, %d parse errors" % (
+                    (stats.bytes - last_bytes) / (now - last), (stats.readings - last_readings) / (now - last),
+                    stats.reports, stats.parse_errors), flush=True)
+                last, last_bytes, last_readings = now, stats.bytes, stats.readings
+    except KeyboardInterrupt:
+        pass
+    for fd in endpoints:
+        os.close(fd)
+    poller.close()
+    store.close()
+    result = stats.as_dict()
+    result["seconds"] = time.time() - start
+    with open(os.path.join(out, "stats.json"), "w") as f:
+        json.dump(result, f, indent=2)
+    return result
+
+
+def report_text(hour, minute, second, values):
+    """Same bytes ReportTask prints."""
+    rule = b"=" * 64 + b"\r\n"
+    text = rule + b"System report\r\n" + rule
+    text += b"Time: %dh %dmin %dsec\n\r\n" % (hour, minute, second)
+    text += b"Current sensor readings:\r\n"
+    text += b"".join(b"Sensor%d: %d\n" % (i + 1, value) for i, value in enumerate(values)) + b"\r\n"
+    text += b"Current light mode: Automatic\r\n" + rule
+    return text
+
+
+def read_columns(directory):
+    """Column files of a store as arrays, and the size of each file in bytes."""
+    columns, sizes = {}, {}
+    for name, code, suffix in COLUMNS:
+        path = os.path.join(directory, "%s.%s" % (name, suffix))
+        with open(path, "rb") as f:
+            data = f.read()
+        column = array.array(code)
+        column.frombytes(data[:len(data) - len(data) % column.itemsize])
+        columns[name] = column
+        sizes[name] = len(data)
+    return columns, sizes
+
+
+def check_columns(directory, count, expected):
+    """Compares the stored rows of every endpoint with the expected (day_sec, zone, value) rows."""
+    columns, sizes = read_columns(directory)
+    rows = len(expected) * count
+    problems = []
+    for name, _, suffix in COLUMNS:
+        size = rows * int(suffix[1:]) // 8  # Width the file name promises, not the array's
+        if sizes[name] != size:
+            problems.append("%s: %d bytes, expected %d" % (name, sizes[name], size))
+    if problems:
+        return problems
+    stored = [[] for _ in range(count)]
+    for endpoint, day_sec, zone, value in zip(columns["endpoint"], columns["day_sec"], columns["zone"],
+                                              columns["value"]):
+        if endpoint >= count:
+            return ["endpoint %d out of range" % endpoint]
+        stored[endpoint].append((day_sec, zone, value))
+    for index, rows in enumerate(stored):
+        if rows != expected:
+            problems.append("endpoint %d: stored rows differ" % index)
+    return problems
+
+
+def self_test(count, reports):
+    with tempfile.TemporaryDirectory(prefix="collector") as out:
+        return run_self_test(count, reports, out)
+
+
+def run_self_test(count, reports, out):
+    masters, paths = [], []
+    for _ in range(count):
+        master, slave = pty.openpty()
+        masters.append(master)
+        paths.append(os.ttyname(slave))
+        tty.setraw(slave)
+        os.close(slave)
+
+    ready = threading.Event()
+    stats = Stats()
+    result = {}
+    thread = threading.Thread(target=lambda: result.update(collect(paths, out, 4096, 0, ready=ready, stats=stats)))
+    thread.start()
+    ready.wait()
+
+    expected_errors = 0
+    expected_rows = []
+    written = 0
+    for n in range(reports):
+        values = [(n * 7 + i) % 1024 for i in range(5)]
+        text = report_text(n % 24, n % 60, 0, values)
+        corrupted = n % 10 == 9
+        if corrupted:
+            # One unparsable reading per corrupted report, the other four are still stored
+            text = text.replace(b"Sensor3: ", b"Sensor3: x")
+            expected_errors += 1
+        expected_rows += [((n % 24) * 3600 + (n % 60) * 60, i + 1, value) for i, value in enumerate(values)
+                          if not (corrupted and i == 2)]
+        for master in masters:
+            os.write(master, text)
+        written += len(text) * count
+    # Unread pty data is discarded when the master closes, so wait for the collector to drain
+    while stats.bytes < written and thread.is_alive():
+        time.sleep(0.05)
+    for master in masters:
+        os.close(master)
+    thread.join()
+
+    expected_readings = count * (reports * 5 - expected_errors)
+    ok = (result["reports"] == count * reports and result["readings"] == expected_readings
+          and result["parse_errors"] == count * expected_errors)
+    problems = check_columns(out, count, expected_rows)
+    for problem in problems:
+        print(problem)
+    print("%d endpoints, %d reports, %d readings, %d parse errors in %.2f s: %s" % (
+        count, result["reports"], result["readings"], result["parse_errors"], result["seconds"],
+        "ok" if ok and not problems else "MISMATCH"))
+    return 0 if ok and not problems else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("endpoints", nargs="*")
+    parser.add_argument("--manifest", help="fleet.json written by tools/fleet.py")
+    parser.add_argument("--out", default=os.path.join(ROOT, "telemetry"))
+    parser.add_argument("--batch", type=int, default=1024, help="rows per column write")
+    parser.add_argument("--stats-interval", type=float, default=5)
+    parser.add_argument("--duration", type=float, default=0, help="seconds, 0 runs until all endpoints close")
+    parser.add_argument("--self-test", type=int, metavar="N", help="drive N local ptys and check the counts")
+    parser.add_argument("--reports", type=int, default=50, help="reports per pty in --self-test")
+    args = parser.parse_args()
+
+    if args.self_test:
+        return self_test(args.self_test, args.reports)
+
+    paths = list(args.endpoints)
+    if args.manifest:
+        with open(args.manifest) as f:
+            paths += [entry["path"] for entry in json.load(f)]
+    if not paths:
+        parser.error("no endpoints")
+    result = collect(paths, args.out, args.batch, args.stats_interval, args.duration)
+    print("%d bytes, %d readings, %d reports, %d parse errors in %.1f s" % (
+        result["bytes"], result["readings"], result["reports"], result["parse_errors"], result["seconds"]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,373 @@
+#!/usr/bin/env python3
+"""
+Host side of the framed configuration protocol (include/ConfigProtocol.h).
+
+Operations are packed CONFIG_MAX_OPS to a frame, and frames are pipelined: a new frame
+is sent while the unanswered ones still fit in the RX ring of the controller
+(SERIAL_RX_RING), the responses are matched to the frames by seq. A frame that is not
+answered within --timeout is sent again. Report lines from the controller share the
+port, they are skipped while looking for the response sync byte.
+
+Keys: threshold1..thresholdN (zones counted from 1 like the console), lights_on,
+lights_off, light_mode (0 automatic, 1 manual), time (hh:mm:ss) and zones (read only).
+
+--measure runs the protocol against an emulated controller on a local pty, paced at
+the baud rate of the board, and prints the time of a full update (every threshold,
+the light settings and the time) for 5 and 40 zones. The same update through the
+console prompts is estimated from their count, every answer ends with a
+SERIAL_READ_TIMEOUT of silence.
+
+Usage:
+  python3 tools/config_cli.py --port /dev/ttyACM0 get zones threshold1 time
+  python3 tools/config_cli.py --port /dev/ttyACM0 set threshold1=480 threshold2=500 lights_off=20
+  python3 tools/config_cli.py --measure
+"""
+
+import argparse
+import os
+import pty
+import select
+import struct
+import sys
+import termios
+import threading
+import time
+import tty
+
+REQUEST_SYNC = 0xC5
+RESPONSE_SYNC = 0xC6
+MAX_OPS = 16
+OP_SET = 0x80
+KEY_THRESHOLD = 0x00
+KEY_LIGHTS_ON = 0x40
+KEY_LIGHTS_OFF = 0x41
+KEY_LIGHT_MODE = 0x42
+KEY_TIME = 0x43
+KEY_ZONES = 0x44
+THRESHOLD_MAX = 1023
+
+STATUS = ("ok", "bad crc", "bad length", "bad key", "bad value", "read only")
+
+BAUD = 115200
+RX_RING = 128            # SERIAL_RX_RING
+SERIAL_READ_TIMEOUT = 1.0  # Silence that ends every console answer
+BITS_PER_BYTE = 10       # 8N1
+
+NAMED_KEYS = {"lights_on": KEY_LIGHTS_ON, "lights_off": KEY_LIGHTS_OFF,
+              "light_mode": KEY_LIGHT_MODE, "time": KEY_TIME, "zones": KEY_ZONES}
+
+
+def crc16(data, crc=0xFFFF):
+    """_crc_ccitt_update of avr-libc: reflected polynomial 0x8408, no final xor."""
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc
+
+
+def encode_request(seq, ops):
+    body = bytes([seq, len(ops)]) + b"".join(struct.pack("<BI", key, value) for key, value in ops)
+    return bytes([REQUEST_SYNC]) + body + struct.pack("<H", crc16(body))
+
+
+def encode_response(seq, status, bad, values):
+    body = bytes([seq, status, bad, len(values)]) + b"".join(struct.pack("<I", v) for v in values)
+    return bytes([RESPONSE_SYNC]) + body + struct.pack("<H", crc16(body))
+
+
+class ResponseParser:
+    """Finds responses in a byte stream that also carries text."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.skipped = 0
+
+    def feed(self, data):
+        self.buffer += data
+        responses = []
+        while True:
+            start = self.buffer.find(bytes([RESPONSE_SYNC]))
+            if start < 0:
+                self.skipped += len(self.buffer)
+                self.buffer.clear()
+                break
+            self.skipped += start
+            del self.buffer[:start]
+            if len(self.buffer) < 5:
+                break
+            length = 5 + 4 * self.buffer[4] + 2
+            if len(self.buffer) < length:
+                break
+            frame = bytes(self.buffer[:length])
+            if crc16(frame[1:-2]) != struct.unpack("<H", frame[-2:])[0]:
+                # A 0xC6 inside something else, resync from the next byte
+                del self.buffer[:1]
+                self.skipped += 1
+                continue
+            del self.buffer[:length]
+            seq, status, bad, count = frame[1:5]
+            values = list(struct.unpack("<%dI" % count, frame[5:-2]))
+            responses.append((seq, status, bad, values))
+        return responses
+
+
+def parse_key(name):
+    if name.startswith("threshold"):
+        zone = int(name[len("threshold"):])
+        if zone < 1:
+            raise ValueError("zones are counted from 1: %s" % name)
+        return KEY_THRESHOLD + zone - 1
+    if name not in NAMED_KEYS:
+        raise ValueError("unknown key %s" % name)
+    return NAMED_KEYS[name]
+
+
+def key_name(key):
+    if key < KEY_LIGHTS_ON:
+        return "threshold%d" % (key - KEY_THRESHOLD + 1)
+    return next(name for name, k in NAMED_KEYS.items() if k == key)
+
+
+def parse_value(key, text):
+    if key == KEY_TIME:
+        hour, minute, second = (int(part) for part in text.split(":"))
+        return hour << 16 | minute << 8 | second
+    return int(text)
+
+
+def format_value(key, value):
+    if key == KEY_TIME:
+        return "%02d:%02d:%02d" % (value >> 16, (value >> 8) & 0xFF, value & 0xFF)
+    return str(value)
+
+
+class Client:
+    def __init__(self, fd, window=RX_RING, timeout=0.5, retries=3):
+        self.fd = fd
+        self.window = window
+        self.timeout = timeout
+        self.retries = retries
+        self.parser = ResponseParser()
+        self.seq = 0
+        self.frames = 0
+        self.resent = 0
+
+    def transact(self, ops):
+        """Sends ops in pipelined frames, returns the values in the order of ops."""
+        batches = [ops[i:i + MAX_OPS] for i in range(0, len(ops), MAX_OPS)]
+        results = [None] * len(batches)
+        pending = {}  # seq -> (batch index, frame, sent at, attempts)
+        next_batch = 0
+        while next_batch < len(batches) or pending:
+            in_flight = sum(len(frame) for _, frame, _, _ in pending.values())
+            while next_batch < len(batches):
+                frame = encode_request(self.seq, batches[next_batch])
+                # The first frame always goes, a larger one could never be sent
+                if pending and in_flight + len(frame) > self.window:
+                    break
+                os.write(self.fd, frame)
+                pending[self.seq] = (next_batch, frame, time.monotonic(), 1)
+                self.seq = (self.seq + 1) & 0xFF
+                self.frames += 1
+                in_flight += len(frame)
+                next_batch += 1
+            ready, _, _ = select.select([self.fd], [], [], 0.01)
+            if ready:
+                for seq, status, bad, values in self.parser.feed(os.read(self.fd, 4096)):
+                    if seq not in pending:
+                        continue
+                    if status == 1:
+                        # Corrupted on the way in, the timeout below sends it again
+                        continue
+                    index, frame, _, _ = pending.pop(seq)
+                    if status != 0:
+                        key = batches[index][bad][0] & 0x7F
+                        raise RuntimeError("frame %d rejected: %s at %s" % (seq, STATUS[status] if status < len(STATUS)
+                                                                           else status, key_name(key)))
+                    results[index] = values
+            now = time.monotonic()
+            for seq, (index, frame, sent, attempts) in list(pending.items()):
+                if now - sent > self.timeout:
+                    if attempts > self.retries:
+                        raise RuntimeError("no response to frame %d" % seq)
+                    # Sets are absolute values, sending a frame twice is harmless
+                    os.write(self.fd, frame)
+                    pending[seq] = (index, frame, now, attempts + 1)
+                    self.resent += 1
+        return [value for values in results for value in values]
+
+
+def open_port(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    if os.isatty(fd):
+        tty.setraw(fd)
+        speed = getattr(termios, "B%d" % baud)
+        attrs = termios.tcgetattr(fd)
+        attrs[4] = attrs[5] = speed
+        termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+class Emulator(threading.Thread):
+    """Answers frames like UserInputTask, on the master side of a pty, at the baud rate of the board."""
+
+    def __init__(self, fd, zones, baud, apply_s):
+        super().__init__(daemon=True)
+        self.fd = fd
+        self.byte_s = BITS_PER_BYTE / baud
+        self.apply_s = apply_s
+        self.zones = zones
+        self.values = {KEY_THRESHOLD + zone: 450 for zone in range(zones)}
+        self.values.update({KEY_LIGHTS_ON: 6, KEY_LIGHTS_OFF: 18, KEY_LIGHT_MODE: 0, KEY_TIME: 6 << 16,
+                            KEY_ZONES: zones})
+        self.buffer = bytearray()
+        self.stop = False
+
+    def check(self, key, value):
+        if key < KEY_LIGHTS_ON:
+            return 0 if key < self.zones and value <= THRESHOLD_MAX else (3 if key >= self.zones else 4)
+        if key in (KEY_LIGHTS_ON, KEY_LIGHTS_OFF):
+            return 0 if value < 24 else 4
+        if key == KEY_LIGHT_MODE:
+            return 0 if value <= 1 else 4
+        if key == KEY_TIME:
+            return 0 if value >> 16 < 24 and (value >> 8) & 0xFF < 60 and value & 0xFF < 60 else 4
+        return 5 if key == KEY_ZONES else 3
+
+    def handle(self, frame):
+        seq, count = frame[1], frame[2]
+        ops = [struct.unpack("<BI", frame[3 + 5 * i:8 + 5 * i]) for i in range(count)]
+        status, bad = 0, 0
+        if crc16(frame[1:]) != 0:
+            status = 1
+        for index, (key, value) in enumerate(ops if status == 0 else []):
+            result = self.check(key & 0x7F, value) if key & OP_SET else (0 if key in self.values else 3)
+            if result:
+                status, bad = result, index
+                break
+        values = []
+        if status == 0:
+            for key, value in ops:
+                if key & OP_SET:
+                    self.values[key & 0x7F] = value
+            values = [self.values[key & 0x7F] for key, _ in ops]
+        time.sleep(self.apply_s)
+        response = encode_response(seq, status, bad, values)
+        time.sleep(len(response) * self.byte_s)
+        os.write(self.fd, response)
+
+    def run(self):
+        while not self.stop:
+            ready, _, _ = select.select([self.fd], [], [], 0.05)
+            if not ready:
+                continue
+            data = os.read(self.fd, 4096)
+            # Bytes arrive at the baud rate of the board, not at the speed of the pty
+            time.sleep(len(data) * self.byte_s)
+            self.buffer += data
+            while len(self.buffer) >= 3:
+                start = self.buffer.find(bytes([REQUEST_SYNC]))
+                if start < 0:
+                    self.buffer.clear()
+                    break
+                del self.buffer[:start]
+                length = 3 + 5 * self.buffer[2] + 2
+                if len(self.buffer) < length:
+                    break
+                frame = bytes(self.buffer[:length])
+                del self.buffer[:length]
+                self.handle(frame)
+
+
+def full_update(zones):
+    ops = [(OP_SET | KEY_THRESHOLD + zone, 400 + zone) for zone in range(zones)]
+    ops += [(OP_SET | KEY_LIGHTS_ON, 7), (OP_SET | KEY_LIGHTS_OFF, 20), (OP_SET | KEY_LIGHT_MODE, 1),
+            (OP_SET | KEY_TIME, 12 << 16 | 30 << 8)]
+    return ops
+
+
+def console_answers(zones):
+    """Answers typed for the same update through the console prompts."""
+    thresholds = 3 * zones        # p, pump, value
+    lights = 6                    # l, m, y, on, y, off
+    clock = 3 * 3                 # t, unit, value for h, m and s
+    return thresholds + lights + clock
+
+
+def measure(baud, apply_s):
+    print("zones  ops  frames  bytes  pipelined ms  stop-and-wait ms  console s (estimated)")
+    for zones in (5, 40):
+        row = [zones]
+        for window in (RX_RING, 1):
+            master, slave = pty.openpty()
+            tty.setraw(master)
+            tty.setraw(slave)
+            emulator = Emulator(master, zones, baud, apply_s)
+            emulator.start()
+            client = Client(slave, window=window)
+            ops = full_update(zones)
+            start = time.monotonic()
+            assert client.transact([(KEY_ZONES, 0)]) == [zones]
+            values = client.transact(ops)
+            elapsed = time.monotonic() - start
+            assert values == [value for _, value in ops], "values read back differ"
+            emulator.stop = True
+            emulator.join()
+            os.close(master)
+            os.close(slave)
+            if window == RX_RING:
+                frames = client.frames - 1  # Without the zones query
+                wire = sum(len(encode_request(0, ops[i:i + MAX_OPS])) for i in range(0, len(ops), MAX_OPS))
+                row += [len(ops), frames, wire]
+            row.append(elapsed * 1000)
+        answers = console_answers(zones)
+        row.append(answers * SERIAL_READ_TIMEOUT)
+        print("%5d  %3d  %6d  %5d  %12.1f  %16.1f  %21.1f" % tuple(row))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", help="serial port of the controller")
+    parser.add_argument("--baud", type=int, default=BAUD)
+    parser.add_argument("--timeout", type=float, default=0.5, help="seconds before a frame is sent again")
+    parser.add_argument("--measure", action="store_true", help="time full updates against an emulated controller")
+    parser.add_argument("--apply-ms", type=float, default=1.0,
+                        help="controller time per frame for --measure, see max in the Config line of 's'")
+    parser.add_argument("command", nargs="?", choices=("get", "set"))
+    parser.add_argument("items", nargs="*", help="keys for get, key=value for set")
+    args = parser.parse_args()
+
+    if args.measure:
+        measure(args.baud, args.apply_ms / 1000)
+        return 0
+    if not args.port or not args.command or not args.items:
+        parser.error("--port, a command and at least one key are needed")
+
+    if args.command == "get":
+        ops = [(parse_key(item), 0) for item in args.items]
+    else:
+        ops = []
+        for item in args.items:
+            name, _, text = item.partition("=")
+            key = parse_key(name)
+            ops.append((OP_SET | key, parse_value(key, text)))
+
+    fd = open_port(args.port, args.baud)
+    client = Client(fd, timeout=args.timeout)
+    start = time.monotonic()
+    try:
+        values = client.transact(ops)
+    except RuntimeError as error:
+        print(error, file=sys.stderr)
+        return 1
+    elapsed = time.monotonic() - start
+    for (key, _), value in zip(ops, values):
+        print("%s = %s" % (key_name(key & 0x7F), format_value(key & 0x7F, value)))
+    print("%d ops in %d frames, %.1f ms, %d resent" % (len(ops), client.frames, elapsed * 1000, client.resent),
+          file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+"""
+Fleet simulator: runs many gardening controllers at once to load-test the telemetry path.
+
+Every instance is one simavr process running the sim build, so each has its own
+globalSensors, currentTime and handles. Instance i runs a copy of the ELF with
+simRandomSeed patched to --seed + i, so the instances read different sensor values.
+A small pool of worker threads, each with a selector over its share of instances,
+moves every instance's serial output to its own pty (default) or pipe. A collector can
+open the pty slaves like real serial ports, their paths are written to --manifest.
+
+Output that the pty or pipe does not take at once stays in a buffer of the instance
+and is written when the endpoint becomes writable again, in order. Only when a buffer
+holds --buffer bytes, because nobody reads the endpoint, is further output dropped,
+and the dropped bytes are reported per instance.
+
+When the instances finish (SIM_DAYS) or --duration passes, the CPU time of every
+instance is read from /proc and reported with the bytes it produced.
+
+Usage:
+  python3 tools/fleet.py --instances 200 [--workers 4] [--duration 60] [--pipe] [--seed 1]
+"""
+
+import argparse
+import json
+import os
+import pty
+import selectors
+import shutil
+import signal
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+ELF = os.path.join(ROOT, ".pio", "build", "sim", "firmware.elf")
+CLOCK_TICKS = os.sysconf("SC_CLK_TCK")
+SEED_SYMBOL = b"simRandomSeed"
+
+
+def seed_offset(elf):
+    """File offset of the initial value of simRandomSeed in .data, from the ELF32 symbol table."""
+    with open(elf, "rb") as f:
+        image = f.read()
+    if image[:4] != b"\x7fELF" or image[4] != 1 or image[5] != 1:
+        sys.exit("%s: not a little-endian ELF32 file" % elf)
+    shoff, = struct.unpack_from("<I", image, 0x20)
+    shentsize, shnum = struct.unpack_from("<HH", image, 0x2E)
+    # name, type, flags, addr, offset, size, link, info, addralign, entsize
+    sections = [struct.unpack_from("<10I", image, shoff + i * shentsize) for i in range(shnum)]
+    for section in sections:
+        if section[1] != 2:  # SHT_SYMTAB
+            continue
+        strtab = sections[section[6]]
+        for pos in range(section[4], section[4] + section[5], 16):
+            name, value, size, _, _, shndx = struct.unpack_from("<IIIBBH", image, pos)
+            start = strtab[4] + name
+            symbol = image[start:image.index(b"\0", start)]
+            # LTO can add a suffix to the name of a symbol it keeps
+            if size == 4 and symbol.split(b".")[0] == SEED_SYMBOL and shndx < len(sections):
+                data = sections[shndx]
+                return data[4] + value - data[3]
+    sys.exit("%s: no %s, build the sim environment" % (elf, SEED_SYMBOL.decode()))
+
+
+def seeded_elf(elf, offset, seed, directory):
+    """Copy of the ELF with simRandomSeed set to seed."""
+    path = os.path.join(directory, "seed%d.elf" % seed)
+    shutil.copyfile(elf, path)
+    with open(path, "r+b") as f:
+        f.seek(offset)
+        f.write(struct.pack("<I", seed & 0xFFFFFFFF))
+    return path
+
+
+class Instance:
+    def __init__(self, index, command, use_pty, seed, buffer_limit):
+        self.index = index
+        self.seed = seed
+        self.proc = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+        os.set_blocking(self.proc.stdout.fileno(), False)
+        self.bytes = 0
+        self.dropped = 0
+        self.pending = bytearray()  # Output the endpoint did not take yet
+        self.buffer_limit = buffer_limit
+        self.watching = False  # Output registered for EVENT_WRITE while pending
+        self.eof = False
+        self.cpu = 0.0
+        if use_pty:
+            self.out, slave = pty.openpty()
+            self.path = os.ttyname(slave)
+            # Keep the slave open so writes don't fail before a collector attaches
+            self.slave = slave
+        else:
+            read, self.out = os.pipe()
+            self.path = "/proc/%d/fd/%d" % (os.getpid(), read)
+            self.slave = read
+        os.set_blocking(self.out, False)
+
+    def sample_cpu(self):
+        """User plus system time of the process, from /proc/<pid>/stat."""
+        try:
+            with open("/proc/%d/stat" % self.proc.pid) as f:
+                fields = f.read().rsplit(")", 1)[1].split()
+            self.cpu = (int(fields[11]) + int(fields[12])) / CLOCK_TICKS
+        except OSError:
+            pass  # Process already reaped, keep the last sample
+
+    def pump(self):
+        """Moves available output to the pty or pipe, returns False at end of stream."""
+        try:
+            data = os.read(self.proc.stdout.fileno(), 4096)
+        except BlockingIOError:
+            return True
+        if not data:
+            return False
+        self.bytes += len(data)
+        room = self.buffer_limit - len(self.pending)
+        if len(data) > room:
+            # Nobody has read the endpoint for a while, drop like a serial line would
+            self.dropped += len(data) - max(room, 0)
+            data = data[:max(room, 0)]
+        self.pending += data
+        self.flush()
+        return True
+
+    def flush(self):
+        """Writes as much of the pending output as the endpoint takes, partial writes keep the tail."""
+        while self.pending:
+            try:
+                written = os.write(self.out, self.pending)
+            except BlockingIOError:
+                return
+            del self.pending[:written]
+
+    def watch(self, sel):
+        """Asks the selector for writability of the endpoint only while output is pending."""
+        if self.pending and not self.watching:
+            sel.register(self.out, selectors.EVENT_WRITE, self)
+        elif not self.pending and self.watching:
+            sel.unregister(self.out)
+        self.watching = bool(self.pending)
+
+
+def worker(instances, stop):
+    sel = selectors.DefaultSelector()
+    for inst in instances:
+        sel.register(inst.proc.stdout, selectors.EVENT_READ, inst)
+    running = set(instances)
+    while running and not stop.is_set():
+        for key, events in sel.select(timeout=0.5):
+            inst = key.data
+            if events & selectors.EVENT_READ:
+                if not inst.pump():
+                    sel.unregister(key.fileobj)
+                    inst.eof = True
+            else:
+                inst.flush()
+            inst.watch(sel)
+            if inst.eof and not inst.pending:
+                running.discard(inst)
+        for inst in instances:
+            inst.sample_cpu()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--instances", type=int, default=100)
+    parser.add_argument("--workers", type=int, default=os.cpu_count() or 1)
+    parser.add_argument("--duration", type=float, default=0, help="wall-clock seconds, 0 runs to SIM_DAYS")
+    parser.add_argument("--simulator", default="simavr -m atmega2560 -f 16000000")
+    parser.add_argument("--elf", default=ELF)
+    parser.add_argument("--pipe", action="store_true", help="use pipes instead of ptys")
+    parser.add_argument("--manifest", default=os.path.join(ROOT, "fleet.json"))
+    parser.add_argument("--seed", type=int, default=1, help="random seed of instance 0, instance i gets seed + i")
+    parser.add_argument("--buffer", type=int, default=1 << 20, help="bytes kept per instance for a slow endpoint")
+    args = parser.parse_args()
+
+    offset = seed_offset(args.elf)
+    elfs = tempfile.TemporaryDirectory(prefix="fleet")
+    instances = []
+    for i in range(args.instances):
+        command = args.simulator.split() + [seeded_elf(args.elf, offset, args.seed + i, elfs.name)]
+        instances.append(Instance(i, command, not args.pipe, args.seed + i, args.buffer))
+    with open(args.manifest, "w") as f:
+        json.dump([{"instance": i.index, "pid": i.proc.pid, "path": i.path, "seed": i.seed} for i in instances], f,
+                  indent=2)
+    print("%d instances started, endpoints in %s" % (len(instances), os.path.relpath(args.manifest, ROOT)))
+
+    stop = threading.Event()
+    start = time.time()
+    shards = [instances[w::args.workers] for w in range(args.workers)]
+    threads = [threading.Thread(target=worker, args=(shard, stop)) for shard in shards if shard]
+    for t in threads:
+        t.start()
+    try:
+        while any(t.is_alive() for t in threads):
+            if args.duration and time.time() - start >= args.duration:
+                break
+            time.sleep(0.5)
+    except KeyboardInterrupt:
+        pass
+    stop.set()
+    for t in threads:
+        t.join()
+    wall = time.time() - start
+    for inst in instances:
+        inst.sample_cpu()
+        if inst.proc.poll() is None:
+            inst.proc.send_signal(signal.SIGTERM)
+        inst.proc.wait()
+    elfs.cleanup()
+
+    print("%8s %10s %12s %10s %10s %10s" % ("instance", "cpu s", "bytes", "bytes/s", "unsent", "dropped"))
+    for inst in instances:
+        print("%8d %10.2f %12d %10.0f %10d %10d" % (inst.index, inst.cpu, inst.bytes, inst.bytes / wall,
+                                                 len(inst.pending), inst.dropped))
+    total_cpu = sum(i.cpu for i in instances)
+    total_bytes = sum(i.bytes for i in instances)
+    total_dropped = sum(i.dropped for i in instances)
+    print("wall-clock %.1f s, cpu %.1f s (%.3f s per instance), %d bytes (%.0f bytes/s), %d dropped" % (
+        wall, total_cpu, total_cpu / len(instances), total_bytes, total_bytes / wall, total_dropped))
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+"""
+Generates include/GammaTable.h, the brightness to PWM duty table of the light engine.
+
+Brightness 0-255 is perceptual, duty = TOP * (brightness / 255) ^ gamma, so equal
+brightness steps look equal to the eye and ramps look linear. TOP is the Timer1 TOP
+(ICR1) of src/LightEngine.cpp.
+
+Usage:
+  python3 tools/gamma_table.py [--gamma 2.2]
+"""
+
+import argparse
+import os
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+HEADER = os.path.join(ROOT, "include", "GammaTable.h")
+TOP = 0xFFFF
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--gamma", type=float, default=2.2)
+    args = parser.parse_args()
+
+    duty = [round(TOP * (i / 255.0) ** args.gamma) for i in range(256)]
+    # Every level above 0 lights the LED
+    duty = [d if i == 0 else max(d, 1) for i, d in enumerate(duty)]
+    lines = [
+        "#ifndef GAMMA_TABLE_H",
+        "#define GAMMA_TABLE_H",
+        "",
+        "#include <avr/pgmspace.h>",
+        "",
+        "/*",
+        "Generated by tools/gamma_table.py, do not edit.",
+        "Timer1 duty for brightness 0-255, gamma %.1f, TOP %d." % (args.gamma, TOP),
+        "*/",
+        "",
+        "static const uint16_t gammaTable[256] PROGMEM = {",
+    ]
+    for row in range(0, 256, 8):
+        lines.append("    " + ", ".join("%d" % d for d in duty[row:row + 8]) + ",")
+    lines += ["};", "", "#endif", ""]
+    with open(HEADER, "w") as f:
+        f.write("\n".join(lines))
+    print("wrote %s" % os.path.relpath(HEADER, ROOT))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,91 @@
+/*
+Runs the SENSORS_MODBUS build of the gardening system in simavr with USART1 on a pty.
+
+The Modbus master (ModbusMaster.cpp) sends on USART1, this connects that UART to a pty
+with uart_pty of the simavr examples (examples/parts), so tools/modbus_slave.py can
+answer as the sensor and pump nodes, and otherwise runs the firmware like twi_sim.c.
+The path of the pty is printed on stderr as
+
+  modbus_sim: USART1 on /dev/pts/N
+
+USART0, the console, is printed by simavr as usual. The slaves run on wall-clock time,
+so the firmware does too: the cycles asleep are waited for like the simavr command
+line does, not skipped like in sim_run.c and twi_sim.c, otherwise the 20 ms response
+timeout would pass before a slave could answer. Bytes still reach the firmware at the
+baud rate of USART1 in simulated time, so the t1.5 and t3.5 framing is exercised.
+
+--wait reads a line from stdin after the pty is printed and before the firmware starts,
+so the slaves can be connected first and the first scans are not timeouts.
+
+Build (simavr source tree for uart_pty, simavr and libelf development files):
+  cc -O2 -o tools/modbus_sim tools/modbus_sim.c $SIMAVR/examples/parts/uart_pty.c \
+     -I$SIMAVR/examples/parts $(pkg-config --cflags --libs simavr) -lelf -lpthread -lutil
+Usage:
+  tools/modbus_sim [--wait] .pio/build/sim_modbus/firmware.elf
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "uart_pty.h"
+
+#define F_CPU 16000000UL
+
+static avr_t *avr;
+static uart_pty_t pty;
+
+static double seconds(void)
+{
+  return (double)avr->cycle / avr->frequency;
+}
+
+int main(int argc, char *argv[])
+{
+  elf_firmware_t firmware = {{0}};
+  int wait = argc == 3 && strcmp(argv[1], "--wait") == 0;
+  if (argc != 2 + wait)
+  {
+    fprintf(stderr, "usage: %s [--wait] firmware.elf\n", argv[0]);
+    return 2;
+  }
+  const char *path = argv[1 + wait];
+  if (elf_read_firmware(path, &firmware) != 0)
+  {
+    fprintf(stderr, "modbus_sim: can't read %s\n", path);
+    return 1;
+  }
+  if (firmware.frequency == 0)
+  {
+    firmware.frequency = F_CPU;
+  }
+  avr = avr_make_mcu_by_name("atmega2560");
+  if (avr == NULL)
+  {
+    fprintf(stderr, "modbus_sim: simavr has no atmega2560\n");
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+
+  uart_pty_init(avr, &pty);
+  uart_pty_connect(&pty, '1');
+  fprintf(stderr, "modbus_sim: USART1 on %s\n", pty.port[0].slavename);
+  char line[16];
+  if (wait && fgets(line, sizeof(line), stdin) == NULL)
+  {
+    fprintf(stderr, "modbus_sim: stdin closed, starting without the slaves\n");
+  }
+
+  int state;
+  do
+  {
+    state = avr_run(avr);
+  } while (state != cpu_Done && state != cpu_Crashed);
+
+  uart_pty_stop(&pty);
+  fprintf(stderr, "modbus_sim: %.1f s simulated\n", seconds());
+  return state == cpu_Crashed;
+}
@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+"""
+Modbus RTU slaves for the SENSORS_MODBUS build (include/ModbusMaster.h).
+
+Simulates the nodes of the gardening bus on a serial port (an RS-485 adapter wired to
+the board) or on a local pty:
+
+  1 + zone   soil sensor, input registers 0 to 15. Register 0 is the moisture in mV,
+             a sawtooth from 250 to 500 mV with a period of its own, the others read
+             1000 + register.
+  17 + zone  pump, holding register 0, 1 while the pump runs.
+
+Requests are framed by t3.5 of silence like on the bus, answers come after --reply-ms
+and take the time of their bytes at --baud (8E1, 11 bits a byte). Other nodes do not
+answer, other functions and registers get exception 1 and 2. --drop and --corrupt
+leave out answers or break their CRC, to see the timeouts and errors in the Modbus
+line of 's'.
+
+--bench polls the slaves on a pty with a master that works like the driver: every
+zone of a scan is one request, queued and sent back to back, the end of an answer is
+t3.5 of silence. It prints the zones scanned per second at 19200 and 115200 baud, for
+1 and 8 registers per zone, once with one request per zone and once with one request
+per register, next to the time the bytes and gaps take on the wire. The master of
+--bench is Python on the host, not the firmware: its figures show what the framing and
+the request layout cost on the bus, not the timing of ModbusMaster.cpp. The firmware's
+own figures come from a board on an RS-485 adapter running these slaves, or from
+tools/sim.py --modbus, which runs the sim_modbus build in tools/modbus_sim with these
+slaves on its USART1 pty (the Modbus line of 's' and of the end of the simulation).
+
+Usage:
+  python3 tools/modbus_slave.py --port /dev/ttyUSB0 --baud 19200
+  python3 tools/modbus_slave.py --drop 0.05          # prints the pty to connect to
+  python3 tools/modbus_slave.py --bench
+"""
+
+import argparse
+import os
+import pty
+import random
+import select
+import struct
+import sys
+import threading
+import time
+import tty
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from config_cli import open_port  # noqa: E402
+
+SENSOR_NODE_BASE = 1    # MODBUS_SENSOR_NODE_BASE
+PUMP_NODE_BASE = 17     # MODBUS_PUMP_NODE_BASE
+SENSOR_REGISTERS = 16   # MODBUS_MAX_REGISTERS
+READ_HOLDING = 0x03
+READ_INPUT = 0x04
+WRITE_REGISTER = 0x06
+ILLEGAL_FUNCTION = 1
+ILLEGAL_ADDRESS = 2
+BITS_PER_BYTE = 11      # Start, 8 data, parity, stop
+RESPONSE_TIMEOUT = 0.020  # MODBUS_RESPONSE_TIMEOUT_MS
+
+
+def crc16(data, crc=0xFFFF):
+    """Modbus CRC, _crc16_update of avr-libc: reflected polynomial 0xA001."""
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def with_crc(body):
+    return body + struct.pack("<H", crc16(body))
+
+
+def silence(baud, characters):
+    """t1.5 and t3.5, fixed above 19200 baud."""
+    if baud > 19200:
+        return 0.00075 if characters == 1.5 else 0.00175
+    return characters * BITS_PER_BYTE / baud
+
+
+def read_frame(fd, gap, first_timeout):
+    """Reads until gap seconds of silence, None if nothing came within first_timeout."""
+    frame = bytearray()
+    timeout = first_timeout
+    while True:
+        ready, _, _ = select.select([fd], [], [], timeout)
+        if not ready:
+            return bytes(frame) if frame else None
+        frame += os.read(fd, 256)
+        timeout = gap
+
+
+class Nodes:
+    def __init__(self, zones):
+        self.zones = zones
+        self.pumps = [0] * zones
+        self.start = time.monotonic()
+
+    def moisture(self, zone):
+        period = 20.0 + 5.0 * zone
+        phase = (time.monotonic() - self.start) / period % 1.0
+        return 250 + int(250 * phase)
+
+    def answer(self, request):
+        """Answer to a request without its CRC, None for no answer."""
+        node, function = request[0], request[1]
+        address, data = struct.unpack(">HH", request[2:6])
+        zone = node - SENSOR_NODE_BASE
+        pump = node - PUMP_NODE_BASE
+        if 0 <= zone < self.zones:
+            if function not in (READ_INPUT, READ_HOLDING):
+                return bytes([node, function | 0x80, ILLEGAL_FUNCTION])
+            if data < 1 or address + data > SENSOR_REGISTERS:
+                return bytes([node, function | 0x80, ILLEGAL_ADDRESS])
+            values = [self.moisture(zone) if r == 0 else 1000 + r for r in range(address, address + data)]
+            return bytes([node, function, 2 * data]) + struct.pack(">%dH" % data, *values)
+        if 0 <= pump < self.zones:
+            if function == WRITE_REGISTER:
+                if address != 0 or data > 1:
+                    return bytes([node, function | 0x80, ILLEGAL_ADDRESS])
+                self.pumps[pump] = data
+                return request[:6]
+            if function == READ_HOLDING:
+                if address != 0 or data != 1:
+                    return bytes([node, function | 0x80, ILLEGAL_ADDRESS])
+                return bytes([node, function, 2]) + struct.pack(">H", self.pumps[pump])
+            return bytes([node, function | 0x80, ILLEGAL_FUNCTION])
+        return None
+
+
+class Slave(threading.Thread):
+    """Answers requests on fd, paced at the baud rate in both directions like the bus."""
+
+    def __init__(self, fd, zones, baud, reply_s, drop=0.0, corrupt=0.0, verbose=False):
+        super().__init__(daemon=True)
+        self.fd = fd
+        self.nodes = Nodes(zones)
+        self.baud = baud
+        self.byte_s = BITS_PER_BYTE / baud
+        self.reply_s = reply_s
+        self.drop = drop
+        self.corrupt = corrupt
+        self.verbose = verbose
+        self.requests = self.answered = self.dropped = self.bad = 0
+        self.stop = False
+
+    def run(self):
+        t35 = silence(self.baud, 3.5)
+        while not self.stop:
+            frame = read_frame(self.fd, t35, 0.05)
+            if frame is None:
+                continue
+            # Bytes arrive at the baud rate of the bus, not at the speed of the pty
+            time.sleep(len(frame) * self.byte_s)
+            if len(frame) < 8 or crc16(frame) != 0:
+                self.bad += 1
+                continue
+            self.requests += 1
+            answer = self.nodes.answer(frame[:-2])
+            if answer is None or random.random() < self.drop:
+                self.dropped += 1
+                continue
+            answer = with_crc(answer)
+            if random.random() < self.corrupt:
+                answer = answer[:-1] + bytes([answer[-1] ^ 0xFF])
+            time.sleep(self.reply_s + len(answer) * self.byte_s)
+            os.write(self.fd, answer)
+            self.answered += 1
+            if self.verbose:
+                print("%s -> %s" % (frame.hex(" "), answer.hex(" ")))
+
+
+class Master:
+    """Polls like ModbusMaster.cpp: requests back to back, t3.5 ends an answer."""
+
+    def __init__(self, fd, baud):
+        self.fd = fd
+        self.t35 = silence(baud, 3.5)
+        self.request_s = 8 * BITS_PER_BYTE / baud
+        self.timeouts = self.errors = 0
+
+    def transact(self, node, function, address, quantity):
+        os.write(self.fd, with_crc(struct.pack(">BBHH", node, function, address, quantity)))
+        # The timeout starts once the request is on the wire, with a margin for the scheduler of the host
+        answer = read_frame(self.fd, self.t35, self.request_s + self.t35 + RESPONSE_TIMEOUT + 0.010)
+        if answer is None:
+            self.timeouts += 1
+            return None
+        if crc16(answer) != 0 or answer[0] != node or answer[1] != function or answer[2] != 2 * quantity:
+            self.errors += 1
+            return None
+        return struct.unpack(">%dH" % quantity, answer[3:-2])
+
+    def scan(self, zones, registers, per_register):
+        values = []
+        for zone in range(zones):
+            node = SENSOR_NODE_BASE + zone
+            if per_register:
+                for r in range(registers):
+                    values.append(self.transact(node, READ_INPUT, r, 1))
+            else:
+                values.append(self.transact(node, READ_INPUT, 0, registers))
+        return values
+
+
+def wire_time(baud, registers, requests):
+    """Bytes and t3.5 gaps of one zone on the bus, without the reply time of the node."""
+    quantity = registers // requests
+    byte_s = BITS_PER_BYTE / baud
+    per_request = (8 + 5 + 2 * quantity) * byte_s + 2 * silence(baud, 3.5)
+    return requests * per_request
+
+
+def bench(zones, scans, reply_s):
+    print("baud    registers  requests/zone  zones/s  ms/zone  wire ms/zone  timeouts  errors")
+    for baud in (19200, 115200):
+        for registers in (1, 8):
+            for per_register in ((False, True) if registers > 1 else (False,)):
+                master_fd, slave_fd = pty.openpty()
+                tty.setraw(master_fd)
+                tty.setraw(slave_fd)
+                slave = Slave(master_fd, zones, baud, reply_s)
+                slave.start()
+                master = Master(slave_fd, baud)
+                start = time.monotonic()
+                for _ in range(scans):
+                    master.scan(zones, registers, per_register)
+                elapsed = time.monotonic() - start
+                slave.stop = True
+                slave.join()
+                os.close(master_fd)
+                os.close(slave_fd)
+                requests = registers if per_register else 1
+                scanned = zones * scans
+                wire = wire_time(baud, registers, requests) + requests * reply_s
+                print("%6d  %9d  %13d  %7.1f  %7.2f  %12.2f  %8d  %6d" % (
+                    baud, registers, requests, scanned / elapsed, elapsed * 1000 / scanned, wire * 1000,
+                    master.timeouts, master.errors))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", help="serial port of the bus, a new pty if left out")
+    parser.add_argument("--baud", type=int, default=19200, help="MODBUS_BAUD of the build")
+    parser.add_argument("--zones", type=int, default=5)
+    parser.add_argument("--reply-ms", type=float, default=1.0, help="time a node takes before it answers")
+    parser.add_argument("--drop", type=float, default=0.0, help="share of requests left unanswered")
+    parser.add_argument("--corrupt", type=float, default=0.0, help="share of answers with a broken CRC")
+    parser.add_argument("--bench", action="store_true", help="measure zones scanned per second on a pty")
+    parser.add_argument("--scans", type=int, default=40, help="scans per row of --bench")
+    parser.add_argument("-v", "--verbose", action="store_true", help="print every request and answer")
+    args = parser.parse_args()
+
+    if args.bench:
+        bench(args.zones, args.scans, args.reply_ms / 1000)
+        return 0
+
+    if args.port:
+        fd = open_port(args.port, args.baud)
+    else:
+        fd, slave_fd = pty.openpty()
+        tty.setraw(fd)
+        tty.setraw(slave_fd)
+        print("Slaves on %s" % os.ttyname(slave_fd))
+    slave = Slave(fd, args.zones, args.baud, args.reply_ms / 1000, args.drop, args.corrupt, args.verbose)
+    slave.start()
+    try:
+        while slave.is_alive():
+            slave.join(1.0)
+    except KeyboardInterrupt:
+        pass
+    print("%d requests, %d answered, %d not answered, %d broken frames, pumps %s" % (
+        slave.requests, slave.answered, slave.dropped, slave.bad, slave.nodes.pumps))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""
+Response time analysis for the gardening system task table.
+
+Reads tools/tasks.json, assigns rate monotonic priorities (shortest period
+highest) to the FreeRTOS priority levels, computes worst-case response times
+with priority inheritance blocking and writes include/TaskConfig.h, including
+the priority ceiling of every mutex (highest priority of the tasks using it).
+With --ceiling blocking is computed for the immediate priority ceiling protocol,
+which the firmware uses when built with -D MUTEX_PRIORITY_CEILING.
+
+Execution times in tasks.json can be replaced by measured ones: capture the
+output of the 's' command from the serial monitor and pass it with --stats.
+The maximum execution time of every periodic task found there is used.
+
+Usage:
+  python3 tools/rta.py [--table tools/tasks.json] [--stats serial.log] [--ceiling] [--check]
+"""
+
+import argparse
+import json
+import math
+import os
+import re
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# "Soil: releases 10, misses 0, overruns 0, lateness 0/15ms, exec 120/340us"
+STATS_LINE = re.compile(r"^(\w+): releases \d+, .*exec \d+/(\d+)us")
+
+
+def load_stats(path):
+    """Returns max execution time in ms per stats name."""
+    wcet = {}
+    with open(path) as f:
+        for line in f:
+            m = STATS_LINE.match(line.strip())
+            if m:
+                ms = int(m.group(2)) / 1000.0
+                wcet[m.group(1)] = max(ms, wcet.get(m.group(1), 0.0))
+    return wcet
+
+
+def assign_priorities(tasks, levels):
+    """
+    Rate monotonic: shorter period, higher priority. Priority 0 is shared with
+    the idle task and is left for tasks without a period. When there are more
+    distinct periods than levels, the longest periods share the lowest level.
+    """
+    periods = sorted({t["period_ms"] for t in tasks if t["period_ms"]})
+    usable = levels - 1
+    prio = {}
+    for t in tasks:
+        if not t["period_ms"]:
+            prio[t["name"]] = 0
+            continue
+        rank = periods.index(t["period_ms"])
+        prio[t["name"]] = max(1, usable - rank)
+    return prio
+
+
+def ceilings(tasks, prio):
+    """Highest priority of the tasks using each mutex."""
+    mutexes = {m for t in tasks for m in t["critical_sections"]}
+    return {m: max(prio[t["name"]] for t in tasks if m in t["critical_sections"]) for m in sorted(mutexes)}
+
+
+def blocking(task, tasks, prio, ceiling_protocol=False):
+    """
+    Priority inheritance bound: for every mutex whose ceiling is at least the
+    priority of the task, the longest critical section of a lower priority task.
+    Immediate priority ceiling: only one such critical section, the longest.
+    """
+    p = prio[task["name"]]
+    sections = []
+    for m, ceiling in ceilings(tasks, prio).items():
+        if ceiling < p:
+            continue
+        lower = [t["critical_sections"][m] for t in tasks
+                 if m in t["critical_sections"] and prio[t["name"]] < p and t is not task]
+        if lower:
+            sections.append(max(lower))
+    if not sections:
+        return 0.0
+    return max(sections) if ceiling_protocol else sum(sections)
+
+
+def response_time(task, tasks, prio, tick_ms, ceiling_protocol=False):
+    """
+    R = C + B + sum over higher or equal priority tasks of ceil(R / Tj) * Cj.
+    Equal priorities are counted as interference since FreeRTOS time slices them.
+    A release can be seen up to one tick late, that is added as jitter.
+    """
+    c = task["wcet_ms"]
+    b = blocking(task, tasks, prio, ceiling_protocol)
+    hp = [t for t in tasks if t is not task and t["period_ms"]
+          and prio[t["name"]] >= prio[task["name"]]]
+    r = c + b
+    while True:
+        nxt = c + b + sum(math.ceil((r + tick_ms) / t["period_ms"]) * t["wcet_ms"] for t in hp)
+        if nxt == r or nxt > 100 * task["period_ms"]:
+            return nxt, b
+        r = nxt
+
+
+def write_header(path, tasks, prio, table):
+    lines = [
+        "#ifndef TASK_CONFIG_H",
+        "#define TASK_CONFIG_H",
+        "",
+        "/*",
+        "Generated by tools/rta.py from %s, do not edit." % table,
+        "Priorities are rate monotonic, periods in ms, mutex ceilings are the highest priority of their users.",
+        "*/",
+        "",
+    ]
+    for t in tasks:
+        macro = re.sub(r"(?<!^)(?=[A-Z])", "_", t["name"]).upper()
+        lines.append("#define TASK_PRIO_%s %d" % (macro, prio[t["name"]]))
+        if t["period_ms"]:
+            lines.append("#define TASK_PERIOD_%s %d" % (macro, t["period_ms"]))
+    for m, ceiling in ceilings(tasks, prio).items():
+        # xSerialSemaphore -> TASK_CEILING_SERIAL_SEMAPHORE
+        macro = re.sub(r"(?<!^)(?=[A-Z])", "_", re.sub(r"^x(?=[A-Z])", "", m)).upper()
+        lines.append("#define TASK_CEILING_%s %d" % (macro, ceiling))
+    lines += ["", "#endif", ""]
+    with open(path, "w") as f:
+        f.write("\n".join(lines))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--table", default=os.path.join(ROOT, "tools", "tasks.json"))
+    parser.add_argument("--stats", help="serial log with the output of the 's' command")
+    parser.add_argument("--ceiling", action="store_true", help="blocking under the immediate priority ceiling protocol")
+    parser.add_argument("--check", action="store_true", help="exit with 1 if a deadline can be missed")
+    args = parser.parse_args()
+
+    with open(args.table) as f:
+        config = json.load(f)
+    tasks = config["tasks"]
+    tick_ms = config["tick_ms"]
+
+    if args.stats:
+        measured = load_stats(args.stats)
+        for t in tasks:
+            name = t.get("stats_name")
+            if name in measured:
+                t["wcet_ms"] = measured[name]
+
+    prio = assign_priorities(tasks, config["priority_levels"])
+
+    print("%-16s %5s %8s %8s %8s %8s  %s" % ("task", "prio", "T ms", "C ms", "B ms", "R ms", "result"))
+    failed = False
+    for t in sorted(tasks, key=lambda t: -prio[t["name"]]):
+        if not t["period_ms"]:
+            print("%-16s %5d %8s %8s %8s %8s  %s" % (t["name"], prio[t["name"]], "-", "-", "-", "-", "background"))
+            continue
+        r, b = response_time(t, tasks, prio, tick_ms, args.ceiling)
+        ok = r <= t["period_ms"]
+        failed |= not ok
+        print("%-16s %5d %8d %8.1f %8.1f %8.1f  %s" % (
+            t["name"], prio[t["name"]], t["period_ms"], t["wcet_ms"], b, r, "ok" if ok else "DEADLINE MISS"))
+
+    utilisation = sum(t["wcet_ms"] / t["period_ms"] for t in tasks if t["period_ms"])
+    print("utilisation %.1f%%" % (100 * utilisation))
+
+    header = os.path.join(ROOT, config["header"])
+    write_header(header, tasks, prio, os.path.relpath(args.table, ROOT))
+    print("wrote %s" % os.path.relpath(header, ROOT))
+
+    if args.check and failed:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
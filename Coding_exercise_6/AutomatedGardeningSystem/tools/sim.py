@@ -0,0 +1,276 @@
+#!/usr/bin/env python3
+"""
+Runs the sim build of the gardening system in simavr and checks it against a golden run.
+
+The sim environment seeds random() (SIM_RANDOM_SEED) and stops itself after SIM_DAYS
+simulated days, 504 s of simulated time for a week at 3 s per simulated hour.
+
+The firmware runs in virtual time in tools/sim_run of the repository (../../tools/sim_run.c):
+the idle task sleeps whenever every task is blocked, and sim_run skips the cycles asleep
+instead of waiting for them like the simavr command line does, which would take the
+whole 504 s. The run takes the wall-clock time of the cycles the CPU executes.
+--realtime keeps the simavr sleeping. simavr is cycle accurate, so the same firmware and
+seed print the same bytes on every run, in either mode: the SHA-256 of the serial output
+is compared with tools/sim_golden.sha256 to catch behaviour changes. A run without the
+golden file fails.
+
+With --compare the sim_fixed environment, which reads every soil sensor on every
+100 ms tick instead of using the adaptive sampler, is run as well and the scans per
+simulated day and the detection lag of both are printed side by side.
+
+With --i2c the sim_i2c environment, which reads the sensors over the TWI driver
+(TwiBus.h), is run as well in tools/twi_sim, simavr with I2C slave models of the
+sensors. Its I2C line gives the bus time and the CPU time of a sensor scan, a blocking
+Wire read keeps the CPU busy for the whole bus time. twi_sim runs in virtual time too.
+
+With --modbus the sim_modbus environment, which reads the sensors and switches the
+pumps over the Modbus master (ModbusMaster.h), runs for a simulated day in
+tools/modbus_sim, simavr with USART1 on a pty, against tools/modbus_slave.py on that
+pty. The Modbus line and the node lines the firmware prints at the end are shown,
+with the counts of the slaves. The slaves answer in wall-clock time, so this run is
+not in virtual time and takes the 72 s of the simulated day. The run fails if the
+firmware printed no Modbus line or cancelled a batch.
+
+With --soak the sim_soak environment runs a simulated month of the String-heavy
+report, print and pump paths and prints the heap and the pools (PoolAllocator.h) once a
+simulated day. The run fails if an allocation failed, if the fragmentation of the last
+day is above SOAK_MAX_FRAGMENTATION or if the free heap of the last day is below the
+lowest of the first week, which is a leak or creeping fragmentation.
+
+The month also crosses the wrap of the 16-bit kernel tick count (65536 ticks, about 16
+minutes) twice. The soil tick of the sampler and the soil model is printed every day
+as well and must grow by the same number of ticks every simulated day, across the
+wraps.
+
+The wait and hold histograms of the mutexes (ProfiledMutex.h) at the end of the run
+are printed as well.
+
+Usage:
+  python3 tools/sim.py [--no-build] [--realtime] [--update-golden] [--output sim_output.txt] [--compare] [--i2c]
+  python3 tools/sim.py --modbus [--no-build] [--modbus-reply-ms 1]
+  python3 tools/sim.py --soak [--no-build]
+"""
+
+import argparse
+import collections
+import hashlib
+import os
+import re
+import signal
+import subprocess
+import sys
+import threading
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+GOLDEN = os.path.join(ROOT, "tools", "sim_golden.sha256")
+SIM_RUN = os.path.join(ROOT, "..", "..", "tools", "sim_run")
+PLATFORMIO_INI = os.path.join(ROOT, "platformio.ini")
+
+# "Sampler: scans 3864, reads 5607, detections 79, lag 6/16min, intervals 1 16 4 2 8"
+# "Watering: requests 90, merged 7, started 83, completed 83, wait 12/45ms, queued 0/3, running 0/2"
+WATERING_LINE = re.compile(r"^Watering: requests (\d+), merged (\d+), started \d+, completed (\d+), wait (\d+)/(\d+)ms", re.M)
+MODBUS_LINE = re.compile(r"^Modbus: batches (\d+), requests (\d+), gaps (\d+), overruns (\d+), cancelled (\d+), "
+                         r"scans (\d+), (\d+) zones/s", re.M)
+MODBUS_PTY_LINE = re.compile(r"^modbus_sim: USART1 on (\S+)", re.M)
+I2C_LINE = re.compile(r"^I2C: .*scans (\d+), bus (\d+)us, cpu (\d+)us per scan", re.M)
+# "Heap: free 5210B, largest 4980B, fragmentation 4%, blocks 12, failed 0"
+HEAP_LINE = re.compile(r"^Heap: free (\d+)B, largest (\d+)B, fragmentation (\d+)%, blocks (\d+), failed (\d+)", re.M)
+SOAK_DAY_LINE = re.compile(r"^Soak day (\d+), soil tick (\d+)", re.M)
+SOAK_MAX_FRAGMENTATION = 25
+SOAK_WARMUP_DAYS = 7
+SAMPLER_LINE = re.compile(r"^Sampler: scans (\d+), reads (\d+), detections (\d+), lag (\d+)/(\d+)min", re.M)
+
+
+def elf(env):
+    return os.path.join(ROOT, ".pio", "build", env, "firmware.elf")
+
+
+def sim_days():
+    with open(PLATFORMIO_INI) as f:
+        return int(re.search(r"SIM_DAYS=(\d+)", f.read()).group(1))
+
+
+def run(env, args, simulator=None):
+    """Builds and runs one environment, returns the serial output and the wall-clock time."""
+    if not args.no_build:
+        subprocess.run(["pio", "run", "-d", ROOT, "-e", env], check=True)
+    start = time.time()
+    realtime = ["--realtime"] if args.realtime else []
+    out = subprocess.run((simulator or args.simulator).split() + realtime + [elf(env)], stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                         universal_newlines=True, timeout=args.timeout).stdout
+    if "SIM done" not in out:
+        sys.exit("simulation of %s did not reach SIM_DAYS" % env)
+    return out, time.time() - start
+
+
+def print_sampler(name, out, days):
+    m = SAMPLER_LINE.search(out)
+    if not m:
+        print("%-12s no Sampler line" % name)
+        return
+    scans, reads, detections, lag_avg, lag_max = (int(g) for g in m.groups())
+    print("%-12s %8.0f scans/day %8.0f reads/day %5d detections, lag avg %d max %d simulated min" % (
+        name, scans / days, reads / days, detections, lag_avg, lag_max))
+
+
+def modbus(args):
+    """Runs sim_modbus in modbus_sim with modbus_slave.py on its USART1 and prints what the firmware measured."""
+    if not args.no_build:
+        subprocess.run(["pio", "run", "-d", ROOT, "-e", "sim_modbus"], check=True)
+    sim = subprocess.Popen([args.modbus_simulator, "--wait", elf("sim_modbus")], stdin=subprocess.PIPE,
+                           stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    # The whole run is bounded, not only the wait for the end of the output
+    timer = threading.Timer(args.timeout, sim.kill)
+    timer.start()
+    out = ""
+    path = None
+    while path is None:
+        line = sim.stdout.readline()
+        if not line:
+            timer.cancel()
+            sys.exit("modbus_sim exited before it opened the pty:\n" + out)
+        out += line
+        m = MODBUS_PTY_LINE.match(line)
+        if m:
+            path = m.group(1)
+    slave = subprocess.Popen([sys.executable, os.path.join(ROOT, "tools", "modbus_slave.py"), "--port", path,
+                              "--reply-ms", str(args.modbus_reply_ms)],
+                             stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    # Give the slaves time to open the pty before the firmware sends its first request
+    time.sleep(1.0)
+    sim.stdin.write("\n")
+    sim.stdin.close()
+    start = time.time()
+    out += sim.stdout.read()
+    sim.wait()
+    timer.cancel()
+    wall = time.time() - start
+    slave.send_signal(signal.SIGINT)
+    slave_out = slave.communicate(timeout=10)[0]
+    with open(args.output, "w") as f:
+        f.write(out)
+
+    if "SIM done" not in out:
+        sys.exit("simulation of sim_modbus did not reach SIM_DAYS (exit %d)" % sim.returncode)
+    m = MODBUS_LINE.search(out)
+    if not m:
+        sys.exit("sim_modbus: no Modbus line")
+    print("wall-clock %.1f s" % wall)
+    for line in re.findall(r"^(?:Modbus|  Node).*$", out, re.M):
+        print(line)
+    for line in slave_out.splitlines()[-1:]:
+        print("slaves: " + line)
+    cancelled = int(m.group(5))
+    if cancelled:
+        sys.exit("sim_modbus: %d batches cancelled" % cancelled)
+
+
+def soak(args):
+    """Runs sim_soak and fails if the heap did not stay bounded over the month."""
+    out, wall = run("sim_soak", args)
+    lines = SOAK_DAY_LINE.findall(out)
+    days = [int(d) for d, _ in lines]
+    soil_ticks = [int(t) for _, t in lines]
+    heaps = [tuple(int(g) for g in m) for m in HEAP_LINE.findall(out)]
+    if not heaps or len(days) != len(heaps):
+        sys.exit("sim_soak: expected one Heap line per Soak day line")
+    for line in re.findall(r"^Pool .*$", out, re.M)[-4:]:
+        print(line)
+    print("wall-clock %.1f s, %d simulated days" % (wall, days[-1]))
+    print("day  free  largest  fragmentation  blocks  soil tick")
+    for day, soil_tick, (free, largest, fragmentation, blocks, _) in zip(days, soil_ticks, heaps):
+        print("%3d  %4d  %7d  %12d%%  %6d  %9d" % (day, free, largest, fragmentation, blocks, soil_tick))
+    free, _, fragmentation, _, failures = heaps[-1]
+    warmup = [heap[0] for day, heap in zip(days, heaps) if day <= SOAK_WARMUP_DAYS]
+    errors = []
+    if failures:
+        errors.append("%d allocations failed" % failures)
+    if fragmentation > SOAK_MAX_FRAGMENTATION:
+        errors.append("fragmentation %d%% above %d%%" % (fragmentation, SOAK_MAX_FRAGMENTATION))
+    if warmup and free < min(warmup):
+        errors.append("free heap %dB below the %dB of the first %d days" % (free, min(warmup), SOAK_WARMUP_DAYS))
+    steps = [b - a for a, b in zip(soil_ticks, soil_ticks[1:])]
+    if steps and max(steps) - min(steps) > 1:
+        errors.append("soil ticks per day range from %d to %d, the soil tick jumped" % (min(steps), max(steps)))
+    if errors:
+        sys.exit("soak: " + ", ".join(errors))
+    print("heap stayed bounded")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--no-build", action="store_true")
+    parser.add_argument("--simulator", default=SIM_RUN, help="built from ../../tools/sim_run.c")
+    parser.add_argument("--realtime", action="store_true", help="sleep like simavr, a week takes 504 s")
+    parser.add_argument("--timeout", type=int, default=1800, help="wall-clock seconds")
+    parser.add_argument("--output", default=os.path.join(ROOT, "sim_output.txt"))
+    parser.add_argument("--update-golden", action="store_true")
+    parser.add_argument("--compare", action="store_true", help="also run sim_fixed, the fixed 100 ms sampling")
+    parser.add_argument("--i2c", action="store_true", help="also run sim_i2c, the sensors on the TWI driver")
+    parser.add_argument("--soak", action="store_true", help="only run sim_soak, a simulated month of allocations")
+    parser.add_argument("--twi-simulator", default=os.path.join(ROOT, "tools", "twi_sim"))
+    parser.add_argument("--modbus", action="store_true", help="only run sim_modbus against tools/modbus_slave.py")
+    parser.add_argument("--modbus-simulator", default=os.path.join(ROOT, "tools", "modbus_sim"))
+    parser.add_argument("--modbus-reply-ms", type=float, default=1.0, help="--reply-ms of the slaves")
+    args = parser.parse_args()
+
+    if args.soak:
+        soak(args)
+        return
+    if args.modbus:
+        modbus(args)
+        return
+
+    out, wall = run("sim", args)
+    with open(args.output, "w") as f:
+        f.write(out)
+
+    pumps = collections.Counter(re.findall(r"Pump_(\d) Start", out))
+    scans = out.count("Reading Sensors Done")
+    print("wall-clock %.1f s, %d sensor scans" % (wall, scans))
+    boot = re.search(r"^Boot:.*$", out, re.M)
+    if boot:
+        print(boot.group(0))
+    for pump in sorted(pumps):
+        print("pump %s started %d times" % (pump, pumps[pump]))
+    days = sim_days()
+    watering = WATERING_LINE.search(out)
+    if watering:
+        requests, merged, completed, wait_avg, wait_max = (int(g) for g in watering.groups())
+        print("watering: %.1f jobs/simulated day, %d of %d requests merged, queue wait avg %d max %d ms" % (
+            completed / days, merged, requests, wait_avg, wait_max))
+    for line in re.findall(r"^(?:Mutex|Supervisor).*$", out, re.M):
+        print(line)
+    print_sampler("adaptive", out, days)
+    if args.compare:
+        fixed, _ = run("sim_fixed", args)
+        print_sampler("fixed 100ms", fixed, days)
+    if args.i2c:
+        i2c, _ = run("sim_i2c", args, args.twi_simulator)
+        m = I2C_LINE.search(i2c)
+        if not m:
+            print("sim_i2c: no I2C line")
+        else:
+            scans, bus_us, cpu_us = (int(g) for g in m.groups())
+            print("i2c: %d soil scans, per scan %d us on the bus, %d us of CPU (blocking Wire: %d us)" % (
+                scans, bus_us, cpu_us, bus_us))
+
+    digest = hashlib.sha256(out.encode()).hexdigest()
+    if args.update_golden:
+        with open(GOLDEN, "w") as f:
+            f.write(digest + "\n")
+        print("wrote %s" % os.path.relpath(GOLDEN, ROOT))
+        return
+    if not os.path.exists(GOLDEN):
+        # Nothing to compare with is not a pass, like tools/bench.py without a baseline
+        sys.exit("no tools/sim_golden.sha256, run with --update-golden on a known good tree and commit it")
+    with open(GOLDEN) as f:
+        golden = f.read().strip()
+    if digest != golden:
+        sys.exit("output differs from the golden run (%s)" % digest)
+    print("output matches the golden run")
+
+
+if __name__ == "__main__":
+    main()
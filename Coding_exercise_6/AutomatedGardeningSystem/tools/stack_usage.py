@@ -0,0 +1,326 @@
+#!/usr/bin/env python3
+"""
+Static stack usage analysis for the gardening system tasks.
+
+Combines the per-function frame sizes written by -fstack-usage (*.su files)
+with the call graph read from the disassembly of firmware.elf, and computes
+the worst-case stack depth from every task entry function, plus the saved
+task context, the deepest interrupt handler and a safety margin.
+
+include/TaskStacks.h is committed and only written by a standalone run with
+--write. It takes the largest size of every task over all the environments
+built in .pio/build, so build each of them first:
+  pio run -e megaatmega2560 -e bench -e sim -e sim_fixed -e sim_i2c -e sim_soak -e modbus -e sim_modbus
+  python3 tools/stack_usage.py --write
+
+After every link the PlatformIO extra script (see platformio.ini) checks the
+header against the build: the build fails if a task needs a larger stack than
+the header gives it, since the image was compiled with the stale size.
+Standalone without --write it checks one build:
+  python3 tools/stack_usage.py [--build-dir .pio/build/megaatmega2560]
+
+Both also check the SRAM budget of the build: .data, .bss and .noinit from avr-size,
+plus every task stack from the header (WATERING_MAX_PUMPS pump tasks at once), the idle
+and timer task stacks of FreeRTOSConfig.h and a TCB and malloc header per task, must
+leave SRAM_RESERVE_BYTES of the 8 KB for queues, timers, String buffers and the stack
+of setup. The stacks come from the heap (heap_3), so avr-size alone does not show them.
+
+Indirect calls (function pointers, virtual Print::write) can't be followed
+in the disassembly; the callees of the task runner are listed in TASKS and
+every other indirect call is charged INDIRECT_CALL_BYTES.
+"""
+
+import argparse
+import glob
+import os
+import re
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+HEADER = os.path.join(ROOT, "include", "TaskStacks.h")
+
+# Task name: (entry function, functions it calls through a pointer)
+TASKS = {
+    "MAIN_EVENT": ("MainEventTask", []),
+    "WATER_CONTROL": ("WaterControlTask", []),
+    "USER_INPUT": ("UserInputTask", []),
+    "PUMP": ("pumpTask", []),
+    "SOIL_MOISTURE": ("PeriodicTaskRunner", ["SoilMoistureSetup", "SoilMoistureTask"]),
+    "LIGHT_MANAGEMENT": ("PeriodicTaskRunner", ["LightManagementSetup", "LightManagementTask"]),
+    "REPORT": ("PeriodicTaskRunner", ["ReportTask"]),
+    "TIME_INCREMENT": ("PeriodicTaskRunner", ["timeIncrementTask"]),
+}
+
+# Maximum recursion depth of recursive functions, e.g. {"walk": 3}. None at the moment,
+# any recursion found is reported as unbounded
+RECURSION_DEPTH = {}
+
+# Registers, SREG, RAMPZ, EIND, 3 byte return address and critical nesting saved by portSAVE_CONTEXT
+CONTEXT_BYTES = 38
+# Charged for an indirect call that is not listed in TASKS, e.g. Print::write through the vtable
+INDIRECT_CALL_BYTES = 48
+MARGIN_PERCENT = 25
+MARGIN_MIN_BYTES = 32
+
+# Internal SRAM of the ATmega2560
+SRAM_BYTES = 8192
+# TCB of a task (feilipu port, 8 character names) and the size word malloc keeps per block
+TCB_BYTES = 40
+MALLOC_HEADER_BYTES = 2
+# Left for queues, semaphores, timers, String buffers and the stack of setup
+SRAM_RESERVE_BYTES = 512
+
+FUNC_START = re.compile(r"^[0-9a-f]+ <(.+)>:$")
+CALL = re.compile(r"\t(?:call|rcall|jmp|rjmp)\t.*; 0x[0-9a-f]+ <([^>+]+)>")
+ICALL = re.compile(r"\t(?:icall|eicall|ijmp|eijmp)\b")
+
+
+def bare_name(signature):
+    """'void Foo::bar(int)' and 'Foo::bar(int)' -> 'Foo::bar'."""
+    head = signature.split("(")[0].strip()
+    return head.split(" ")[-1]
+
+
+def read_frames(build_dir):
+    """Frame size per function from every .su file, overloads share the largest."""
+    frames = {}
+    dynamic = set()
+    for path, _, files in os.walk(build_dir):
+        for name in files:
+            if not name.endswith(".su"):
+                continue
+            with open(os.path.join(path, name)) as f:
+                for line in f:
+                    parts = line.rstrip("\n").split("\t")
+                    if len(parts) != 3:
+                        continue
+                    func = bare_name(parts[0].split(":", 3)[-1])
+                    frames[func] = max(frames.get(func, 0), int(parts[1]))
+                    if "dynamic" in parts[2]:
+                        dynamic.add(func)
+    return frames, dynamic
+
+
+def read_call_graph(elf, objdump):
+    """Direct callees and indirect call flag per function from the disassembly."""
+    out = subprocess.run([objdump, "-d", "-C", elf], check=True, stdout=subprocess.PIPE,
+                         universal_newlines=True).stdout
+    calls, indirect = {}, set()
+    current = None
+    for line in out.splitlines():
+        m = FUNC_START.match(line)
+        if m:
+            current = bare_name(m.group(1))
+            calls.setdefault(current, set())
+            continue
+        if current is None:
+            continue
+        m = CALL.search(line)
+        if m:
+            callee = bare_name(m.group(1))
+            if callee != current or current in RECURSION_DEPTH:
+                calls[current].add(callee)
+        elif ICALL.search(line):
+            indirect.add(current)
+    return calls, indirect
+
+
+class Analyser:
+    def __init__(self, frames, calls, indirect):
+        self.frames, self.calls, self.indirect = frames, calls, indirect
+        self.memo, self.active, self.warnings = {}, set(), []
+
+    def depth(self, func):
+        """Worst-case stack bytes used by func and everything it calls."""
+        if func in self.memo:
+            return self.memo[func]
+        if func in self.active:
+            if func not in RECURSION_DEPTH:
+                self.warnings.append("unbounded recursion through %s" % func)
+            return 0
+        self.active.add(func)
+        frame = self.frames.get(func, 0)
+        deepest = INDIRECT_CALL_BYTES if func in self.indirect else 0
+        for callee in self.calls.get(func, ()):
+            if callee != func:
+                deepest = max(deepest, self.depth(callee))
+        self.active.discard(func)
+        # Each recursion level adds the frame and the 3 byte return address
+        levels = RECURSION_DEPTH.get(func, 1)
+        self.memo[func] = frame + deepest + (levels - 1) * (frame + 3)
+        return self.memo[func]
+
+
+def stack_size(used):
+    margin = max(used * MARGIN_PERCENT // 100, MARGIN_MIN_BYTES)
+    return (used + margin + 7) // 8 * 8
+
+
+def analyse(build_dir, elf, objdump):
+    frames, dynamic = read_frames(build_dir)
+    if not frames:
+        sys.exit("stack_usage: no .su files in %s, is -fstack-usage in build_flags?" % build_dir)
+    calls, indirect = read_call_graph(elf, objdump)
+    analyser = Analyser(frames, calls, indirect)
+
+    isr = max([analyser.depth(f) for f in calls if f.startswith("__vector_")] or [0])
+    sizes = {}
+    print("stack_usage: task used +context +isr(%d) -> stack" % isr)
+    for task, (entry, pointed) in TASKS.items():
+        used = analyser.depth(entry) + max([analyser.depth(f) for f in pointed] or [0])
+        sizes[task] = stack_size(used + CONTEXT_BYTES + isr)
+        print("stack_usage: %-16s %5d -> %5d" % (task, used, sizes[task]))
+    for func in sorted(dynamic):
+        analyser.warnings.append("dynamic stack allocation in %s" % func)
+    for warning in analyser.warnings:
+        print("stack_usage: warning: %s" % warning)
+    return sizes
+
+
+def write_header(sizes, envs):
+    lines = [
+        "#ifndef TASK_STACKS_H",
+        "#define TASK_STACKS_H",
+        "",
+        "/*",
+        "Generated by tools/stack_usage.py --write, do not edit. Builds fail when a size is stale.",
+        "Stack sizes in bytes: worst-case call graph depth from -fstack-usage, saved context,",
+        "deepest interrupt handler and a %d%% margin, the largest of the environments" % MARGIN_PERCENT,
+        "%s." % ", ".join(envs),
+        "*/",
+        "",
+    ]
+    lines += ["#define TASK_STACK_%s %d" % (task, size) for task, size in sorted(sizes.items())]
+    lines += ["", "#endif", ""]
+    with open(HEADER, "w") as f:
+        f.write("\n".join(lines))
+    print("stack_usage: include/TaskStacks.h written, build again to apply the new sizes")
+
+
+def read_header():
+    """Sizes in the committed header."""
+    sizes = {}
+    with open(HEADER) as f:
+        for line in f:
+            m = re.match(r"#define TASK_STACK_(\w+) (\d+)", line)
+            if m:
+                sizes[m.group(1)] = int(m.group(2))
+    return sizes
+
+
+def check_header(sizes):
+    """Stale entries of the header, tasks given less than this build needs."""
+    header = read_header()
+    stale = []
+    for task, size in sorted(sizes.items()):
+        if header.get(task, 0) < size:
+            stale.append("TASK_STACK_%s is %d, the build needs %d" % (task, header.get(task, 0), size))
+    return stale
+
+
+def read_define(path, name):
+    with open(path) as f:
+        m = re.search(r"#define\s+%s\s+\(?\s*(\d+)" % name, f.read())
+    if m is None:
+        sys.exit("stack_usage: no %s in %s" % (name, path))
+    return int(m.group(1))
+
+
+def kernel_stacks():
+    """Stack bytes of the idle and timer tasks, from the FreeRTOSConfig.h of the installed library."""
+    configs = glob.glob(os.path.join(ROOT, ".pio", "libdeps", "*", "FreeRTOS*", "src", "FreeRTOSConfig.h"))
+    if not configs:
+        sys.exit("stack_usage: no FreeRTOSConfig.h in .pio/libdeps, build first")
+    # StackType_t is a byte on the AVR port, depths are bytes
+    return read_define(configs[0], "configMINIMAL_STACK_SIZE") + read_define(configs[0], "configTIMER_TASK_STACK_DEPTH")
+
+
+def section_sizes(elf, avr_size):
+    """Size of every section of the image, from avr-size -A."""
+    out = subprocess.run([avr_size, "-A", elf], check=True, stdout=subprocess.PIPE,
+                         universal_newlines=True).stdout
+    sizes = {}
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 3 and parts[0].startswith(".") and parts[1].isdigit():
+            sizes[parts[0]] = int(parts[1])
+    return sizes
+
+
+def check_sram(elf, avr_size):
+    """Prints the SRAM budget of the build, returns the shortfall, 0 when it fits."""
+    sections = section_sizes(elf, avr_size)
+    static = sum(sections.get(name, 0) for name in (".data", ".bss", ".noinit"))
+    header = read_header()
+    pumps = read_define(os.path.join(ROOT, "include", "WateringQueue.h"), "WATERING_MAX_PUMPS")
+    stacks = sum(header.values()) + (pumps - 1) * header.get("PUMP", 0) + kernel_stacks()
+    tasks = len(header) + (pumps - 1) + 2
+    overhead = tasks * (TCB_BYTES + 2 * MALLOC_HEADER_BYTES)
+    free = SRAM_BYTES - static - stacks - overhead
+    print("stack_usage: sram: data %d + bss %d + noinit %d, %d tasks: stacks %d + tcbs %d, free %d of %d "
+          "(reserve %d)" % (sections.get(".data", 0), sections.get(".bss", 0), sections.get(".noinit", 0),
+                            tasks, stacks, overhead, free, SRAM_BYTES, SRAM_RESERVE_BYTES))
+    return max(SRAM_RESERVE_BYTES - free, 0)
+
+
+def post_build(source, target, env):
+    objdump = os.path.join(os.path.dirname(env.subst("$CC")), "avr-objdump")
+    avr_size = os.path.join(os.path.dirname(env.subst("$CC")), "avr-size")
+    os.environ["PATH"] = env["ENV"]["PATH"]
+    stale = check_header(analyse(env.subst("$BUILD_DIR"), str(target[0]), objdump))
+    for line in stale:
+        print("stack_usage: error: %s" % line)
+    if stale:
+        print("stack_usage: error: include/TaskStacks.h is stale, run python3 tools/stack_usage.py --write")
+        env.Exit(1)
+    short = check_sram(str(target[0]), avr_size)
+    if short:
+        print("stack_usage: error: SRAM over budget by %d bytes" % short)
+        env.Exit(1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--build-dir", default=os.path.join(ROOT, ".pio", "build", "megaatmega2560"),
+                        help="build to check, without --write")
+    parser.add_argument("--objdump", default="avr-objdump")
+    parser.add_argument("--size", default="avr-size")
+    parser.add_argument("--write", action="store_true", help="size the stacks over every build in .pio/build")
+    args = parser.parse_args()
+    if not args.write:
+        elf = os.path.join(args.build_dir, "firmware.elf")
+        stale = check_header(analyse(args.build_dir, elf, args.objdump))
+        for line in stale:
+            print("stack_usage: error: %s" % line)
+        short = check_sram(elf, args.size)
+        if short:
+            print("stack_usage: error: SRAM over budget by %d bytes" % short)
+        return 1 if stale or short else 0
+
+    builds = os.path.join(ROOT, ".pio", "build")
+    envs = sorted(e for e in os.listdir(builds) if os.path.exists(os.path.join(builds, e, "firmware.elf")))
+    if not envs:
+        sys.exit("stack_usage: no firmware.elf in %s, build the environments first" % builds)
+    sizes = {}
+    for name in envs:
+        print("stack_usage: environment %s" % name)
+        for task, size in analyse(os.path.join(builds, name), os.path.join(builds, name, "firmware.elf"),
+                                  args.objdump).items():
+            sizes[task] = max(sizes.get(task, 0), size)
+    write_header(sizes, envs)
+    short = 0
+    for name in envs:
+        print("stack_usage: environment %s" % name)
+        short = max(short, check_sram(os.path.join(builds, name, "firmware.elf"), args.size))
+    if short:
+        print("stack_usage: error: SRAM over budget by %d bytes with the new sizes" % short)
+    return 1 if short else 0
+
+
+try:
+    Import("env")  # noqa: F821, only defined when run by PlatformIO
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", post_build)  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main())
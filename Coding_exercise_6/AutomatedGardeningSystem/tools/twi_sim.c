@@ -0,0 +1,199 @@
+/*
+Runs a build of the gardening system in simavr with its I2C sensors on the TWI bus.
+
+simavr has no I2C devices of its own, this attaches slave models to the TWI of the
+ATmega2560 and otherwise runs the firmware like tools/sim_run.c of the repository,
+in virtual time unless --realtime is given:
+
+  0x30 + zone  soil moisture sensor, register 0x00 is the reading in mV, 16 bit big
+               endian. Every zone dries from 250 mV to 500 mV along a sawtooth of its
+               own period and reads with +-4 mV of noise.
+  0x23         BH1750 light sensor, answers after the continuous mode command 0x10
+               with 1.2 counts per lx: daylight from 0 to 100 lx and back over a
+               minute of simulated time, plus up to 100 lx from the LEDs, read from
+               the Timer1 PWM duty (OCR1A, OCR1B, OCR1C).
+
+Addresses without a model are not acknowledged. The transactions, bytes and
+unacknowledged addresses are counted and printed on stderr at the end of the run.
+
+Build (simavr and libelf development files):
+  cc -O2 -o tools/twi_sim tools/twi_sim.c $(pkg-config --cflags --libs simavr) -lelf
+Usage:
+  tools/twi_sim [--realtime] .pio/build/sim_i2c/firmware.elf
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_twi.h"
+
+#define F_CPU 16000000UL
+#define ZONES 5
+#define MOISTURE_BASE 0x30
+#define MOISTURE_WET_MV 250
+#define MOISTURE_DRY_MV 500
+#define LUX_ADDRESS 0x23
+#define LUX_CONTINUOUS_HIGH_RES 0x10
+#define OCR1A_ADDRESS 0x88 // OCR1B and OCR1C follow
+
+static avr_t *avr;
+static avr_irq_t *irq;
+static uint8_t selected;   // Address byte of the selected slave, 0 for none
+static uint8_t pointer;    // Register written last
+static uint8_t readIndex;  // Byte of the current read
+static uint16_t readValue; // Latched at the first byte of a read
+static int luxOn = 0;
+static uint32_t noise = 1;
+static unsigned long transactions, bytesRead, nacks;
+
+static double seconds(void)
+{
+  return (double)avr->cycle / avr->frequency;
+}
+
+static int randomNoise(void)
+{
+  noise = noise * 1103515245 + 12345;
+  return (int)((noise >> 16) % 9) - 4;
+}
+
+static uint16_t moisture(uint8_t zone)
+{
+  double period = 20.0 + 5.0 * zone;
+  double phase = seconds() / period;
+  phase -= (long)phase;
+  return MOISTURE_WET_MV + (uint16_t)((MOISTURE_DRY_MV - MOISTURE_WET_MV) * phase) + randomNoise();
+}
+
+static uint16_t luxCounts(void)
+{
+  double phase = seconds() / 60.0;
+  phase -= (long)phase;
+  double daylight = 100.0 * (phase < 0.5 ? 2 * phase : 2 - 2 * phase);
+  double duty = 0;
+  for (int channel = 0; channel < 3; channel++)
+  {
+    uint16_t ocr = avr->data[OCR1A_ADDRESS + 2 * channel] | (avr->data[OCR1A_ADDRESS + 2 * channel + 1] << 8);
+    duty += ocr / 65535.0;
+  }
+  return (uint16_t)((daylight + duty * 100.0 / 3) * 1.2);
+}
+
+static int present(uint8_t address)
+{
+  return (address >= MOISTURE_BASE && address < MOISTURE_BASE + ZONES) || address == LUX_ADDRESS;
+}
+
+static void twiHook(struct avr_irq_t *source, uint32_t value, void *param)
+{
+  avr_twi_msg_irq_t v;
+  v.u.v = value;
+  if (v.u.twi.msg & TWI_COND_STOP)
+  {
+    selected = 0;
+  }
+  if (v.u.twi.msg & TWI_COND_START)
+  {
+    // Also sent for a repeated start, with the new address byte
+    selected = 0;
+    readIndex = 0;
+    if (present(v.u.twi.addr >> 1))
+    {
+      selected = v.u.twi.addr;
+      transactions++;
+      avr_raise_irq(irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, selected, 1));
+    }
+    else
+    {
+      nacks++;
+    }
+  }
+  if (selected == 0)
+  {
+    return;
+  }
+  uint8_t address = selected >> 1;
+  if (v.u.twi.msg & TWI_COND_WRITE)
+  {
+    avr_raise_irq(irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, selected, 1));
+    pointer = v.u.twi.data;
+    if (address == LUX_ADDRESS && pointer == LUX_CONTINUOUS_HIGH_RES)
+    {
+      luxOn = 1;
+    }
+  }
+  if (v.u.twi.msg & TWI_COND_READ)
+  {
+    if (readIndex == 0)
+    {
+      if (address == LUX_ADDRESS)
+      {
+        readValue = luxOn ? luxCounts() : 0;
+      }
+      else
+      {
+        readValue = pointer == 0 ? moisture(address - MOISTURE_BASE) : 0xFFFF;
+      }
+    }
+    uint8_t data = readIndex++ == 0 ? readValue >> 8 : readValue & 0xFF;
+    bytesRead++;
+    avr_raise_irq(irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_READ, selected, data));
+  }
+}
+
+/// Virtual time, the cycles asleep pass without waiting
+static void skipSleep(avr_t *core, avr_cycle_count_t howLong)
+{
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *names[2] = {"twi.slave.in", "twi.slave.out"};
+  elf_firmware_t firmware = {{0}};
+  int realtime = argc == 3 && strcmp(argv[1], "--realtime") == 0;
+  if (argc != 2 + realtime)
+  {
+    fprintf(stderr, "usage: %s [--realtime] firmware.elf\n", argv[0]);
+    return 2;
+  }
+  const char *path = argv[1 + realtime];
+  if (elf_read_firmware(path, &firmware) != 0)
+  {
+    fprintf(stderr, "twi_sim: can't read %s\n", path);
+    return 1;
+  }
+  if (firmware.frequency == 0)
+  {
+    firmware.frequency = F_CPU;
+  }
+  avr = avr_make_mcu_by_name("atmega2560");
+  if (avr == NULL)
+  {
+    fprintf(stderr, "twi_sim: simavr has no atmega2560\n");
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  if (!realtime)
+  {
+    avr->sleep = skipSleep;
+  }
+
+  irq = avr_alloc_irq(&avr->irq_pool, 0, 2, names);
+  avr_irq_register_notify(irq + TWI_IRQ_OUTPUT, twiHook, NULL);
+  avr_connect_irq(irq + TWI_IRQ_INPUT, avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+  avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT), irq + TWI_IRQ_OUTPUT);
+
+  int state;
+  do
+  {
+    state = avr_run(avr);
+  } while (state != cpu_Done && state != cpu_Crashed);
+
+  fprintf(stderr, "twi_sim: %lu transactions, %lu bytes read, %lu addresses not acknowledged, %.1f s simulated\n",
+          transactions, bytesRead, nacks, seconds());
+  return state == cpu_Crashed;
+}
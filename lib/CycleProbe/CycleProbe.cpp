@@ -0,0 +1,82 @@
+#include "CycleProbe.h"
+#include <stdio.h>
+#include <util/atomic.h>
+#include <avr/sleep.h>
+
+static volatile uint16_t overflows;
+static Probe *probes;
+static void (*printLine)(const char *);
+
+void probeBegin(void (*print)(const char *))
+{
+  printLine = print;
+  // Timer5 normal mode, no prescaler: one count per CPU cycle
+  TCCR5A = 0;
+  TCCR5B = _BV(CS50);
+  TCNT5 = 0;
+  TIFR5 = _BV(TOV5);
+  TIMSK5 = _BV(TOIE5);
+}
+
+uint32_t cycleCount(void)
+{
+  uint16_t high, low;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    low = TCNT5;
+    high = overflows;
+    // Overflow happened after interrupts were disabled and is not counted yet
+    if ((TIFR5 & _BV(TOV5)) && low < 0x8000)
+    {
+      high++;
+    }
+  }
+  return ((uint32_t)high << 16) | low;
+}
+
+void probeRecord(Probe *probe, uint32_t cycles)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (probe->count++ == 0)
+    {
+      probe->next = probes;
+      probes = probe;
+    }
+    probe->sum += cycles;
+    if (cycles < probe->min)
+    {
+      probe->min = cycles;
+    }
+    if (cycles > probe->max)
+    {
+      probe->max = cycles;
+    }
+  }
+}
+
+/// @brief Prints every probe that has measurements.
+static void probeReport(void)
+{
+  char line[80];
+  for (Probe *probe = probes; probe != NULL; probe = probe->next)
+  {
+    snprintf(line, sizeof(line), "BENCH %s %lu %lu %lu %lu\r\n", probe->name, (unsigned long)probe->count,
+             (unsigned long)probe->min, (unsigned long)probe->max, (unsigned long)(probe->sum / probe->count));
+    printLine(line);
+  }
+  printLine("BENCH done\r\n");
+}
+
+ISR(TIMER5_OVF_vect)
+{
+  overflows++;
+  if (overflows >= (uint16_t)((uint64_t)F_CPU * BENCH_SECONDS >> 16))
+  {
+    probeReport();
+    // Sleeping with interrupts disabled ends the simavr run
+    cli();
+    sleep_enable();
+    sleep_cpu();
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef CYCLE_PROBE_H
+#define CYCLE_PROBE_H
+
+#include <Arduino.h>
+
+/*
+Cycle probes for the simavr benchmarks (tools/bench.py)
+
+Only compiled into the bench environment of each project (-D BENCHMARK). Timer5
+counts CPU cycles, its overflow interrupt extends the count to 32 bits. A probe
+keeps count, min, max and sum of the cycles between PROBE_START and PROBE_STOP,
+start and stop may be in different tasks.
+
+After BENCH_SECONDS of run time the overflow interrupt prints one line per probe,
+  BENCH <probe> <count> <min> <max> <mean>
+and stops the CPU with interrupts disabled, which makes simavr exit.
+*/
+
+#ifndef BENCH_SECONDS
+#define BENCH_SECONDS 20
+#endif
+
+struct Probe
+{
+  const char *name;
+  uint32_t start;
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  Probe *next;
+};
+
+#define PROBE(probe) Probe probe = {#probe, 0, 0, 0xFFFFFFFF, 0, 0, NULL}
+#define PROBE_START(probe) (probe).start = cycleCount()
+#define PROBE_STOP(probe) probeRecord(&(probe), cycleCount() - (probe).start)
+
+/// @brief Starts the cycle counter.
+/// @param print Writes a string to the console, called with interrupts disabled.
+void probeBegin(void (*print)(const char *));
+
+/// @brief Cycles since probeBegin.
+uint32_t cycleCount(void);
+
+/// @brief Adds one measurement to a probe.
+/// @param probe The probe.
+/// @param cycles Measured cycles.
+void probeRecord(Probe *probe, uint32_t cycles);
+
+#endif
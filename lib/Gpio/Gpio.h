@@ -0,0 +1,199 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+/*
+Typed GPIO
+
+Pins and pin groups are types, their port and mask are known at compile time, so
+every operation inlines to the instructions a hand-written register access would use:
+
+  typedef Pin<PortB, PB5> Led;
+  Led::output();   // sbi DDRB, 5
+  Led::high();     // sbi PORTB, 5
+  Led::low();      // cbi PORTB, 5
+  Led::toggle();   // out PINB, r (writing a 1 to PINx toggles the pin)
+
+  typedef PinGroup<Led1, Led2, Led3> Leds;
+  Leds::set(Led1::mask | Led2::mask); // All three pins change in one out PORTB
+
+All operations are safe against interrupts and task switches. Single bits on ports
+A to G use sbi/cbi, which can't be interrupted. Ports H to L are outside the sbi range,
+and groups need a read-modify-write. These are done with interrupts disabled, for as
+long as the in, and/or and out take. Toggling writes PINx, which is a single write.
+
+tools/gpio_size_check.py compiles these operations next to the hand-written register
+code and compares the size of the generated code.
+*/
+
+// Accessors of constant register addresses, they inline to the address
+#define GPIO_DEFINE_PORT(letter, sbiRange)                   \
+  struct Port##letter                                        \
+  {                                                          \
+    static constexpr bool bitAccess = sbiRange;              \
+    static volatile uint8_t &port() { return PORT##letter; } \
+    static volatile uint8_t &ddr() { return DDR##letter; }   \
+    static volatile uint8_t &pin() { return PIN##letter; }   \
+  };
+
+#ifdef PORTA
+GPIO_DEFINE_PORT(A, true)
+#endif
+#ifdef PORTB
+GPIO_DEFINE_PORT(B, true)
+#endif
+#ifdef PORTC
+GPIO_DEFINE_PORT(C, true)
+#endif
+#ifdef PORTD
+GPIO_DEFINE_PORT(D, true)
+#endif
+#ifdef PORTE
+GPIO_DEFINE_PORT(E, true)
+#endif
+#ifdef PORTF
+GPIO_DEFINE_PORT(F, true)
+#endif
+#ifdef PORTG
+GPIO_DEFINE_PORT(G, true)
+#endif
+#ifdef PORTH
+GPIO_DEFINE_PORT(H, false)
+#endif
+#ifdef PORTJ
+GPIO_DEFINE_PORT(J, false)
+#endif
+#ifdef PORTK
+GPIO_DEFINE_PORT(K, false)
+#endif
+#ifdef PORTL
+GPIO_DEFINE_PORT(L, false)
+#endif
+
+/// @brief Sets the bits of mask in a register, with sbi when possible.
+template <class Port, uint8_t Mask>
+inline void gpioSet(volatile uint8_t &reg)
+{
+  if (Port::bitAccess && (Mask & (Mask - 1)) == 0)
+  {
+    reg |= Mask;
+  }
+  else
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      reg |= Mask;
+    }
+  }
+}
+
+/// @brief Clears the bits of mask in a register, with cbi when possible.
+template <class Port, uint8_t Mask>
+inline void gpioClear(volatile uint8_t &reg)
+{
+  if (Port::bitAccess && (Mask & (Mask - 1)) == 0)
+  {
+    reg &= (uint8_t)~Mask;
+  }
+  else
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      reg &= (uint8_t)~Mask;
+    }
+  }
+}
+
+template <class Port, uint8_t Mask>
+struct GpioBits
+{
+  typedef Port port_t;
+  static constexpr uint8_t mask = Mask;
+
+  static inline void output() { gpioSet<Port, Mask>(Port::ddr()); }
+  static inline void input() { gpioClear<Port, Mask>(Port::ddr()); }
+  static inline void high() { gpioSet<Port, Mask>(Port::port()); }
+  static inline void low() { gpioClear<Port, Mask>(Port::port()); }
+  static inline void toggle() { Port::pin() = Mask; }
+  /// @brief Levels the pins are driven to, the bits of mask that are set in PORTx.
+  static inline uint8_t driven() { return Port::port() & Mask; }
+  /// @brief Levels on the pins, the bits of mask that are set in PINx.
+  static inline uint8_t read() { return Port::pin() & Mask; }
+};
+
+/// @brief One pin, Bit is the bit number in the port (PB5 etc.).
+template <class Port, uint8_t Bit>
+struct Pin : GpioBits<Port, (1 << Bit)>
+{
+  static constexpr uint8_t bit = Bit;
+
+  static inline void set(bool level)
+  {
+    if (level)
+    {
+      Pin::high();
+    }
+    else
+    {
+      Pin::low();
+    }
+  }
+};
+
+template <class A, class B>
+struct GpioSamePort
+{
+  static constexpr bool value = false;
+};
+
+template <class A>
+struct GpioSamePort<A, A>
+{
+  static constexpr bool value = true;
+};
+
+template <class... Pins>
+struct GpioMask
+{
+  static constexpr uint8_t value = 0;
+};
+
+template <class First, class... Rest>
+struct GpioMask<First, Rest...>
+{
+  static constexpr uint8_t value = First::mask | GpioMask<Rest...>::value;
+};
+
+template <class Port, class... Pins>
+struct GpioOnPort
+{
+  static constexpr bool value = true;
+};
+
+template <class Port, class First, class... Rest>
+struct GpioOnPort<Port, First, Rest...>
+{
+  static constexpr bool value = GpioSamePort<Port, typename First::port_t>::value && GpioOnPort<Port, Rest...>::value;
+};
+
+/// @brief Pins of one port that change together.
+template <class First, class... Rest>
+struct PinGroup : GpioBits<typename First::port_t, GpioMask<First, Rest...>::value>
+{
+  typedef typename First::port_t Port;
+  static_assert(GpioOnPort<Port, Rest...>::value, "All pins of a PinGroup must be on the same port");
+
+  /// @brief Drives the pins of the group whose bit is set in levels high and the others low, in one write.
+  /// @param levels Port bits, e.g. Led1::mask | Led2::mask. Bits outside the group are ignored.
+  static inline void set(uint8_t levels)
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      Port::port() = (Port::port() & (uint8_t)~PinGroup::mask) | (levels & PinGroup::mask);
+    }
+  }
+};
+
+#endif
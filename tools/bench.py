@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""
+Cycle-count benchmarks of every firmware project in simavr.
+
+Builds the bench environment of each project (-D BENCHMARK, cycle probes from
+lib/CycleProbe), boots firmware.elf in simavr with tools/sim_run and collects the
+  BENCH <probe> <count> <min> <max> <mean>
+lines the firmware prints before it stops itself. Results are written as JSON
+and the mean of every probe is compared with tools/bench_baseline.json.
+
+The run fails when a simulator times out or exits non-zero, when a project prints no
+BENCH lines and when a probe of the baseline is missing from the results, so a
+firmware that stops reporting can't pass as "no regressions". --update-baseline
+refuses to store a run that failed.
+
+Usage:
+  python3 tools/bench.py                     build, run, compare
+  python3 tools/bench.py --no-build          use the existing bench builds
+  python3 tools/bench.py --update-baseline   store the results as the new baseline
+  python3 tools/bench.py --threshold 5       fail when a mean is 5% above baseline
+
+Projects in STIMULUS get a pin trace (tools/sim_run.c): Coding_exercise_5 only
+reports its probes when the button on PE4 is pressed, tools/stimulus/button_pe4.trace
+presses it once a second with a bounce.
+
+tools/sim_run is built from tools/sim_run.c, see the build line at its top.
+
+Projects in VARIANTS also run their other bench environments, reported as
+project@env: SoftwareTimers without the timer callback offload (bench_inline),
+for the timer_late_ms and daemon_queue probes of both builds side by side.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BASELINE = os.path.join(ROOT, "tools", "bench_baseline.json")
+SIM_RUN = os.path.join(ROOT, "tools", "sim_run")
+
+PROJECTS = [
+    "Coding_exercise_1",
+    "Coding_exercise_2/Queue_usage",
+    "Coding_exercise_2/Event_groups",
+    "Coding_exercise_4/SoftwareTimers",
+    "Coding_exercise_5/RTOS_Interrupts",
+    "Coding_exercise_6/AutomatedGardeningSystem",
+]
+
+# Extra bench environments of a project, each reported as project@env
+VARIANTS = {
+    "Coding_exercise_4/SoftwareTimers": ["bench_inline"],
+}
+
+# Pin trace of a project for sim_run --trace, relative to tools/
+STIMULUS = {
+    "Coding_exercise_5/RTOS_Interrupts": "stimulus/button_pe4.trace",
+}
+
+BENCH_LINE = re.compile(r"BENCH (\w+) (\d+) (\d+) (\d+) (\d+)")
+
+
+def build(project, env):
+    subprocess.run(["pio", "run", "-d", os.path.join(ROOT, project), "-e", env], check=True)
+
+
+def run(project, env, simulator, sim_args, timeout):
+    """Returns the probes and an error message, None when the simulator ran to the end."""
+    elf = os.path.join(ROOT, project, ".pio", "build", env, "firmware.elf")
+    if project in STIMULUS:
+        sim_args = sim_args + ["--trace", os.path.join(ROOT, "tools", STIMULUS[project])]
+    cmd = simulator.split() + sim_args + [elf]
+    error = None
+    try:
+        proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                              universal_newlines=True, timeout=timeout)
+        out = proc.stdout
+        if proc.returncode != 0:
+            error = "simulator exited with %d" % proc.returncode
+    except subprocess.TimeoutExpired as e:
+        out = e.stdout or ""
+        if isinstance(out, bytes):
+            out = out.decode(errors="replace")
+        error = "simulator timed out after %d s" % timeout
+    probes = {}
+    for m in BENCH_LINE.finditer(out):
+        probes[m.group(1)] = {
+            "count": int(m.group(2)),
+            "min": int(m.group(3)),
+            "max": int(m.group(4)),
+            "mean": int(m.group(5)),
+        }
+    return probes, error
+
+
+def compare(results, baseline, threshold):
+    """Returns the probes whose mean grew more than threshold percent or that are missing."""
+    regressions = []
+    for project, probes in results.items():
+        for probe in sorted(set(baseline.get(project, {})) - set(probes)):
+            regressions.append((project, probe))
+            print("%-45s %-18s %10d %10s  MISSING" % (project, probe, baseline[project][probe]["mean"], "-"))
+        for probe, value in probes.items():
+            old = baseline.get(project, {}).get(probe)
+            if old is None:
+                continue
+            limit = old["mean"] * (100 + threshold) / 100.0
+            status = "ok"
+            if value["mean"] > limit:
+                status = "REGRESSION"
+                regressions.append((project, probe))
+            print("%-45s %-18s %10d %10d  %s" % (project, probe, old["mean"], value["mean"], status))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--no-build", action="store_true")
+    parser.add_argument("--simulator", default=SIM_RUN, help="takes --trace for the projects in STIMULUS")
+    parser.add_argument("--sim-args", default="", help="extra simulator arguments")
+    parser.add_argument("--timeout", type=int, default=300, help="seconds per project")
+    parser.add_argument("--output", default=os.path.join(ROOT, "bench_results.json"))
+    parser.add_argument("--threshold", type=float, default=10.0, help="allowed growth of a mean in percent")
+    parser.add_argument("--update-baseline", action="store_true")
+    parser.add_argument("projects", nargs="*", default=PROJECTS)
+    args = parser.parse_args()
+    if args.simulator == SIM_RUN and not os.path.exists(SIM_RUN):
+        sys.exit("no tools/sim_run, build it from tools/sim_run.c")
+
+    results = {}
+    failures = []
+    for project in args.projects:
+        for env in ["bench"] + VARIANTS.get(project, []):
+            name = project if env == "bench" else "%s@%s" % (project, env)
+            if not args.no_build:
+                build(project, env)
+            results[name], error = run(project, env, args.simulator, args.sim_args.split(), args.timeout)
+            if error is not None:
+                failures.append("%s: %s" % (name, error))
+            if not results[name]:
+                failures.append("%s: no BENCH lines" % name)
+
+    with open(args.output, "w") as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+    print("wrote %s" % os.path.relpath(args.output, ROOT))
+    for failure in failures:
+        print(failure, file=sys.stderr)
+
+    if args.update_baseline:
+        if failures:
+            sys.exit("not updating the baseline from a failed run")
+        with open(BASELINE, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+        print("wrote %s" % os.path.relpath(BASELINE, ROOT))
+        return
+
+    if not os.path.exists(BASELINE):
+        # Nothing to compare with is not a pass
+        sys.exit("no tools/bench_baseline.json, run with --update-baseline on a known good tree and commit it")
+    with open(BASELINE) as f:
+        baseline = json.load(f)
+    print("%-45s %-18s %10s %10s" % ("project", "probe", "baseline", "mean"))
+    if compare(results, baseline, args.threshold) or failures:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
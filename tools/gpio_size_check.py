@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""
+Checks that lib/Gpio compiles to the same code as hand-written register access.
+
+Every case is compiled twice with avr-g++ -Os for the ATmega2560, once through the
+typed GPIO layer and once as the register code it replaces (with the interrupt
+handling the typed version guarantees). The function sizes are read with avr-nm and
+must be equal, pass --disassemble to see the instructions side by side.
+
+Usage:
+  python3 tools/gpio_size_check.py [--cxx avr-g++] [--disassemble]
+
+avr-g++ is taken from PATH or from the PlatformIO toolchain-atmelavr package.
+"""
+
+import argparse
+import glob
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+PRELUDE = """
+#include <avr/interrupt.h>
+#include <Gpio.h>
+typedef Pin<PortB, PB5> Led1;
+typedef Pin<PortB, PB6> Led2;
+typedef Pin<PortB, PB7> Led3;
+typedef Pin<PortH, PH3> Far;
+typedef PinGroup<Led1, Led2, Led3> Leds;
+volatile uint8_t sink;
+"""
+
+# name: (typed GPIO, hand-written)
+CASES = {
+    "output": ("Led1::output();", "DDRB |= _BV(PB5);"),
+    "high": ("Led1::high();", "PORTB |= _BV(PB5);"),
+    "low": ("Led1::low();", "PORTB &= ~_BV(PB5);"),
+    "toggle": ("Led1::toggle();", "PINB = _BV(PB5);"),
+    "read": ("sink = Led1::read();", "sink = PINB & _BV(PB5);"),
+    "group_output": ("Leds::output();",
+                     "uint8_t s = SREG; cli(); DDRB |= _BV(PB5) | _BV(PB6) | _BV(PB7); SREG = s;"),
+    "group_set": ("Leds::set(sink);",
+                    "uint8_t v = sink; uint8_t s = SREG; cli();"
+                    " PORTB = (PORTB & ~(_BV(PB5) | _BV(PB6) | _BV(PB7))) | (v & (_BV(PB5) | _BV(PB6) | _BV(PB7)));"
+                    " SREG = s;"),
+    "group_toggle": ("Leds::toggle();", "PINB = _BV(PB5) | _BV(PB6) | _BV(PB7);"),
+    "far_high": ("Far::high();", "uint8_t s = SREG; cli(); PORTH |= _BV(PH3); SREG = s;"),
+}
+
+
+def find_cxx():
+    cxx = shutil.which("avr-g++")
+    if cxx:
+        return cxx
+    found = glob.glob(os.path.expanduser("~/.platformio/packages/toolchain-atmelavr*/bin/avr-g++"))
+    return found[0] if found else None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--cxx", default=find_cxx())
+    parser.add_argument("--disassemble", action="store_true")
+    args = parser.parse_args()
+    if not args.cxx:
+        sys.exit("avr-g++ not found, install the PlatformIO atmelavr platform or pass --cxx")
+    tools = os.path.dirname(args.cxx)
+
+    source = PRELUDE
+    for name, (typed, raw) in CASES.items():
+        source += "void typed_%s(void) { %s }\nvoid raw_%s(void) { %s }\n" % (name, typed, name, raw)
+
+    with tempfile.TemporaryDirectory() as tmp:
+        src = os.path.join(tmp, "gpio_cases.cpp")
+        obj = os.path.join(tmp, "gpio_cases.o")
+        with open(src, "w") as f:
+            f.write(source)
+        subprocess.run([args.cxx, "-mmcu=atmega2560", "-Os", "-std=gnu++11", "-c",
+                        "-I", os.path.join(ROOT, "lib", "Gpio"), src, "-o", obj], check=True)
+        nm = subprocess.run([os.path.join(tools, "avr-nm"), "-S", "-C", obj],
+                            stdout=subprocess.PIPE, universal_newlines=True, check=True).stdout
+        sizes = {}
+        for line in nm.splitlines():
+            parts = line.split()
+            if len(parts) == 4 and parts[2] in "Tt":
+                sizes[parts[3].split("(")[0]] = int(parts[1], 16)
+        if args.disassemble:
+            print(subprocess.run([os.path.join(tools, "avr-objdump"), "-d", "-C", obj],
+                                 stdout=subprocess.PIPE, universal_newlines=True, check=True).stdout)
+
+    failed = 0
+    print("%-14s %8s %8s" % ("case", "typed", "raw"))
+    for name in CASES:
+        typed, raw = sizes["typed_" + name], sizes["raw_" + name]
+        print("%-14s %8d %8d%s" % (name, typed, raw, "" if typed <= raw else "  LARGER"))
+        failed += typed > raw
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
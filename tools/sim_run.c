@@ -0,0 +1,203 @@
+/*
+Runs a firmware image of the repository in simavr, like the simavr command line,
+in virtual time and with scripted stimulus on the GPIO pins.
+
+simavr itself sleeps for the time the CPU is asleep (avr_callback_sleep_raw), so an
+idle firmware runs at wall-clock speed. Here the cycles asleep are skipped at once:
+when every task is blocked and the idle task sleeps, simulated time jumps to the
+next interrupt, the next tick at the latest. Only the cycles the CPU executes take
+wall-clock time, and since no cycle depends on the host the run is the same every
+time. --realtime keeps the sleeping of simavr, for a peer that runs on wall-clock
+time.
+
+A trace file lists pin changes, one per line, times in milliseconds of simulated
+time from reset:
+
+  # time  pin  level
+  0       E4   1
+  1000    E4   0
+  1100    E4   1
+
+The pin is the port letter and the bit, the level 0 or 1 drives the input like an
+external signal. Times must not go down. Empty lines and lines starting with # are
+skipped.
+
+Build (simavr and libelf development files):
+  cc -O2 -o tools/sim_run tools/sim_run.c $(pkg-config --cflags --libs simavr) -lelf
+Usage:
+  tools/sim_run [--realtime] [--trace tools/stimulus/button_pe4.trace] firmware.elf
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+
+#define F_CPU 16000000UL
+#define MAX_EVENTS 512
+
+struct PinEvent
+{
+  uint32_t ms;
+  char port;
+  uint8_t bit;
+  uint8_t level;
+};
+
+static avr_t *avr;
+static struct PinEvent events[MAX_EVENTS];
+static int eventCount;
+static int nextEvent;
+static unsigned long pinChanges;
+
+static double seconds(void)
+{
+  return (double)avr->cycle / avr->frequency;
+}
+
+static int readTrace(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+  {
+    fprintf(stderr, "sim_run: can't open %s\n", path);
+    return -1;
+  }
+  char line[128];
+  int number = 0;
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    number++;
+    char *text = line + strspn(line, " \t");
+    if (*text == '#' || *text == '\n' || *text == '\0')
+    {
+      continue;
+    }
+    unsigned long ms;
+    char port;
+    unsigned bit, level;
+    if (sscanf(text, "%lu %c%u %u", &ms, &port, &bit, &level) != 4 || port < 'A' || port > 'L' || bit > 7 || level > 1)
+    {
+      fprintf(stderr, "sim_run: %s:%d: expected <ms> <port><bit> <0|1>\n", path, number);
+      fclose(f);
+      return -1;
+    }
+    if (eventCount > 0 && ms < events[eventCount - 1].ms)
+    {
+      fprintf(stderr, "sim_run: %s:%d: time goes down\n", path, number);
+      fclose(f);
+      return -1;
+    }
+    if (eventCount == MAX_EVENTS)
+    {
+      fprintf(stderr, "sim_run: %s: more than %d pin changes\n", path, MAX_EVENTS);
+      fclose(f);
+      return -1;
+    }
+    events[eventCount++] = (struct PinEvent){(uint32_t)ms, port, (uint8_t)bit, (uint8_t)level};
+  }
+  fclose(f);
+  return 0;
+}
+
+static avr_cycle_count_t eventCycle(const struct PinEvent *event)
+{
+  return avr_usec_to_cycles(avr, event->ms * 1000ULL);
+}
+
+/// Virtual time, the cycles asleep pass without waiting
+static void skipSleep(avr_t *core, avr_cycle_count_t howLong)
+{
+}
+
+/// One timer walks the trace, simavr has a small fixed number of cycle timers
+static avr_cycle_count_t pinChange(avr_t *core, avr_cycle_count_t when, void *param)
+{
+  while (nextEvent < eventCount && eventCycle(&events[nextEvent]) <= core->cycle)
+  {
+    struct PinEvent *event = &events[nextEvent++];
+    avr_raise_irq(avr_io_getirq(core, AVR_IOCTL_IOPORT_GETIRQ(event->port), event->bit), event->level);
+    pinChanges++;
+  }
+  // Absolute cycle of the next change, 0 stops the timer
+  return nextEvent < eventCount ? eventCycle(&events[nextEvent]) : 0;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *trace = NULL;
+  const char *path = NULL;
+  int realtime = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--realtime") == 0)
+    {
+      realtime = 1;
+    }
+    else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+    {
+      trace = argv[++i];
+    }
+    else if (path == NULL && argv[i][0] != '-')
+    {
+      path = argv[i];
+    }
+    else
+    {
+      path = NULL;
+      break;
+    }
+  }
+  if (path == NULL)
+  {
+    fprintf(stderr, "usage: %s [--realtime] [--trace file] firmware.elf\n", argv[0]);
+    return 2;
+  }
+  if (trace != NULL && readTrace(trace) != 0)
+  {
+    return 2;
+  }
+
+  elf_firmware_t firmware = {{0}};
+  if (elf_read_firmware(path, &firmware) != 0)
+  {
+    fprintf(stderr, "sim_run: can't read %s\n", path);
+    return 1;
+  }
+  if (firmware.frequency == 0)
+  {
+    firmware.frequency = F_CPU;
+  }
+  avr = avr_make_mcu_by_name(firmware.mmcu[0] ? firmware.mmcu : "atmega2560");
+  if (avr == NULL)
+  {
+    fprintf(stderr, "sim_run: simavr has no %s\n", firmware.mmcu[0] ? firmware.mmcu : "atmega2560");
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  if (!realtime)
+  {
+    // Set by avr_init to avr_callback_sleep_raw
+    avr->sleep = skipSleep;
+  }
+
+  if (eventCount > 0)
+  {
+    // Relative to now, which is the reset
+    avr_cycle_timer_register(avr, eventCycle(&events[0]), pinChange, NULL);
+  }
+
+  int state;
+  do
+  {
+    state = avr_run(avr);
+  } while (state != cpu_Done && state != cpu_Crashed);
+
+  fprintf(stderr, "sim_run: %lu of %d pin changes, %.1f s simulated\n", pinChanges, eventCount, seconds());
+  return state == cpu_Crashed;
+}